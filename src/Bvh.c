@@ -0,0 +1,379 @@
+#include <Bvh.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <threads.h>
+#include <stdatomic.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define BIN_COUNT 16
+//nodes with this few spheres always become leaves
+#define MIN_LEAF_SIZE 2
+//nodes with more spheres are always split, even when SAH says a leaf would be cheaper
+#define MAX_LEAF_SIZE 8
+//cost of visiting a node relative to intersecting one sphere
+#define TRAVERSAL_COST 1.0f
+//subtrees at least this large get their own thread while there are threads left
+#define PARALLEL_THRESHOLD 4096
+
+typedef struct {
+	float min[3], max[3];
+} Bounds;
+
+typedef struct {
+	EngineBvh *bvh;
+	Bounds *sphereBounds;
+	float (*centroids)[3];
+	atomic_uint nodeCount;
+	atomic_int threadsLeft;
+} BuildContext;
+
+typedef struct {
+	BuildContext *ctx;
+	uint32_t node, first, count, depth;
+} BuildTask;
+
+static uint32_t hardwareThreadCount() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+static inline Bounds emptyBounds() {
+	return (Bounds){{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+}
+
+static inline void growBounds(Bounds *bounds, const Bounds *other) {
+	for(int i = 0; i < 3; i++) {
+		bounds->min[i] = other->min[i] < bounds->min[i] ? other->min[i] : bounds->min[i];
+		bounds->max[i] = other->max[i] > bounds->max[i] ? other->max[i] : bounds->max[i];
+	}
+}
+
+static inline float halfArea(const Bounds *bounds) {
+	float x = bounds->max[0] - bounds->min[0];
+	float y = bounds->max[1] - bounds->min[1];
+	float z = bounds->max[2] - bounds->min[2];
+	if(x < 0 || y < 0 || z < 0)
+		return 0;
+	return x * y + y * z + z * x;
+}
+
+static inline uint32_t binIndex(float centroid, float min, float scale) {
+	int32_t bin = (int32_t)((centroid - min) * scale);
+	return bin < 0 ? 0 : (bin >= BIN_COUNT ? BIN_COUNT - 1 : (uint32_t)bin);
+}
+
+static void makeLeaf(EngineBvh *bvh, uint32_t nodeIndex, uint32_t first, uint32_t count) {
+	bvh->nodes[nodeIndex].leftOrFirst = first;
+	bvh->nodes[nodeIndex].count = count;
+	for(uint32_t i = first; i < first + count; i++) {
+		bvh->sphereLeaves[bvh->indices[i]] = nodeIndex;
+	}
+}
+
+static inline Bounds nodeBounds(const EngineBvhNode *node) {
+	Bounds bounds;
+	memcpy(bounds.min, node->boundsMin, sizeof(bounds.min));
+	memcpy(bounds.max, node->boundsMax, sizeof(bounds.max));
+	return bounds;
+}
+
+//what a node adds to the SAH cost
+static inline double nodeCost(const EngineBvhNode *node) {
+	Bounds bounds = nodeBounds(node);
+	return (double)halfArea(&bounds) * (node->count > 0 ? (double)node->count : TRAVERSAL_COST);
+}
+
+//only takes one while there are any left, so the budget never goes below zero
+static bool takeThread(BuildContext *ctx) {
+	int left = atomic_load(&ctx->threadsLeft);
+	while(left > 0) {
+		if(atomic_compare_exchange_weak(&ctx->threadsLeft, &left, left - 1))
+			return true;
+	}
+	return false;
+}
+
+static void buildNode(BuildContext *ctx, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth);
+
+static int buildTaskMain(void *arg) {
+	BuildTask *task = arg;
+	buildNode(task->ctx, task->node, task->first, task->count, task->depth);
+	return 0;
+}
+
+static void buildNode(BuildContext *ctx, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth) {
+	EngineBvhNode *node = &ctx->bvh->nodes[nodeIndex];
+	uint32_t *indices = ctx->bvh->indices + first;
+	Bounds bounds = emptyBounds(), centroidBounds = emptyBounds();
+	for(uint32_t i = 0; i < count; i++) {
+		growBounds(&bounds, &ctx->sphereBounds[indices[i]]);
+		const float *c = ctx->centroids[indices[i]];
+		Bounds point = {{c[0], c[1], c[2]}, {c[0], c[1], c[2]}};
+		growBounds(&centroidBounds, &point);
+	}
+	memcpy(node->boundsMin, bounds.min, sizeof(bounds.min));
+	memcpy(node->boundsMax, bounds.max, sizeof(bounds.max));
+	if(count <= MIN_LEAF_SIZE || depth + 1 >= ENGINE_BVH_MAX_DEPTH) {
+		makeLeaf(ctx->bvh, nodeIndex, first, count);
+		return;
+	}
+
+	//sweep the bins of every axis for the cheapest split
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	uint32_t bestSplit = 0;
+	for(int axis = 0; axis < 3; axis++) {
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		if(!(extent > 0))
+			continue;
+		float scale = BIN_COUNT / extent;
+		Bounds binBounds[BIN_COUNT];
+		uint32_t binCounts[BIN_COUNT] = {0};
+		for(uint32_t i = 0; i < BIN_COUNT; i++) {
+			binBounds[i] = emptyBounds();
+		}
+		for(uint32_t i = 0; i < count; i++) {
+			uint32_t bin = binIndex(ctx->centroids[indices[i]][axis], centroidBounds.min[axis], scale);
+			binCounts[bin]++;
+			growBounds(&binBounds[bin], &ctx->sphereBounds[indices[i]]);
+		}
+		float rightArea[BIN_COUNT];
+		uint32_t rightCount[BIN_COUNT];
+		Bounds sweep = emptyBounds();
+		uint32_t sweepCount = 0;
+		for(uint32_t i = BIN_COUNT - 1; i > 0; i--) {
+			growBounds(&sweep, &binBounds[i]);
+			sweepCount += binCounts[i];
+			rightArea[i] = halfArea(&sweep);
+			rightCount[i] = sweepCount;
+		}
+		sweep = emptyBounds();
+		sweepCount = 0;
+		for(uint32_t split = 1; split < BIN_COUNT; split++) {
+			growBounds(&sweep, &binBounds[split - 1]);
+			sweepCount += binCounts[split - 1];
+			if(sweepCount == 0 || rightCount[split] == 0)
+				continue;
+			float cost = halfArea(&sweep) * sweepCount + rightArea[split] * rightCount[split];
+			if(cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	uint32_t leftCount = 0;
+	if(bestAxis >= 0) {
+		float area = halfArea(&bounds);
+		float splitCost = TRAVERSAL_COST + (area > 0 ? bestCost / area : 0);
+		if(splitCost >= (float)count && count <= MAX_LEAF_SIZE) {
+			makeLeaf(ctx->bvh, nodeIndex, first, count);
+			return;
+		}
+		float scale = BIN_COUNT / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+		uint32_t i = 0, j = count;
+		while(i < j) {
+			if(binIndex(ctx->centroids[indices[i]][bestAxis], centroidBounds.min[bestAxis], scale) < bestSplit) {
+				i++;
+			} else {
+				uint32_t tmp = indices[i];
+				indices[i] = indices[--j];
+				indices[j] = tmp;
+			}
+		}
+		leftCount = i;
+	}
+	if(leftCount == 0 || leftCount == count) {
+		//all centroids in the same spot, no bin can separate them
+		if(count <= MAX_LEAF_SIZE) {
+			makeLeaf(ctx->bvh, nodeIndex, first, count);
+			return;
+		}
+		leftCount = count / 2;
+	}
+
+	uint32_t left = atomic_fetch_add(&ctx->nodeCount, 2);
+	node->leftOrFirst = left;
+	node->count = 0;
+	ctx->bvh->parents[left] = nodeIndex;
+	ctx->bvh->parents[left + 1] = nodeIndex;
+
+	uint32_t rightCount = count - leftCount;
+	BuildTask task = {ctx, left, first, leftCount, depth + 1};
+	thrd_t thread;
+	bool spawned = false;
+	if(leftCount >= PARALLEL_THRESHOLD && rightCount >= PARALLEL_THRESHOLD && takeThread(ctx)) {
+		spawned = thrd_create(&thread, buildTaskMain, &task) == thrd_success;
+		if(!spawned)
+			atomic_fetch_add(&ctx->threadsLeft, 1);
+	}
+	if(!spawned)
+		buildNode(ctx, left, first, leftCount, depth + 1);
+	buildNode(ctx, left + 1, first + leftCount, rightCount, depth + 1);
+	if(spawned) {
+		thrd_join(thread, NULL);
+		atomic_fetch_add(&ctx->threadsLeft, 1);
+	}
+}
+
+EngineResult EngineBvhCreate(EngineBvh *bvh, size_t sphereCapacity) {
+	size_t nodeCapacity = ENGINE_BVH_MAX_NODES(sphereCapacity);
+	*bvh = (EngineBvh){
+		.sphereCapacity = sphereCapacity,
+		.nodes = malloc(sizeof(EngineBvhNode) * nodeCapacity),
+		.indices = malloc(sizeof(uint32_t) * (sphereCapacity > 0 ? sphereCapacity : 1)),
+		.parents = malloc(sizeof(uint32_t) * nodeCapacity),
+		.sphereLeaves = malloc(sizeof(uint32_t) * (sphereCapacity > 0 ? sphereCapacity : 1)),
+		.refitMarks = calloc(nodeCapacity, sizeof(uint32_t)),
+		.refitGeneration = 0,
+	};
+	if(!bvh->nodes || !bvh->indices || !bvh->parents || !bvh->sphereLeaves || !bvh->refitMarks) {
+		EngineBvhDestroy(bvh);
+		return (EngineResult){ENGINE_OUT_OF_MEMORY, 0};
+	}
+	//nothing is in the tree before the first build
+	memset(bvh->sphereLeaves, 0xFF, sizeof(uint32_t) * (sphereCapacity > 0 ? sphereCapacity : 1));
+	return (EngineResult){ENGINE_SUCCESS, 0};
+}
+
+void EngineBvhDestroy(EngineBvh *bvh) {
+	free(bvh->nodes);
+	free(bvh->indices);
+	free(bvh->parents);
+	free(bvh->sphereLeaves);
+	free(bvh->refitMarks);
+	*bvh = (EngineBvh){0};
+}
+
+EngineResult EngineBvhBuild(EngineBvhBuildCI buildCI, const EngineSphere *spheres, size_t sphereCount, EngineBvh *bvh) {
+	if(sphereCount > bvh->sphereCapacity)
+		return (EngineResult){ENGINE_OUT_OF_MEMORY, 0};
+	BuildContext ctx = {
+		.bvh = bvh,
+		.sphereBounds = malloc(sizeof(Bounds) * (sphereCount > 0 ? sphereCount : 1)),
+		.centroids = malloc(sizeof(float[3]) * (sphereCount > 0 ? sphereCount : 1)),
+	};
+	if(ctx.sphereBounds == NULL || ctx.centroids == NULL) {
+		free(ctx.sphereBounds);
+		free(ctx.centroids);
+		return (EngineResult){ENGINE_OUT_OF_MEMORY, 0};
+	}
+	uint32_t count = 0;
+	for(size_t i = 0; i < sphereCount; i++) {
+		bvh->sphereLeaves[i] = ENGINE_BVH_NONE;
+		uint32_t flags = spheres[i].flags;
+		if(!(flags & ENGINE_EXISTS_FLAG) || !(flags & ENGINE_ISACTIVE_FLAG))
+			continue;
+		const float *pos = spheres[i].transformation.translation;
+		float radius = fabsf(spheres[i].radius);
+		for(int axis = 0; axis < 3; axis++) {
+			ctx.sphereBounds[i].min[axis] = pos[axis] - radius;
+			ctx.sphereBounds[i].max[axis] = pos[axis] + radius;
+			ctx.centroids[i][axis] = pos[axis];
+		}
+		bvh->indices[count++] = (uint32_t)i;
+	}
+	for(size_t i = sphereCount; i < bvh->sphereCapacity; i++) {
+		bvh->sphereLeaves[i] = ENGINE_BVH_NONE;
+	}
+	uint32_t threadCount = buildCI.threadCount ? buildCI.threadCount : hardwareThreadCount();
+	//the calling thread does its share too
+	atomic_init(&ctx.threadsLeft, (int)threadCount - 1);
+	atomic_init(&ctx.nodeCount, 1);
+
+	bvh->parents[0] = ENGINE_BVH_NONE;
+	if(count == 0) {
+		Bounds empty = emptyBounds();
+		memcpy(bvh->nodes[0].boundsMin, empty.min, sizeof(empty.min));
+		memcpy(bvh->nodes[0].boundsMax, empty.max, sizeof(empty.max));
+		makeLeaf(bvh, 0, 0, 0);
+	} else {
+		buildNode(&ctx, 0, 0, count, 0);
+	}
+	bvh->nodeCount = atomic_load(&ctx.nodeCount);
+	bvh->indexCount = count;
+	bvh->costSum = 0;
+	for(uint32_t i = 0; i < bvh->nodeCount; i++) {
+		bvh->costSum += nodeCost(&bvh->nodes[i]);
+	}
+	free(ctx.sphereBounds);
+	free(ctx.centroids);
+	return (EngineResult){ENGINE_SUCCESS, 0};
+}
+
+//returns whether the bounds changed
+static bool refitNode(EngineBvh *bvh, const EngineSphere *spheres, uint32_t nodeIndex) {
+	EngineBvhNode *node = &bvh->nodes[nodeIndex];
+	Bounds bounds = emptyBounds();
+	if(node->count > 0) {
+		for(uint32_t i = node->leftOrFirst; i < node->leftOrFirst + node->count; i++) {
+			const EngineSphere *sphere = &spheres[bvh->indices[i]];
+			float radius = fabsf(sphere->radius);
+			Bounds sphereBounds;
+			for(int axis = 0; axis < 3; axis++) {
+				sphereBounds.min[axis] = sphere->transformation.translation[axis] - radius;
+				sphereBounds.max[axis] = sphere->transformation.translation[axis] + radius;
+			}
+			growBounds(&bounds, &sphereBounds);
+		}
+	} else {
+		Bounds left = nodeBounds(&bvh->nodes[node->leftOrFirst]);
+		Bounds right = nodeBounds(&bvh->nodes[node->leftOrFirst + 1]);
+		growBounds(&bounds, &left);
+		growBounds(&bounds, &right);
+	}
+	if(!memcmp(bounds.min, node->boundsMin, sizeof(bounds.min)) && !memcmp(bounds.max, node->boundsMax, sizeof(bounds.max)))
+		return false;
+	bvh->costSum -= nodeCost(node);
+	memcpy(node->boundsMin, bounds.min, sizeof(bounds.min));
+	memcpy(node->boundsMax, bounds.max, sizeof(bounds.max));
+	bvh->costSum += nodeCost(node);
+	return true;
+}
+
+uint32_t EngineBvhRefit(EngineBvh *bvh, const EngineSphere *spheres, const uint32_t *sphereIndices, uint32_t count, uint32_t *changedNodes) {
+	//marks make sure every node is reported once; a new generation saves clearing them
+	uint32_t generation = ++bvh->refitGeneration;
+	if(generation == 0) {
+		memset(bvh->refitMarks, 0, sizeof(uint32_t) * ENGINE_BVH_MAX_NODES(bvh->sphereCapacity));
+		generation = bvh->refitGeneration = 1;
+	}
+	uint32_t changedCount = 0;
+	for(uint32_t i = 0; i < count; i++) {
+		if(sphereIndices[i] >= bvh->sphereCapacity)
+			continue;
+		//walks up until a node's bounds stop changing, anything above it already covers the new position
+		uint32_t node = bvh->sphereLeaves[sphereIndices[i]];
+		while(node != ENGINE_BVH_NONE && refitNode(bvh, spheres, node)) {
+			if(bvh->refitMarks[node] != generation) {
+				bvh->refitMarks[node] = generation;
+				changedNodes[changedCount++] = node;
+			}
+			node = bvh->parents[node];
+		}
+	}
+	return changedCount;
+}
+
+double EngineBvhCost(const EngineBvh *bvh) {
+	if(bvh->indexCount == 0)
+		return 0;
+	Bounds root = nodeBounds(&bvh->nodes[0]);
+	float rootArea = halfArea(&root);
+	return rootArea > 0 ? bvh->costSum / rootArea : 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Engine.h>
+
+/*
+ * Bounding volume hierarchy over the sphere buffer, built with binned SAH.
+ * The nodes are laid out exactly the way raytrace.comp reads them from its BvhNodes binding:
+ * the two children of a node are always next to each other, so a node only stores the index of the left one.
+ */
+
+//also the size of the shader's traversal stack; the builder turns everything below it into leaves
+#define ENGINE_BVH_MAX_DEPTH 32
+//parent of the root, and leaf of every sphere that was left out of the tree
+#define ENGINE_BVH_NONE UINT32_MAX
+
+typedef struct {
+    float boundsMin[3];
+    uint32_t leftOrFirst; //inner nodes: the left child, the right one is leftOrFirst + 1; leaves: first entry of the index array
+    float boundsMax[3];
+    uint32_t count; //spheres in a leaf, 0 for inner nodes
+} EngineBvhNode;
+
+typedef struct {
+    size_t sphereCapacity;
+    //what the shader reads
+    EngineBvhNode *nodes;
+    uint32_t *indices;
+    uint32_t nodeCount, indexCount;
+    //host only, for refitting
+    uint32_t *parents;
+    uint32_t *sphereLeaves;
+    uint32_t *refitMarks;
+    uint32_t refitGeneration;
+    double costSum; //SAH cost before dividing by the root's area
+} EngineBvh;
+
+typedef struct {
+    uint32_t threadCount; //0 picks one thread per hardware thread
+} EngineBvhBuildCI;
+
+//node capacity needed for sphereCount spheres
+#define ENGINE_BVH_MAX_NODES(sphereCount) ((sphereCount) > 0 ? 2 * (sphereCount) - 1 : 1)
+
+EngineResult EngineBvhCreate(EngineBvh *bvh, size_t sphereCapacity);
+void EngineBvhDestroy(EngineBvh *bvh);
+
+//only spheres that exist and are active are added; without any the root has count and leftOrFirst 0, which the shader skips
+EngineResult EngineBvhBuild(EngineBvhBuildCI buildCI, const EngineSphere *spheres, size_t sphereCount, EngineBvh *bvh);
+//moves the bounds of the leaves holding the given spheres, and of everything above them, to where the spheres are now;
+//spheres outside the tree are ignored. Every node whose bounds changed ends up in changedNodes once, returns how many did
+uint32_t EngineBvhRefit(EngineBvh *bvh, const EngineSphere *spheres, const uint32_t *sphereIndices, uint32_t count, uint32_t *changedNodes);
+//SAH cost in sphere intersections per ray that hits the root; refits make it grow as the tree drifts away from the scene
+double EngineBvhCost(const EngineBvh *bvh);
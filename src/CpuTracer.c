@@ -0,0 +1,857 @@
+#include <CpuTracer.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <threads.h>
+#include <stdatomic.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * PACKET_WIDTH rays are intersected with the sphere list at once.
+ * Every lane does the exact same float operations in the same order as castRay below,
+ * so a packet gives bit-identical hits to tracing its rays one by one.
+ */
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PACKET_WIDTH 8
+typedef __m256 vfloat;
+#define vset1 _mm256_set1_ps
+#define vsetindex(i) _mm256_castsi256_ps(_mm256_set1_epi32((int32_t)(i)))
+#define vload _mm256_loadu_ps
+#define vstore _mm256_storeu_ps
+#define vadd _mm256_add_ps
+#define vsub _mm256_sub_ps
+#define vmul _mm256_mul_ps
+#define vdiv _mm256_div_ps
+#define vsqrt _mm256_sqrt_ps
+#define vand _mm256_and_ps
+#define vandnot _mm256_andnot_ps
+#define vor _mm256_or_ps
+#define vxor _mm256_xor_ps
+#define vlt(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define vgt(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define vmovemask _mm256_movemask_ps
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PACKET_WIDTH 4
+typedef __m128 vfloat;
+#define vset1 _mm_set1_ps
+#define vsetindex(i) _mm_castsi128_ps(_mm_set1_epi32((int32_t)(i)))
+#define vload _mm_loadu_ps
+#define vstore _mm_storeu_ps
+#define vadd _mm_add_ps
+#define vsub _mm_sub_ps
+#define vmul _mm_mul_ps
+#define vdiv _mm_div_ps
+#define vsqrt _mm_sqrt_ps
+#define vand _mm_and_ps
+#define vandnot _mm_andnot_ps
+#define vor _mm_or_ps
+#define vxor _mm_xor_ps
+#define vlt _mm_cmplt_ps
+#define vgt _mm_cmpgt_ps
+#define vmovemask _mm_movemask_ps
+#else
+#define PACKET_WIDTH 1
+#endif
+
+#if PACKET_WIDTH > 1
+#define vselect(mask, a, b) vor(vand(mask, a), vandnot(mask, b))
+#endif
+
+/*constants of raytrace.comp*/
+#define OBJECT_NOTHING 0
+#define OBJECT_SPHERE 1
+#define OBJECT_PLANE 2
+#define CASTRAY_MISS_LENGTH 50
+#define MIN_INTERSECTION 0.005f
+#define MIN_OFFSET (MIN_INTERSECTION * 2)
+#define MIN_LUMINOSITY 0.05f
+#define MAX_RAYS_BOUNCE_SIZE 20
+#define MAX_SHADOW_RAYS_BOUNCE_SIZE 6
+#define WEIGHT_THRESHOLD 0.1f
+#define WORLD_ETA 1.0f
+#define SHADER_UINT32_MAX 4294967296.0f
+
+#define DEFAULT_TILE_SIZE 16
+#define NO_TILE UINT32_MAX
+
+typedef struct {
+	float x, y, z;
+} v3;
+
+typedef struct {
+	float x, y, z, w;
+} v4;
+
+static inline v3 v3add(v3 a, v3 b) { return (v3){a.x + b.x, a.y + b.y, a.z + b.z}; }
+static inline v3 v3sub(v3 a, v3 b) { return (v3){a.x - b.x, a.y - b.y, a.z - b.z}; }
+static inline v3 v3scale(v3 a, float s) { return (v3){a.x * s, a.y * s, a.z * s}; }
+static inline v3 v3neg(v3 a) { return (v3){-a.x, -a.y, -a.z}; }
+static inline float v3dot(v3 a, v3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static inline v3 v3cross(v3 a, v3 b) {
+	return (v3){a.y * b.z - b.y * a.z, a.z * b.x - b.z * a.x, a.x * b.y - b.x * a.y};
+}
+static inline v3 v3normalize(v3 a) {
+	float length = sqrtf(v3dot(a, a));
+	return (v3){a.x / length, a.y / length, a.z / length};
+}
+static inline v3 v3mix(v3 a, v3 b, float t) {
+	return v3add(v3scale(a, 1 - t), v3scale(b, t));
+}
+static inline v3 v3arr(const float arr[3]) { return (v3){arr[0], arr[1], arr[2]}; }
+
+static inline v4 v4add(v4 a, v4 b) { return (v4){a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w}; }
+static inline v4 v4mul(v4 a, v4 b) { return (v4){a.x * b.x, a.y * b.y, a.z * b.z, a.w * b.w}; }
+static inline v4 v4scale(v4 a, float s) { return (v4){a.x * s, a.y * s, a.z * s, a.w * s}; }
+static inline v4 v4normalize(v4 a) {
+	float length = sqrtf(a.x * a.x + a.y * a.y + a.z * a.z + a.w * a.w);
+	return (v4){a.x / length, a.y / length, a.z / length, a.w / length};
+}
+static inline v4 v4mix(v4 a, v4 b, float t) {
+	return v4add(v4scale(a, 1 - t), v4scale(b, t));
+}
+static inline v4 v4arr(const float arr[4]) { return (v4){arr[0], arr[1], arr[2], arr[3]}; }
+static inline float clampf(float val, float min, float max) { return fminf(fmaxf(val, min), max); }
+
+typedef struct {
+	v3 origin, direction;
+} Ray;
+
+typedef struct {
+	uint32_t objectType;
+	uint32_t hitIndex;
+	float hitLength;
+	v3 hitCoord;
+} CastRayResult;
+
+typedef struct {
+	float roughness, refraction, metallic;
+	v4 color;
+} Material;
+
+typedef struct {
+	float val;
+	uint32_t seed;
+} RandomResult;
+
+typedef struct {
+	Ray reflectRay, refractRay;
+	bool refracted, frontFace;
+	float reflectance;
+} RayBounceResult;
+
+/*everything a frame needs, laid out for the tracer*/
+typedef struct {
+	//structure-of-arrays copy of the spheres that exist and are active
+	float *posX, *posY, *posZ, *radius2;
+	uint32_t *index;
+	size_t activeCount, capacity;
+
+	const EngineSphere *spheres;
+	const EngineMaterial *materials;
+	size_t sphereCount, materialCount;
+	v4 sunData, sunColor;
+	v3 cameraOrigin, right, up, front;
+	float screenToViewport[3][4];
+
+	EngineCpuFrameInfo frame;
+	uint32_t maxRays, tilesX, tilesY, tileSize;
+} CpuJob;
+
+/*[begin, end) range of tile indices packed into one word, begin in the low half*/
+typedef struct {
+	_Atomic uint64_t range;
+	char padding[64 - sizeof(uint64_t)];
+} TileQueue;
+
+typedef struct {
+	EngineCpuTracer *tracer;
+	uint32_t index;
+} WorkerContext;
+
+struct EngineCpuTracer {
+	uint32_t threadCount, tileSize;
+	thrd_t *threads;
+	WorkerContext *contexts;
+	TileQueue *queues;
+
+	mtx_t lock;
+	cnd_t jobReady, jobDone;
+	uint64_t jobGeneration;
+	uint32_t workersBusy;
+	bool quitting;
+
+	CpuJob job;
+};
+
+static inline uint64_t packRange(uint32_t begin, uint32_t end) {
+	return (uint64_t)begin | ((uint64_t)end << 32);
+}
+
+static uint32_t hardwareThreadCount() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+static inline RandomResult shaderRand(uint32_t seed) {
+	uint32_t state = seed * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	seed = (word >> 22u) ^ word;
+	return (RandomResult){(float)seed / SHADER_UINT32_MAX, seed};
+}
+
+static void setScreenToViewport(CpuJob *job, EngineTransformation t) {
+	v3 s = {sinf(t.rotation[0]), sinf(t.rotation[1]), sinf(t.rotation[2])};
+	v3 c = {cosf(t.rotation[0]), cosf(t.rotation[1]), cosf(t.rotation[2])};
+	//rows of GenerateTransformationMatrix's result
+	float m[3][4] = {
+		{t.scale[0]*c.y*c.z, -s.x*s.y*c.z - c.x*s.y, s.x*s.z - c.x*s.y*c.z, t.translation[0]},
+		{c.y*s.x, t.scale[1]*(c.x*c.z - s.x*s.y*s.z), -s.x*c.z - c.x*s.y*s.z, t.translation[1]},
+		{s.y, s.x*c.y, t.scale[2]*c.x*c.y, t.translation[2]},
+	};
+	memcpy(job->screenToViewport, m, sizeof(m));
+}
+
+static Ray rayGenerate(const CpuJob *job, uint32_t x, uint32_t y) {
+	float p[4] = {(float)x, (float)y, 2, 1};
+	float dir[3];
+	for(size_t i = 0; i < 3; i++) {
+		const float *row = job->screenToViewport[i];
+		dir[i] = row[0] * p[0] + row[1] * p[1] + row[2] * p[2] + row[3] * p[3];
+	}
+	v3 direction = v3normalize(v3add(v3add(v3scale(job->right, dir[0]), v3scale(job->up, dir[1])), v3scale(job->front, dir[2])));
+	return (Ray){job->cameraOrigin, direction};
+}
+
+//the plane loop at the end of the shader's castRay
+static void castRayPlanes(Ray ray, CastRayResult *result) {
+	const v3 planeNormal = {0, 1, 0};
+	const v3 planeOrigin = {0, -1, 0};
+	float nd = v3dot(planeNormal, ray.direction);
+	if(nd >= 0) {
+		return;
+	}
+	float intersectionDistance = v3dot(planeNormal, v3sub(planeOrigin, ray.origin)) / nd;
+	if(intersectionDistance < MIN_INTERSECTION) {
+		return;
+	}
+	if(intersectionDistance < result->hitLength) {
+		result->hitCoord = v3add(ray.origin, v3scale(ray.direction, intersectionDistance));
+		result->hitLength = intersectionDistance;
+		result->objectType = OBJECT_PLANE;
+		result->hitIndex = 0;
+	}
+}
+
+static CastRayResult castRay(const CpuJob *job, Ray ray) {
+	CastRayResult result = {OBJECT_NOTHING, 0, CASTRAY_MISS_LENGTH, {0, 0, 0}};
+	for(size_t i = 0; i < job->activeCount; i++) {
+		v3 q = {ray.origin.x - job->posX[i], ray.origin.y - job->posY[i], ray.origin.z - job->posZ[i]};
+		float b = 2 * v3dot(ray.direction, q);
+		float c = v3dot(q, q) - job->radius2[i];
+		float discriminant = b*b - 4*c;
+		if(discriminant <= 0) {
+			continue;
+		}
+		float root = sqrtf(discriminant);
+		float intersectionDistance = (-b - root) / 2;
+		float secondDistance = (-b + root) / 2;
+		if((secondDistance < intersectionDistance || intersectionDistance < MIN_INTERSECTION) && secondDistance > 0) {
+			intersectionDistance = secondDistance;
+		}
+		if(intersectionDistance < MIN_INTERSECTION) {
+			continue;
+		}
+		if(intersectionDistance < result.hitLength) {
+			result.hitLength = intersectionDistance;
+			result.objectType = OBJECT_SPHERE;
+			result.hitIndex = job->index[i];
+		}
+	}
+	if(result.objectType == OBJECT_SPHERE) {
+		result.hitCoord = v3add(ray.origin, v3scale(ray.direction, result.hitLength));
+	}
+	castRayPlanes(ray, &result);
+	return result;
+}
+
+#if PACKET_WIDTH > 1
+static void castRayPacket(const CpuJob *job, const Ray *rays, CastRayResult *results) {
+	float lanes[6][PACKET_WIDTH];
+	for(size_t l = 0; l < PACKET_WIDTH; l++) {
+		lanes[0][l] = rays[l].origin.x;
+		lanes[1][l] = rays[l].origin.y;
+		lanes[2][l] = rays[l].origin.z;
+		lanes[3][l] = rays[l].direction.x;
+		lanes[4][l] = rays[l].direction.y;
+		lanes[5][l] = rays[l].direction.z;
+	}
+	vfloat ox = vload(lanes[0]), oy = vload(lanes[1]), oz = vload(lanes[2]);
+	vfloat dx = vload(lanes[3]), dy = vload(lanes[4]), dz = vload(lanes[5]);
+	const vfloat zero = vset1(0), two = vset1(2), four = vset1(4);
+	const vfloat minIntersection = vset1(MIN_INTERSECTION), signMask = vset1(-0.0f);
+	vfloat hitLength = vset1(CASTRAY_MISS_LENGTH);
+	vfloat hitSlot = vsetindex(-1);
+
+	for(size_t i = 0; i < job->activeCount; i++) {
+		vfloat qx = vsub(ox, vset1(job->posX[i]));
+		vfloat qy = vsub(oy, vset1(job->posY[i]));
+		vfloat qz = vsub(oz, vset1(job->posZ[i]));
+		vfloat b = vmul(two, vadd(vadd(vmul(dx, qx), vmul(dy, qy)), vmul(dz, qz)));
+		vfloat c = vsub(vadd(vadd(vmul(qx, qx), vmul(qy, qy)), vmul(qz, qz)), vset1(job->radius2[i]));
+		vfloat discriminant = vsub(vmul(b, b), vmul(four, c));
+		vfloat valid = vgt(discriminant, zero);
+		if(!vmovemask(valid)) {
+			continue;
+		}
+		vfloat root = vsqrt(discriminant);
+		vfloat negB = vxor(b, signMask);
+		vfloat first = vdiv(vsub(negB, root), two);
+		vfloat second = vdiv(vadd(negB, root), two);
+		vfloat useSecond = vand(vor(vlt(second, first), vlt(first, minIntersection)), vgt(second, zero));
+		vfloat distance = vselect(useSecond, second, first);
+		vfloat closer = vand(valid, vandnot(vlt(distance, minIntersection), vlt(distance, hitLength)));
+		hitLength = vselect(closer, distance, hitLength);
+		hitSlot = vselect(closer, vsetindex(i), hitSlot);
+	}
+
+	float lengths[PACKET_WIDTH];
+	int32_t slots[PACKET_WIDTH];
+	vstore(lengths, hitLength);
+	vstore((float*)slots, hitSlot);
+	for(size_t l = 0; l < PACKET_WIDTH; l++) {
+		CastRayResult result = {OBJECT_NOTHING, 0, CASTRAY_MISS_LENGTH, {0, 0, 0}};
+		if(slots[l] >= 0) {
+			result.objectType = OBJECT_SPHERE;
+			result.hitIndex = job->index[slots[l]];
+			result.hitLength = lengths[l];
+			result.hitCoord = v3add(rays[l].origin, v3scale(rays[l].direction, lengths[l]));
+		}
+		castRayPlanes(rays[l], &result);
+		results[l] = result;
+	}
+}
+#endif
+
+static Material getMaterial(const CpuJob *job, CastRayResult hitObj) {
+	Material material = {0};
+	material.color = (v4){-1, -1, -1, -1};
+	switch(hitObj.objectType) {
+		case OBJECT_PLANE:
+			material.color = (v4){1, 1, 0, 1};
+			material.metallic = 0;
+			material.roughness = 0.8f;
+			material.refraction = 0;
+			break;
+		case OBJECT_SPHERE: {
+			uint32_t index = job->spheres[hitObj.hitIndex].materialID;
+			if(index >= job->materialCount) {
+				material = (Material){0};
+				break;
+			}
+			const EngineMaterial *src = &job->materials[index];
+			material.roughness = src->roughness;
+			material.refraction = src->refraction;
+			material.metallic = src->metallic;
+			material.color = v4arr(src->color);
+			break;
+		}
+	}
+	return material;
+}
+
+static v3 getNormal(const CpuJob *job, CastRayResult hitObj) {
+	switch(hitObj.objectType) {
+		case OBJECT_PLANE:
+			return (v3){0, 1, 0};
+		case OBJECT_SPHERE: {
+			v3 spherePos = v3arr(job->spheres[hitObj.hitIndex].transformation.translation);
+			return v3normalize(v3sub(hitObj.hitCoord, spherePos));
+		}
+	}
+	return (v3){0, 0, 0};
+}
+
+static float getReflectance(v3 rayDir, v3 normal, float curEta, float refractionIndex, float metallic) {
+	float r0 = (curEta - refractionIndex) / (curEta + refractionIndex);
+	r0 *= r0;
+	float cosX = -v3dot(normal, rayDir);
+	if(curEta > refractionIndex) {
+		float n = curEta / refractionIndex;
+		float sinT2 = n*n*(1.0f - cosX*cosX);
+		//total internal reflection
+		if(sinT2 > 1.0f)
+			return 1.0f;
+		cosX = sqrtf(1.0f - sinT2);
+	}
+	float x = 1.0f - cosX;
+	float ret = r0 + (1.0f - r0)*x*x*x*x*x;
+	return metallic + (1.0f - metallic) * ret;
+}
+
+static v3 reflect(v3 i, v3 n) {
+	return v3sub(i, v3scale(n, 2 * v3dot(n, i)));
+}
+
+static v3 refract(v3 i, v3 n, float eta) {
+	float d = v3dot(n, i);
+	float k = 1 - eta * eta * (1 - d * d);
+	if(k < 0) {
+		return (v3){0, 0, 0};
+	}
+	return v3sub(v3scale(i, eta), v3scale(n, eta * d + sqrtf(k)));
+}
+
+static RayBounceResult calculateRayBounce(const CpuJob *job, RandomResult *res, Ray incomingRay, CastRayResult hit, float currentRefraction) {
+	RayBounceResult result = {0};
+
+	v3 normal = getNormal(job, hit);
+	v3 incomingDir = v3neg(incomingRay.direction);
+	result.frontFace = v3dot(incomingDir, normal) >= 0;
+	if(!result.frontFace) {
+		normal = v3scale(normal, -1);
+	}
+	v3 differenceVector = v3normalize(v3sub(normal, incomingDir));
+	v3 perpVector = v3normalize(v3cross(normal, incomingDir));
+	*res = shaderRand(res->seed);
+	float randValue1 = v3dot(incomingDir, normal)*(2*res->val - 1);
+	*res = shaderRand(res->seed);
+	float randValue2 = v3dot(incomingDir, normal)*(2*res->val - 1);
+	v3 roughDir = v3normalize(v3add(normal, v3add(v3scale(differenceVector, randValue1), v3scale(perpVector, randValue2))));
+
+	Material material = getMaterial(job, hit);
+
+	*res = shaderRand(res->seed);
+	v3 refractDir = {0, 0, 0};
+	if(res->val >= material.metallic && material.refraction != 0) {
+		result.reflectance = getReflectance(incomingRay.direction, normal, currentRefraction, material.refraction, material.metallic);
+		currentRefraction /= material.refraction;
+		refractDir = v3normalize(refract(incomingRay.direction, normal, currentRefraction));
+	}
+	result.refracted = refractDir.x != 0 || refractDir.y != 0 || refractDir.z != 0;
+	v3 reflectDir = v3normalize(reflect(incomingRay.direction, normal));
+
+	result.reflectRay.direction = v3mix(reflectDir, roughDir, material.roughness);
+	result.reflectRay.origin = v3add(hit.hitCoord, v3scale(normal, MIN_OFFSET));
+
+	result.refractRay.direction = v3mix(refractDir, roughDir, material.roughness);
+	result.refractRay.origin = v3sub(hit.hitCoord, v3scale(normal, MIN_OFFSET));
+	return result;
+}
+
+static v4 calculateColor(const CpuJob *job, RandomResult *res, CastRayResult hitObj, const float stack[MAX_RAYS_BOUNCE_SIZE], uint32_t refractionCount) {
+	if(hitObj.objectType == OBJECT_NOTHING) {
+		return (v4){-1, -1, -1, -1};
+	}
+	float refractionStack[MAX_RAYS_BOUNCE_SIZE];
+	memcpy(refractionStack, stack, sizeof(refractionStack));
+
+	Material material = getMaterial(job, hitObj);
+	v3 normal = getNormal(job, hitObj);
+	v4 color = v4scale(material.color, MIN_LUMINOSITY);
+	v3 sunDir = v3normalize((v3){job->sunData.x, job->sunData.y, job->sunData.z});
+
+	Ray shadowRay = {v3add(hitObj.hitCoord, v3scale(normal, MIN_OFFSET)), v3neg(sunDir)};
+	float accumulatedWeight = 1;
+
+	for(uint32_t shadowRayCount = 0; shadowRayCount < MAX_SHADOW_RAYS_BOUNCE_SIZE; shadowRayCount++) {
+		CastRayResult shadowRayHit = castRay(job, shadowRay);
+		float curWeight = clampf(v3dot(shadowRay.direction, v3neg(sunDir)), 0, 1);
+		if(shadowRayHit.objectType == OBJECT_NOTHING) {
+			accumulatedWeight *= curWeight;
+			break;
+		}
+		//shadows the outer material like the shader does
+		Material shadowMaterial = getMaterial(job, shadowRayHit);
+		curWeight *= 1 - shadowMaterial.roughness;
+		accumulatedWeight *= curWeight;
+		if(accumulatedWeight <= WEIGHT_THRESHOLD) {
+			break;
+		}
+		float curEta = refractionCount > 0 ? refractionStack[refractionCount-1] : WORLD_ETA;
+
+		RayBounceResult rayBounce = calculateRayBounce(job, res, shadowRay, shadowRayHit, curEta);
+		*res = shaderRand(res->seed);
+		if(rayBounce.refracted) {
+			if(refractionCount > 0) {
+				refractionCount--;
+			} else if(rayBounce.frontFace) {
+				refractionStack[refractionCount] = shadowMaterial.refraction;
+				refractionCount++;
+			}
+		}
+		shadowRay = rayBounce.refracted ? rayBounce.refractRay : rayBounce.reflectRay;
+	}
+	float sunLuminosity = clampf(-v3dot(normal, sunDir), 0, 1) * (MIN_LUMINOSITY + job->sunData.w) * accumulatedWeight;
+	v4 diffuseComponent = v4scale(v4mul(material.color, v4normalize(job->sunColor)), sunLuminosity);
+	return v4add(color, diffuseComponent);
+}
+
+/*state of one invocation of the shader's main()*/
+typedef struct {
+	CastRayResult rayPath[MAX_RAYS_BOUNCE_SIZE];
+	float weight[MAX_RAYS_BOUNCE_SIZE];
+	float refractionStack[MAX_RAYS_BOUNCE_SIZE];
+	float accumulatedWeight;
+	uint32_t refractionCount, rayCount;
+	RandomResult res;
+	Ray mainRay;
+	bool active;
+} PathState;
+
+static void pathStart(const CpuJob *job, PathState *path, uint32_t x, uint32_t y) {
+	//arrays the shader leaves uninitialised are zeroed
+	memset(path, 0, sizeof(*path));
+	path->accumulatedWeight = 1;
+	path->weight[0] = 1;
+	path->mainRay = rayGenerate(job, x, y);
+	uint32_t seed = (y * job->frame.width + x) * job->frame.initialSeed;
+	path->res = shaderRand(seed);
+	path->active = job->maxRays > 0;
+}
+
+//one iteration of the first loop of main(); false means the loop is done
+static bool pathStep(const CpuJob *job, PathState *path, CastRayResult hit) {
+	uint32_t rayCount = path->rayCount;
+	path->weight[rayCount] = 1;
+	path->rayPath[rayCount] = hit;
+	if(hit.objectType == OBJECT_NOTHING) {
+		return false;
+	}
+	Material material = getMaterial(job, hit);
+	path->weight[rayCount] = 1 - material.roughness;
+	path->accumulatedWeight *= path->weight[rayCount];
+	if(path->accumulatedWeight <= WEIGHT_THRESHOLD) {
+		path->rayCount++;
+		return false;
+	}
+	float curEta = path->refractionCount > 0 ? path->refractionStack[path->refractionCount-1] : WORLD_ETA;
+
+	RayBounceResult rayBounce = calculateRayBounce(job, &path->res, path->mainRay, hit, curEta);
+	path->res = shaderRand(path->res.seed);
+	bool chosenRay = rayBounce.refracted && rayBounce.reflectance <= path->res.val;
+	if(chosenRay) {
+		if(path->refractionCount > 0) {
+			path->refractionCount--;
+		} else if(rayBounce.frontFace) {
+			path->refractionStack[path->refractionCount] = material.refraction;
+			path->refractionCount++;
+		}
+	}
+	path->mainRay = chosenRay ? rayBounce.refractRay : rayBounce.reflectRay;
+	path->rayCount++;
+	return path->rayCount < job->maxRays;
+}
+
+//the second loop of main(), walking the path back to the camera
+static void pathFinish(const CpuJob *job, PathState *path, float *pixel) {
+	if(path->rayCount == 0) {
+		memcpy(pixel, job->frame.background, sizeof(float) * 4);
+		return;
+	}
+	v4 color = {0.1f, 0.5f, 0.9f, 1};
+	uint32_t rayCount = path->rayCount < job->maxRays - 1 ? path->rayCount : job->maxRays - 1;
+	while(rayCount < job->maxRays) {
+		color = v4scale(color, path->weight[rayCount]);
+		if(path->rayPath[rayCount].objectType == OBJECT_NOTHING) {
+			rayCount--;
+			continue;
+		}
+		v4 curColor = calculateColor(job, &path->res, path->rayPath[rayCount], path->refractionStack, path->refractionCount);
+		color = v4mix(curColor, color, path->weight[rayCount]);
+		rayCount--;
+	}
+	pixel[0] = color.x;
+	pixel[1] = color.y;
+	pixel[2] = color.z;
+	pixel[3] = color.w;
+}
+
+static void traceSpan(const CpuJob *job, uint32_t x, uint32_t y, uint32_t count) {
+	PathState paths[PACKET_WIDTH];
+	for(uint32_t l = 0; l < count; l++) {
+		pathStart(job, &paths[l], x + l, y);
+	}
+#if PACKET_WIDTH > 1
+	for(;;) {
+		Ray rays[PACKET_WIDTH] = {0};
+		CastRayResult hits[PACKET_WIDTH];
+		bool anyActive = false;
+		for(uint32_t l = 0; l < count; l++) {
+			if(paths[l].active) {
+				rays[l] = paths[l].mainRay;
+				anyActive = true;
+			}
+		}
+		if(!anyActive) {
+			break;
+		}
+		castRayPacket(job, rays, hits);
+		for(uint32_t l = 0; l < count; l++) {
+			if(paths[l].active) {
+				paths[l].active = pathStep(job, &paths[l], hits[l]);
+			}
+		}
+	}
+#else
+	while(paths[0].active) {
+		paths[0].active = pathStep(job, &paths[0], castRay(job, paths[0].mainRay));
+	}
+#endif
+	float *row = job->frame.pixels + ((size_t)y * job->frame.width + x) * 4;
+	for(uint32_t l = 0; l < count; l++) {
+		pathFinish(job, &paths[l], row + l * 4);
+	}
+}
+
+static void renderTile(const CpuJob *job, uint32_t tile) {
+	uint32_t x0 = (tile % job->tilesX) * job->tileSize;
+	uint32_t y0 = (tile / job->tilesX) * job->tileSize;
+	uint32_t x1 = x0 + job->tileSize < job->frame.width ? x0 + job->tileSize : job->frame.width;
+	uint32_t y1 = y0 + job->tileSize < job->frame.height ? y0 + job->tileSize : job->frame.height;
+	for(uint32_t y = y0; y < y1; y++) {
+		for(uint32_t x = x0; x < x1; x += PACKET_WIDTH) {
+			traceSpan(job, x, y, x1 - x < PACKET_WIDTH ? x1 - x : PACKET_WIDTH);
+		}
+	}
+}
+
+//the owner takes tiles from the front of its own range
+static uint32_t popTile(TileQueue *queue) {
+	uint64_t range = atomic_load(&queue->range);
+	for(;;) {
+		uint32_t begin = (uint32_t)range, end = (uint32_t)(range >> 32);
+		if(begin >= end) {
+			return NO_TILE;
+		}
+		if(atomic_compare_exchange_weak(&queue->range, &range, packRange(begin + 1, end))) {
+			return begin;
+		}
+	}
+}
+
+//thieves take the back half of somebody else's range and make it their own
+static bool stealTiles(EngineCpuTracer *tracer, uint32_t thief) {
+	for(uint32_t i = 1; i < tracer->threadCount; i++) {
+		TileQueue *victim = &tracer->queues[(thief + i) % tracer->threadCount];
+		uint64_t range = atomic_load(&victim->range);
+		for(;;) {
+			uint32_t begin = (uint32_t)range, end = (uint32_t)(range >> 32);
+			if(begin >= end) {
+				break;
+			}
+			uint32_t middle = begin + (end - begin) / 2;
+			if(atomic_compare_exchange_weak(&victim->range, &range, packRange(begin, middle))) {
+				//nobody touches an empty range, so a plain store is enough
+				atomic_store(&tracer->queues[thief].range, packRange(middle, end));
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void runWorker(EngineCpuTracer *tracer, uint32_t index) {
+	for(;;) {
+		uint32_t tile = popTile(&tracer->queues[index]);
+		if(tile == NO_TILE) {
+			if(!stealTiles(tracer, index)) {
+				return;
+			}
+			continue;
+		}
+		renderTile(&tracer->job, tile);
+	}
+}
+
+static int workerMain(void *arg) {
+	WorkerContext *context = arg;
+	EngineCpuTracer *tracer = context->tracer;
+	uint64_t seenGeneration = 0;
+
+	mtx_lock(&tracer->lock);
+	for(;;) {
+		while(!tracer->quitting && tracer->jobGeneration == seenGeneration) {
+			cnd_wait(&tracer->jobReady, &tracer->lock);
+		}
+		if(tracer->quitting) {
+			break;
+		}
+		seenGeneration = tracer->jobGeneration;
+		mtx_unlock(&tracer->lock);
+
+		runWorker(tracer, context->index);
+
+		mtx_lock(&tracer->lock);
+		if(--tracer->workersBusy == 0) {
+			cnd_signal(&tracer->jobDone);
+		}
+	}
+	mtx_unlock(&tracer->lock);
+	return 0;
+}
+
+EngineResult EngineCpuTracerCreate(EngineCpuTracer **tracerOut, EngineCpuTracerCI tracerCI) {
+	EngineCpuTracer *tracer = calloc(1, sizeof(EngineCpuTracer));
+	if(tracer == NULL) {
+		return (EngineResult){ENGINE_OUT_OF_MEMORY, 0};
+	}
+	tracer->threadCount = tracerCI.threadCount ? tracerCI.threadCount : hardwareThreadCount();
+	tracer->tileSize = tracerCI.tileSize ? tracerCI.tileSize : DEFAULT_TILE_SIZE;
+	tracer->queues = calloc(tracer->threadCount, sizeof(TileQueue));
+	tracer->contexts = calloc(tracer->threadCount, sizeof(WorkerContext));
+	tracer->threads = calloc(tracer->threadCount, sizeof(thrd_t));
+	if(!tracer->queues || !tracer->contexts || !tracer->threads) {
+		free(tracer->queues);
+		free(tracer->contexts);
+		free(tracer->threads);
+		free(tracer);
+		return (EngineResult){ENGINE_OUT_OF_MEMORY, 0};
+	}
+	for(uint32_t i = 0; i < tracer->threadCount; i++) {
+		atomic_init(&tracer->queues[i].range, 0);
+		tracer->contexts[i] = (WorkerContext){tracer, i};
+	}
+	mtx_init(&tracer->lock, mtx_plain);
+	cnd_init(&tracer->jobReady);
+	cnd_init(&tracer->jobDone);
+
+	//the calling thread is worker 0
+	uint32_t started = 1;
+	for(; started < tracer->threadCount; started++) {
+		if(thrd_create(&tracer->threads[started], workerMain, &tracer->contexts[started]) != thrd_success) {
+			break;
+		}
+	}
+	if(started != tracer->threadCount) {
+		tracer->threadCount = started;
+		EngineCpuTracerDestroy(tracer);
+		return (EngineResult){ENGINE_THREAD_CREATION_FAILED, 0};
+	}
+	*tracerOut = tracer;
+	return (EngineResult){ENGINE_SUCCESS, 0};
+}
+
+void EngineCpuTracerDestroy(EngineCpuTracer *tracer) {
+	mtx_lock(&tracer->lock);
+	tracer->quitting = true;
+	cnd_broadcast(&tracer->jobReady);
+	mtx_unlock(&tracer->lock);
+	for(uint32_t i = 1; i < tracer->threadCount; i++) {
+		thrd_join(tracer->threads[i], NULL);
+	}
+	cnd_destroy(&tracer->jobReady);
+	cnd_destroy(&tracer->jobDone);
+	mtx_destroy(&tracer->lock);
+
+	free(tracer->job.posX);
+	free(tracer->queues);
+	free(tracer->contexts);
+	free(tracer->threads);
+	free(tracer);
+}
+
+static bool prepareJob(CpuJob *job, const EngineCpuScene *scene) {
+	if(scene->sphereCount > job->capacity) {
+		//one allocation for the whole structure-of-arrays block
+		void *block = realloc(job->posX, scene->sphereCount * (sizeof(float) * 4 + sizeof(uint32_t)));
+		if(block == NULL) {
+			return false;
+		}
+		job->capacity = scene->sphereCount;
+		job->posX = block;
+	}
+	job->posY = job->posX + job->capacity;
+	job->posZ = job->posY + job->capacity;
+	job->radius2 = job->posZ + job->capacity;
+	job->index = (uint32_t*)(job->radius2 + job->capacity);
+
+	job->activeCount = 0;
+	for(size_t i = 0; i < scene->sphereCount; i++) {
+		const EngineSphere *sphere = &scene->spheres[i];
+		if(!(sphere->flags & ENGINE_EXISTS_FLAG) || !(sphere->flags & ENGINE_ISACTIVE_FLAG)) {
+			continue;
+		}
+		size_t slot = job->activeCount++;
+		job->posX[slot] = sphere->transformation.translation[0];
+		job->posY[slot] = sphere->transformation.translation[1];
+		job->posZ[slot] = sphere->transformation.translation[2];
+		job->radius2[slot] = sphere->radius * sphere->radius;
+		job->index[slot] = i;
+	}
+	job->spheres = scene->spheres;
+	job->sphereCount = scene->sphereCount;
+	job->materials = scene->materials;
+	job->materialCount = scene->materials ? scene->materialCount : 0;
+	job->sunData = v4arr(scene->sunlight.lightData);
+	job->sunColor = v4arr(scene->sunlight.color);
+
+	job->cameraOrigin = v3arr(scene->camera.origin);
+	job->front = v3arr(scene->camera.direction);
+	job->right = v3normalize(v3cross((v3){0, 1, 0}, job->front));
+	job->up = v3normalize(v3cross(job->front, job->right));
+	setScreenToViewport(job, scene->screenToViewport);
+	return true;
+}
+
+EngineResult EngineCpuRender(EngineCpuTracer *tracer, const EngineCpuScene *scene, EngineCpuFrameInfo frame) {
+	CpuJob *job = &tracer->job;
+	if(frame.width == 0 || frame.height == 0) {
+		return (EngineResult){ENGINE_SUCCESS, 0};
+	}
+	if(!prepareJob(job, scene)) {
+		return (EngineResult){ENGINE_OUT_OF_MEMORY, 0};
+	}
+	job->frame = frame;
+	job->maxRays = frame.maxRays < MAX_RAYS_BOUNCE_SIZE ? frame.maxRays : MAX_RAYS_BOUNCE_SIZE;
+	job->tileSize = tracer->tileSize;
+	job->tilesX = (frame.width + tracer->tileSize - 1) / tracer->tileSize;
+	job->tilesY = (frame.height + tracer->tileSize - 1) / tracer->tileSize;
+
+	uint32_t tileCount = job->tilesX * job->tilesY;
+	for(uint32_t i = 0; i < tracer->threadCount; i++) {
+		uint32_t begin = (uint64_t)tileCount * i / tracer->threadCount;
+		uint32_t end = (uint64_t)tileCount * (i + 1) / tracer->threadCount;
+		atomic_store(&tracer->queues[i].range, packRange(begin, end));
+	}
+
+	mtx_lock(&tracer->lock);
+	tracer->jobGeneration++;
+	tracer->workersBusy = tracer->threadCount - 1;
+	cnd_broadcast(&tracer->jobReady);
+	mtx_unlock(&tracer->lock);
+
+	runWorker(tracer, 0);
+
+	mtx_lock(&tracer->lock);
+	while(tracer->workersBusy > 0) {
+		cnd_wait(&tracer->jobDone, &tracer->lock);
+	}
+	mtx_unlock(&tracer->lock);
+	return (EngineResult){ENGINE_SUCCESS, 0};
+}
+
+EngineTransformation EngineCpuScreenTransform(uint32_t width, uint32_t height) {
+	return (EngineTransformation){
+		.translation = {-(float)width/(float)height, 1, 0},
+		.scale = {2/(float)height, -2/(float)height, 1},
+		.rotation = {0, 0, 0},
+	};
+}
+
+uint32_t EngineCpuPacketWidth(void) {
+	return PACKET_WIDTH;
+}
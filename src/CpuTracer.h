@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Engine.h>
+
+/*
+ * CPU implementation of src/shaders/raytrace.comp.
+ * It follows the shader's castRay/calculateRayBounce/calculateColor step by step so that it can serve
+ * as a reference when changing the shader, and as a renderer on machines without a usable GPU.
+ */
+
+typedef struct EngineCpuTracer EngineCpuTracer;
+
+typedef struct {
+    uint32_t threadCount; //0 picks one thread per hardware thread
+    uint32_t tileSize; //edge length of the square tiles handed to the threads, 0 picks 16
+} EngineCpuTracerCI;
+
+typedef struct {
+    const EngineSphere *spheres;
+    size_t sphereCount;
+    const EngineMaterial *materials;
+    size_t materialCount;
+    EngineSunlight sunlight;
+    EngineCamera camera;
+    //what the shader reads from Transformations[1], see EngineCpuScreenTransform
+    EngineTransformation screenToViewport;
+} EngineCpuScene;
+
+typedef struct {
+    uint32_t width, height;
+    //raw bits of the shader's initialSeed uniform
+    uint32_t initialSeed;
+    //clamped to the shader's MAX_RAYS_BOUNCE_SIZE
+    uint32_t maxRays;
+    //what EngineDrawStart clears the image to; pixels whose primary ray hits nothing keep it
+    EngineColor background;
+    //width*height RGBA values, row by row
+    float *pixels;
+} EngineCpuFrameInfo;
+
+EngineResult EngineCpuTracerCreate(EngineCpuTracer **tracer, EngineCpuTracerCI tracerCI);
+void EngineCpuTracerDestroy(EngineCpuTracer *tracer);
+EngineResult EngineCpuRender(EngineCpuTracer *tracer, const EngineCpuScene *scene, EngineCpuFrameInfo frame);
+//the screen space to viewport transformation main.c sends for a given framebuffer size
+EngineTransformation EngineCpuScreenTransform(uint32_t width, uint32_t height);
+//how many rays are tested against the sphere list at once (1 when built without SSE/AVX)
+uint32_t EngineCpuPacketWidth(void);
+
+//renders the scene the engine currently holds (its spheres, materials, sunlight and camera) on the CPU
+EngineResult EngineRenderCpu(Engine *engine, EngineCpuTracer *tracer, EngineCpuFrameInfo frame);
@@ -1,4 +1,7 @@
 #include <Engine.h>
+#include <CpuTracer.h>
+#include <Bvh.h>
+#include <trace.h>
 
 #include <vulkan/vulkan.h>
 
@@ -8,6 +11,8 @@
 #include <stdlib.h>
 #include <utils.h>
 #include <math.h>
+#include <threads.h>
+#include <stdatomic.h>
 
 #include <vk_mem_alloc.h>
 #include <stb_image.h>
@@ -26,19 +31,192 @@ typedef struct {
 	VkCommandPool pool;
 } vulkanQueue;
 
-#define FRAME_OVERLAP 2
-#define ENGINE_DATATYPE_INFO_LENGTH 7
+#define ENGINE_DATATYPE_INFO_LENGTH 14
+
+#define BINDING_SPHERE_BUFFER 1
+#define BINDING_MATERIAL_BUFFER 3
+#define BINDING_TRANSFORMATION_BUFFER 2
+#define BINDING_SUNLIGHT_BUFFER 4
+#define BINDING_CAMERA_BUFFER 6
+#define BINDING_SECONDARY_RAYS_BUFFER 7
+#define BINDING_BVH_NODE_BUFFER 8
+#define BINDING_BVH_INDEX_BUFFER 9
+#define BINDING_ACCUMULATION_IMAGE 10
+#define BINDING_FRAME_STATE_BUFFER 11
+#define BINDING_GBUFFER_IMAGES 12
+#define BINDING_HISTORY_IMAGES 13
+//bindings 12 and 13 hold the images of the current frame at 0 and the ones of the previous frame at 1
+#define HISTORY_IMAGE_PAIR 2
+
+/*timestamp query slots of a frame; every timed dispatch takes 2 slots starting at TIMESTAMP_DISPATCH_START*/
+#define TIMESTAMP_CLEAR_START 0
+#define TIMESTAMP_CLEAR_END 1
+#define TIMESTAMP_BLIT_START 2
+#define TIMESTAMP_BLIT_END 3
+#define TIMESTAMP_DISPATCH_START 4
+#define MAX_TIMED_DISPATCHES 8
+#define TIMESTAMP_QUERY_COUNT (TIMESTAMP_DISPATCH_START + 2 * MAX_TIMED_DISPATCHES)
+
+/*Wavefront kernels, raytrace.comp's constant 5 is the stage + 1 (0 runs the whole path in one dispatch)*/
+typedef enum {
+	WAVEFRONT_GENERATE,
+	WAVEFRONT_EXTEND,
+	WAVEFRONT_SHADE,
+	WAVEFRONT_SHADOW,
+	WAVEFRONT_FINISH,
+	WAVEFRONT_ARGS,
+	WAVEFRONT_STAGE_COUNT
+} wavefrontStage;
+//what WAVEFRONT_ARGS does, named after the stage that ran before it
+typedef enum {
+	WAVEFRONT_PHASE_RESET,
+	WAVEFRONT_PHASE_GENERATED,
+	WAVEFRONT_PHASE_EXTENDED,
+	WAVEFRONT_PHASE_SHADED
+} wavefrontPhase;
+//layout of the secondary rays buffer: queue counters, the VkDispatchIndirectCommands, then one WavefrontSlot per pixel
+#define WAVEFRONT_EXTEND_ARGS 16
+#define WAVEFRONT_SHADE_ARGS 32
+#define WAVEFRONT_SHADOW_ARGS 48
+#define WAVEFRONT_HEADER_SIZE 64
+#define WAVEFRONT_SLOT_SIZE 144
+//what the kernels read after EngineSceneAddresses
+typedef struct {
+	EngineRaytraceParams raytrace;
+	uint32_t bounce, phase;
+} wavefrontParams;
+
+/*Specialised variants of raytrace.comp: constant 6 is its MAX_RAYS_BOUNCE_SIZE, constant 7 the VARIANT_ flags*/
+#define SHADER_MAX_BOUNCES 20
+#define VARIANT_NO_REFRACTION 1
+#define VARIANT_NO_SHADOW_RAYS 2
+#define VARIANT_EXACT_DEPTH 4
+//everything a pipeline is specialised on
+typedef struct {
+	uint32_t sizeX, sizeY; //workgroup size
+	uint32_t materialCount, sunlightCount;
+	uint32_t wavefrontStage;
+	uint32_t bounceDepth, flags;
+} pipelineKey;
+typedef struct {
+	uint32_t data[7];
+	VkSpecializationMapEntry mapEntries[7];
+} specialisationConstants;
+/*Pipelines built with one vkCreateComputePipelines call on the compiler thread.
+The job owns everything the create infos point to; pipelines and result may only be read once done is set*/
+typedef struct pipelineJob {
+	uint32_t count;
+	VkComputePipelineCreateInfo *pipelineCIs;
+	VkSpecializationInfo *specialInfos;
+	specialisationConstants *constants;
+	VkPipeline *pipelines;
+	VkResult result;
+	atomic_bool done;
+	struct pipelineJob *next; //in the compiler's queue
+} pipelineJob;
+//pipelines that are swapped in together: the shaders' own, or the wavefront kernels
+typedef struct {
+	VkPipeline *pipelines; //count of them, VK_NULL_HANDLE until the first build is done
+	uint32_t count;
+	pipelineKey key; //what they were built with, or are going to be the first time
+	pipelineJob *job; //the build that replaces them, NULL when none is running
+	pipelineKey jobKey; //what that build, or the last one, was for
+	bool jobFailed; //the last build failed, it isn't started again for the same key
+} pipelineSet;
+typedef struct {
+	size_t shaderIndex;
+	pipelineKey key;
+	VkPipeline pipeline; //VK_NULL_HANDLE while job builds it, or after it failed
+	pipelineJob *job;
+} shaderVariant;
+//a pipeline or a buffer, destroyed once every frame and async command that may use it is done
+typedef struct {
+	VkPipeline pipeline;
+	VkBuffer buffer;
+	VmaAllocation allocation;
+	uint64_t frameEnd; //frames before this one may use it
+	uint64_t asyncValue;
+} retiredObject;
+
+/*Workgroup size tuning: dispatch times of every candidate size, the frames take turns using them*/
+#define TUNE_SAMPLES 8
+#define TUNE_NONE UINT32_MAX
+#define MAX_WORKGROUP_CANDIDATES 8
+typedef struct {
+	uint32_t sizeX, sizeY;
+	double samplesMs[TUNE_SAMPLES];
+	uint32_t sampleCount;
+} workgroupCandidate;
+
+#define UPLOAD_RING_NONE SIZE_MAX
+//enough for any std140/std430 struct the shader reads through an address
+#define UPLOAD_RING_ALIGNMENT 16
+
+//set 1, shared by every frame
+#define BINDLESS_SET 1
+#define BINDING_BINDLESS_BUFFERS 0
+#define BINDING_BINDLESS_TEXTURES 1
+
+typedef struct {
+	uint32_t slot;
+	uint64_t frameIndex; //last frame that may still read it
+} bindlessRetiredSlot;
+
+//slot allocator of one bindless array
+typedef struct {
+	uint32_t capacity, used; //slots below used were handed out at least once
+	uint32_t *freeSlots, freeCount;
+	EngineRingQueue retired; //bindlessRetiredSlot, oldest first
+} BindlessSlots;
+
+//more scattered changes than this are copied as one range covering all of them
+#define STAGED_MAX_RANGES 16
+#define STAGING_MIN_SIZE (64 * 1024)
+
+typedef struct {
+	size_t begin, end;
+} stagedRange;
+
+//device local buffer and the host copy its EngineBuffer.data points at
+typedef struct {
+	VkBuffer buffer;
+	void *shadow;
+	size_t byteSize;
+	size_t rangeCount;
+	stagedRange ranges[STAGED_MAX_RANGES]; //dirty bytes, neither overlapping nor touching
+} stagedBuffer;
 
 struct Engine {
     VkDevice device;
     VkInstance instance;
     VkPhysicalDevice physicalDevice;
 	VkPhysicalDeviceProperties physicalDeviceProperties;
-	uint32_t workgroupSize;
+	uint32_t workgroupSizeX, workgroupSizeY;
+	/*Once every candidate has TUNE_SAMPLES dispatch times, the one with the lowest median becomes the workgroup size
+	and is written into tunePath*/
+	bool tuning;
+	workgroupCandidate tuneCandidates[MAX_WORKGROUP_CANDIDATES];
+	uint32_t tuneCandidateCount, tuneNext;
+	uint32_t frameCandidate[ENGINE_MAX_FRAMES_IN_FLIGHT]; //TUNE_NONE when the frame dispatches with the workgroup size
+	bool frameCandidateUsed[ENGINE_MAX_FRAMES_IN_FLIGHT]; //some dispatch of the frame ran with its candidate
+	char *tunePath;
+	VkPipelineCache pipelineCache; //every pipeline goes through it, loaded from and saved to pipelineCachePath when set
+	char *pipelineCachePath;
 	bool hardwareRayTracing;
 
     VkSurfaceKHR surface;
+	bool headless;
 	vulkanQueue graphics, compute, presentation;
+	//the compute family's queue when the device has no family of their own
+	vulkanQueue transfer, asyncCompute;
+	//families that share buffers; staged and other buffers are concurrent between them when there is more than one
+	uint32_t bufferFamilies[3], bufferFamilyCount;
+	/*Async compute: commands on asyncCompute wait for everything submitted to frameTimelines before them,
+	but signal asyncTimeline, so nothing in the frames waits for them in turn*/
+	VkSemaphore asyncTimeline;
+	uint64_t asyncValue;
+	VkCommandBuffer asyncCommands[ENGINE_MAX_ASYNC_COMMANDS];
+	size_t asyncCommandCount;
 
     struct {
 		VkSurfaceCapabilitiesKHR capabilities;
@@ -49,7 +227,12 @@ struct Engine {
 	VkImage *swapchainImages;
 	VkImageView *swapchainImageViews;
 	uint32_t swapchainImageCount;
-	VkFence frameFence[FRAME_OVERLAP];
+	/*Frame pacing: every frame slot has a timeline of its own, each submission waits for the value the frame's previous one
+	signalled on it and signals the next one, so a frame is finished once the value of its last submission is reached.
+	Frames only wait for each other while they share something, see frameSharesState*/
+	VkSemaphore frameTimelines[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	uint64_t frameDoneValue[ENGINE_MAX_FRAMES_IN_FLIGHT]; //signalled by the frame's newest submission
+	uint64_t sharedWriteFrame; //frames up to this one wait for every other frame in flight, something they all read was written
 
 	VkExtent2D pixelResolution;
 
@@ -58,44 +241,167 @@ struct Engine {
 	uint32_t cur_swapchainIndex;
 	VmaAllocator allocator;
 
-	AllocatedImage renderImages[FRAME_OVERLAP];
-
-	VkSemaphore swapchainSemaphores[FRAME_OVERLAP],
-				frameReadySemaphores[FRAME_OVERLAP],
-				bufferCopySemaphores[FRAME_OVERLAP],
-				tmpSemaphores[FRAME_OVERLAP];
+	AllocatedImage renderImages[ENGINE_MAX_FRAMES_IN_FLIGHT];
+
+	/*Progressive accumulation: every frame's dispatch blends its sample into accumulationImage, which all frames share.
+	frameStateBuffers tell each frame's dispatch how many samples the image already holds*/
+	AllocatedImage accumulationImage;
+	bool accumulationEnabled, accumulationReset;
+	uint32_t accumulatedSamples;
+	EngineCamera accumulationCamera;
+	EngineBuffer frameStateBuffers[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	bool frameStateWritten[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	/*Temporal reprojection: each frame writes its primary hits (normal and distance) and its final colour into its own
+	gbufferImages and historyImages, the next frame reprojects its hits into them to reuse that colour*/
+	AllocatedImage gbufferImages[ENGINE_MAX_FRAMES_IN_FLIGHT], historyImages[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	uint32_t historySlotCount; //one per frame, but at least 2 so a single frame in flight doesn't read what it writes
+	bool temporalEnabled;
+	float temporalWeight;
+	uint32_t historyFrames; //frames in a row that wrote their history, 0 after the images were recreated
+	EngineCamera previousCamera;
+	bool storageImagesReady; //accumulation, G-buffer and history images are in VK_IMAGE_LAYOUT_GENERAL
+
+	/*Headless mode: renderImages are blitted into these and copied into host-visible readback buffers*/
+	AllocatedImage headlessImages[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	struct {
+		VkBuffer buffer;
+		VmaAllocation allocation;
+		void *data;
+		bool pending;
+		uint64_t frameIndex;
+	} readback[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	EngineFrameCallback frameCallback;
+	void *frameCallbackUserData;
+	uint64_t frameIndex;
+
+	/*GPU timing: each frame writes into its own query pools, which are read once it has been waited on*/
+	bool timestampsSupported, pipelineStatisticsSupported, hostQueryReset;
+	uint64_t timestampMask;
+	VkQueryPool timestampPools[ENGINE_MAX_FRAMES_IN_FLIGHT], statisticsPools[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	uint32_t timedDispatchCount[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	bool queriesPending[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	uint64_t queryFrameIndex[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	EngineFrameTimings frameTimings;
+	/*GPU timestamps are moved onto the trace clock with VK_EXT_calibrated_timestamps when the device has it,
+	otherwise with an offset estimated from when the results were read back*/
+	bool calibratedTimestamps;
+	VkTimeDomainEXT hostTimeDomain;
+	PFN_vkGetCalibratedTimestampsEXT getCalibratedTimestamps;
+	double gpuToHostOffsetNs;
+	bool gpuToHostOffsetValid;
+
+	//acquiring and presenting only take binary semaphores
+	VkSemaphore swapchainSemaphores[ENGINE_MAX_FRAMES_IN_FLIGHT],
+				bufferCopySemaphores[ENGINE_MAX_FRAMES_IN_FLIGHT];
 	/*Constant command buffers*/
-	VkCommandBuffer backgroundBufferCmd[FRAME_OVERLAP], copyBufferCmd[FRAME_OVERLAP];
+	VkCommandBuffer backgroundBufferCmd[ENGINE_MAX_FRAMES_IN_FLIGHT], copyBufferCmd[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	/*Compute command buffers handed out by EngineFrameCommand, reset or reused instead of allocating new ones every frame*/
+	VkCommandBuffer frameCommands[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	EngineCommandRecordingType frameCommandType[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	bool frameCommandRecorded[ENGINE_MAX_FRAMES_IN_FLIGHT]; //holds a REUSABLE recording that can still be submitted
+	uint32_t frameCommandDispatches[ENGINE_MAX_FRAMES_IN_FLIGHT]; //timed dispatches in that recording
 	size_t cur_frame;
+	uint32_t frameCount; //frames in flight, every array above only uses this many entries
 	
 	size_t shaderModulesCount;
 	VkShaderModule *shaderModules;
 	
 	VkPipelineLayout pipelineLayout;
-	VkPipeline *pipelines;
+	/*Pipelines are built on compilerThread, so nothing waits for vkCreateComputePipelines. What the frames dispatch only
+	changes at the start of a frame, once a whole build is done; until then they keep dispatching the pipelines they had*/
+	pipelineSet shaderPipelines;
+	thrd_t compilerThread;
+	bool compilerStarted, compilerQuitting;
+	mtx_t compilerLock;
+	cnd_t compilerWake, compilerJobDone;
+	pipelineJob *compilerQueue, *compilerQueueTail;
+	uint32_t compilerPending; //jobs queued or being built
+	retiredObject *retiredObjects;
+	size_t retiredObjectCount, retiredObjectCapacity;
+
+	/*Variants are requested the first time a dispatch needs them and kept until EngineDestroy*/
+	shaderVariant *shaderVariants;
+	size_t shaderVariantCount, shaderVariantCapacity;
+	bool sceneRefractive; //some material refracts
+	bool shadowRays;
+
+	/*Wavefront: the kernels share one buffer between all frames, since every frame waits for the one before it anyway.
+	Until EngineLoadWavefront it only holds a single path, the descriptor has to point somewhere*/
+	pipelineSet wavefrontPipelines;
+	bool wavefrontLoaded;
+	size_t wavefrontShader;
+	VkBuffer wavefrontBuffer;
+	VmaAllocation wavefrontAllocation;
 
 	VkDescriptorSetLayout descriptorSetLayout;
 	EngineDataTypeInfo descriptorDataTypes[ENGINE_DATATYPE_INFO_LENGTH];
 	VkDescriptorPool descriptorPool;
-	VkDescriptorSet descriptorSet[FRAME_OVERLAP];
-
-	EngineHeapArray writeQueue;
+	VkDescriptorSet descriptorSet[ENGINE_MAX_FRAMES_IN_FLIGHT];
+
+	/*Bindless resources: one update-after-bind set the shader indexes into, written in place instead of through writeQueue.
+	A removed slot is only handed out again once every frame recorded before the removal is finished*/
+	VkDescriptorSetLayout bindlessSetLayout;
+	VkDescriptorPool bindlessPool;
+	VkDescriptorSet bindlessSet;
+	VkSampler bindlessSampler;
+	BindlessSlots bindlessBuffers, bindlessTextures;
+
+	EngineSceneAddresses sceneAddresses; //the scene buffers themselves
+	bool sceneAddressesSet; //EngineSetSceneAddresses was called, nothing goes through the upload ring
+	EngineBuffer transformationBuffer; //last one attached to BINDING_TRANSFORMATION_BUFFER
+	EngineSceneAddresses frameSceneAddresses[ENGINE_MAX_FRAMES_IN_FLIGHT]; //what the frame's dispatches push
+
+	/*Upload ring: frameCount regions of uploadRingFrameSize bytes, a region is reset after waiting for its frame.
+	The scene copies are reserved at the start of the frame so the addresses are known while recording, and filled in on submission*/
+	EngineBuffer uploadRing;
+	size_t uploadRingFrameSize;
+	size_t uploadRingUsed[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	size_t cameraUpload[ENGINE_MAX_FRAMES_IN_FLIGHT], sphereUpload[ENGINE_MAX_FRAMES_IN_FLIGHT], transformationUpload[ENGINE_MAX_FRAMES_IN_FLIGHT]; //UPLOAD_RING_NONE when not copied
+
+	/*Staged buffers: the dirty ranges of their host copies go into the frame's staging buffer at its first submission,
+	and a copy submitted right before it moves them into device local memory*/
+	bool stagedScene;
+	stagedBuffer *stagedBuffers;
+	size_t stagedBufferCount, stagedBufferCapacity;
+	EngineBuffer stagingBuffers[ENGINE_MAX_FRAMES_IN_FLIGHT]; //grown when a frame's changes don't fit
+	VkCommandBuffer stagingCmd[ENGINE_MAX_FRAMES_IN_FLIGHT];
+
+	EngineRingQueue writeQueue; //writeQueueElement, ENGINE_MAX_QUEUED_ATTACHMENTS of them
+	EngineArena frameArena; //what updateDescriptorSets hands to vkUpdateDescriptorSets, reset every frame
 	EngineBuffer materialBuffer, sphereBuffer, sunlightBuffer, cameraBuffer;
 
+	/*Sphere BVH: built or refitted on the host and copied into a frame's own buffers once that frame is free again,
+	so the tree the GPU is still walking never changes*/
+	EngineBvh bvh;
+	bool bvhDirty; //needs a full rebuild
+	double bvhBuildCost;
+	//spheres marked with EngineMarkSphereDirty since the last frame
+	bool *sphereDirty;
+	uint32_t *dirtySpheres, dirtySphereCount;
+	uint32_t *bvhChangedNodes;
+	//refitted nodes every frame still has to copy, unless it copies the whole tree anyway
+	bool bvhFullUpload[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	bool *bvhNodePending[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	uint32_t *bvhPendingNodes[ENGINE_MAX_FRAMES_IN_FLIGHT], bvhPendingCount[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	EngineBuffer bvhNodeBuffers[ENGINE_MAX_FRAMES_IN_FLIGHT], bvhIndexBuffers[ENGINE_MAX_FRAMES_IN_FLIGHT];
+
 	EngineObjectLimits limits;
 };
 
 uint32_t EngineGetFrame(Engine *engine) {
 	return engine->cur_frame;
 }
-uint32_t NextFrame(uint32_t frame) {
+uint64_t EngineGetFrameIndex(Engine *engine) {
+	return engine->frameIndex;
+}
+uint32_t NextFrame(Engine *engine, uint32_t frame) {
 	frame++;
-	if(frame >= FRAME_OVERLAP)
+	if(frame >= engine->frameCount)
 		frame = 0;
 	return frame;
 }
 void updateCurrentFrame_(Engine *engine) {
-	engine->cur_frame = NextFrame(engine->cur_frame);
+	engine->cur_frame = NextFrame(engine, engine->cur_frame);
 }
 typedef enum {
     ENGINE_GRAPHICS,
@@ -155,9 +461,11 @@ bool checkValidationSupport() {
 
 VkResult res;
 
+//queue family index that hasn't been found yet
+#define QUEUE_FAMILY_NONE UINT32_MAX
 typedef struct {
 	uint32_t point;
-	uint32_t graphicsI, presentationI, computeI;
+	uint32_t graphicsI, presentationI, computeI, transferI, asyncComputeI;
 	bool supportsRayTracing;
 	VkSurfaceFormatKHR format;
 	VkPhysicalDevice device;
@@ -255,9 +563,9 @@ EngineResult findSuitablePhysicalDevice(VkPhysicalDevice *devices, size_t device
 		vkGetPhysicalDeviceProperties(devices[i], &cur_deviceStats.props);
 		debug_msg("Device %d: %s\n", i, cur_deviceStats.props.deviceName);
 
-		cur_deviceStats.graphicsI = -1; 
-		cur_deviceStats.presentationI = -1; 
-		cur_deviceStats.computeI = -1; 
+		cur_deviceStats.graphicsI = QUEUE_FAMILY_NONE;
+		cur_deviceStats.presentationI = QUEUE_FAMILY_NONE;
+		cur_deviceStats.computeI = QUEUE_FAMILY_NONE;
 		//First checking for queue capabilities; if they are not sufficient then the rest doesnt even matter
 		size_t queuePropCount = 0;
 		vkGetPhysicalDeviceQueueFamilyProperties(devices[i], &queuePropCount, NULL);
@@ -273,20 +581,49 @@ EngineResult findSuitablePhysicalDevice(VkPhysicalDevice *devices, size_t device
 		}
 		vkGetPhysicalDeviceQueueFamilyProperties(devices[i], &queuePropCount, queueProps);
 		for(int j = 0; j < queuePropCount; j++) {
-			if(queueProps[j].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			//a family that does both lets a whole frame go into one submission, see EngineFrameBegin
+			bool graphicsCompute = (queueProps[j].queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueProps[j].queueFlags & VK_QUEUE_COMPUTE_BIT);
+			if(graphicsCompute && cur_deviceStats.graphicsI != cur_deviceStats.computeI) {
+				cur_deviceStats.graphicsI = j;
+				cur_deviceStats.computeI = j;
+			}
+			if(queueProps[j].queueFlags & VK_QUEUE_GRAPHICS_BIT && cur_deviceStats.graphicsI == QUEUE_FAMILY_NONE) {
 				cur_deviceStats.graphicsI = j;
 			}
-			if(queueProps[j].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+			if(queueProps[j].queueFlags & VK_QUEUE_COMPUTE_BIT && cur_deviceStats.computeI == QUEUE_FAMILY_NONE) {
 				cur_deviceStats.computeI = j;
 			}
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(devices[i], j, engine->surface, &presentSupport);
+			if(!engine->headless) {
+				vkGetPhysicalDeviceSurfaceSupportKHR(devices[i], j, engine->surface, &presentSupport);
+			}
 			if(presentSupport)
 				cur_deviceStats.presentationI = j;
-			if(cur_deviceStats.graphicsI > -1 && cur_deviceStats.presentationI > -1 && cur_deviceStats.computeI > -1)
+			if(cur_deviceStats.graphicsI != QUEUE_FAMILY_NONE && cur_deviceStats.presentationI != QUEUE_FAMILY_NONE && cur_deviceStats.graphicsI == cur_deviceStats.computeI)
 				break;
 		}
-		if(cur_deviceStats.graphicsI == -1 || cur_deviceStats.presentationI == -1 || cur_deviceStats.computeI == -1) {
+		//presenting from the family that renders saves the blit a hand-over to another queue
+		VkBool32 graphicsPresents = false;
+		if(!engine->headless && cur_deviceStats.graphicsI != QUEUE_FAMILY_NONE) {
+			vkGetPhysicalDeviceSurfaceSupportKHR(devices[i], cur_deviceStats.graphicsI, engine->surface, &graphicsPresents);
+		}
+		if(graphicsPresents)
+			cur_deviceStats.presentationI = cur_deviceStats.graphicsI;
+		if(engine->headless) {
+			//nothing gets presented, the presentation queue only exists so the rest of the engine doesnt have to care
+			cur_deviceStats.presentationI = cur_deviceStats.graphicsI;
+		}
+		//families without graphics usually are separate hardware queues (copy engines, async compute) running alongside the main one
+		cur_deviceStats.transferI = cur_deviceStats.computeI;
+		cur_deviceStats.asyncComputeI = cur_deviceStats.computeI;
+		for(int j = queuePropCount - 1; j >= 0; j--) {
+			VkQueueFlags flags = queueProps[j].queueFlags;
+			if((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+				cur_deviceStats.transferI = j;
+			if((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+				cur_deviceStats.asyncComputeI = j;
+		}
+		if(cur_deviceStats.graphicsI == QUEUE_FAMILY_NONE || cur_deviceStats.presentationI == QUEUE_FAMILY_NONE || cur_deviceStats.computeI == QUEUE_FAMILY_NONE) {
 			continue;
 		}
 
@@ -305,6 +642,7 @@ EngineResult findSuitablePhysicalDevice(VkPhysicalDevice *devices, size_t device
 		vkGetPhysicalDeviceFeatures2(devices[i], &deviceFeatures);
 		if(!(desiredFeatures13.dynamicRendering && 
 			desiredFeatures13.synchronization2 &&
+			desiredFeatures12.timelineSemaphore &&
 			desiredFeatures12.bufferDeviceAddress &&
 			desiredFeatures12.descriptorIndexing)) {
 				continue;
@@ -340,7 +678,7 @@ EngineResult findSuitablePhysicalDevice(VkPhysicalDevice *devices, size_t device
 				}
 			}
 		}
-		if(found < MandatoryDeviceExtensionsCount) {
+		if(found < MandatoryDeviceExtensionsCount && !engine->headless) {
 			continue;
 		}
 		if(rayTraceSupport == ARR_SIZE(deviceExtensions) - MandatoryDeviceExtensionsCount) {
@@ -349,29 +687,36 @@ EngineResult findSuitablePhysicalDevice(VkPhysicalDevice *devices, size_t device
 			cur_deviceStats.supportsRayTracing = true;
 		}
 
-		size_t formatCount = 0;
-		vkGetPhysicalDeviceSurfaceFormatsKHR(devices[i], engine->surface, &formatCount, NULL);
-		if(formatCount == 0)
-			continue;
-		if(formatCount > formatMemSize) {
-			if(formats == NULL) {
-				formats = malloc(sizeof(VkSurfaceFormatKHR) * formatCount);
-			} else {
-				formats = realloc(formats, sizeof(VkSurfaceFormatKHR) * formatCount);
+		if(engine->headless) {
+			cur_deviceStats.format = (VkSurfaceFormatKHR) {
+				.format = VK_FORMAT_R8G8B8A8_SRGB,
+				.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR
+			};
+		} else {
+			size_t formatCount = 0;
+			vkGetPhysicalDeviceSurfaceFormatsKHR(devices[i], engine->surface, &formatCount, NULL);
+			if(formatCount == 0)
+				continue;
+			if(formatCount > formatMemSize) {
+				if(formats == NULL) {
+					formats = malloc(sizeof(VkSurfaceFormatKHR) * formatCount);
+				} else {
+					formats = realloc(formats, sizeof(VkSurfaceFormatKHR) * formatCount);
+				}
+				formatMemSize = formatCount;
 			}
-			formatMemSize = formatCount;
-		}
-		vkGetPhysicalDeviceSurfaceFormatsKHR(devices[i], engine->surface, &formatCount, formats);
-		bool goodFormat = false;
-		for(int i = 0; i < formatCount; i++) {
-			if(formats[i].format == VK_FORMAT_R8G8B8A8_SRGB && formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-				goodFormat = true;
-				cur_deviceStats.format = formats[i];
-				break;
+			vkGetPhysicalDeviceSurfaceFormatsKHR(devices[i], engine->surface, &formatCount, formats);
+			bool goodFormat = false;
+			for(int i = 0; i < formatCount; i++) {
+				if(formats[i].format == VK_FORMAT_R8G8B8A8_SRGB && formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+					goodFormat = true;
+					cur_deviceStats.format = formats[i];
+					break;
+				}
 			}
+			if(!goodFormat)
+				continue;
 		}
-		if(!goodFormat)
-			continue;
 		cur_deviceStats.point++; //make it strictly better than a 0 point
 		if(cur_deviceStats.props.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
 			cur_deviceStats.point++;
@@ -401,8 +746,15 @@ EngineResult findSuitablePhysicalDevice(VkPhysicalDevice *devices, size_t device
 	engine->compute.index = bestDeviceStats.computeI;
 	engine->graphics.index = bestDeviceStats.graphicsI;
 	engine->presentation.index = bestDeviceStats.presentationI;
+	engine->transfer.index = bestDeviceStats.transferI;
+	engine->asyncCompute.index = bestDeviceStats.asyncComputeI;
 	engine->hardwareRayTracing = bestDeviceStats.supportsRayTracing;
 	engine->physicalDeviceProperties = bestDeviceStats.props;
+	//the largest square the device allows, until EngineAutotuneWorkgroupSize finds something better
+	VkPhysicalDeviceLimits *limits = &engine->physicalDeviceProperties.limits;
+	uint32_t workgroupSize = (uint32_t)sqrt(limits->maxComputeWorkGroupInvocations);
+	engine->workgroupSizeX = workgroupSize < limits->maxComputeWorkGroupSize[0] ? workgroupSize : limits->maxComputeWorkGroupSize[0];
+	engine->workgroupSizeY = workgroupSize < limits->maxComputeWorkGroupSize[1] ? workgroupSize : limits->maxComputeWorkGroupSize[1];
 
 	free(queueProps);
 	free(extensionProps);
@@ -411,6 +763,211 @@ EngineResult findSuitablePhysicalDevice(VkPhysicalDevice *devices, size_t device
 	debug_msg("\x1b[1;37mThe chosen device: %s\n\x1b[0m", engine->physicalDeviceProperties.deviceName);
 	return ENGINE_RESULT_SUCCESS;
 }
+//recordings bind the descriptor sets and pipelines and size their dispatches by the render images, so they have to be redone
+void invalidateFrameCommands(Engine *engine) {
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		engine->frameCommandRecorded[i] = false;
+	}
+}
+
+//image only the shaders use, as large as the render images
+EngineResult createStorageImage(Engine *engine, AllocatedImage *image, VkFormat format) {
+	image->imageExtent = (VkExtent3D){
+		.width = engine->pixelResolution.width,
+		.height = engine->pixelResolution.height,
+		.depth = 1,
+	};
+	image->imageFormat = format;
+	VkImageCreateInfo imageCI = imageCreateInfo(format, VK_IMAGE_USAGE_STORAGE_BIT, image->imageExtent);
+	imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+	VmaAllocationCreateInfo allocationCI = {
+		.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+		.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	};
+	res = vmaCreateImage(engine->allocator, &imageCI, &allocationCI, &image->image, &image->allocation, NULL);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_SWAPCHAIN_FAILED, res);
+	VkImageViewCreateInfo viewCI = imageViewCreateInfo(format, image->image, VK_IMAGE_ASPECT_COLOR_BIT);
+	res = vkCreateImageView(engine->device, &viewCI, NULL, &image->imageView);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_SWAPCHAIN_FAILED, res);
+	return ENGINE_RESULT_SUCCESS;
+}
+void destroyStorageImage(Engine *engine, AllocatedImage image) {
+	vkDestroyImageView(engine->device, image.imageView, NULL);
+	vmaDestroyImage(engine->allocator, image.image, image.allocation);
+}
+
+//binds the G-buffer and history images of slot to frame's set, together with the slot written before it
+void writeHistoryPair(Engine *engine, size_t frame, size_t slot) {
+	size_t slots[HISTORY_IMAGE_PAIR] = {slot, (slot + engine->historySlotCount - 1) % engine->historySlotCount};
+	VkDescriptorImageInfo gbufferInfos[HISTORY_IMAGE_PAIR], historyInfos[HISTORY_IMAGE_PAIR];
+	for(size_t j = 0; j < HISTORY_IMAGE_PAIR; j++) {
+		gbufferInfos[j] = (VkDescriptorImageInfo) {
+			.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+			.imageView = engine->gbufferImages[slots[j]].imageView,
+			.sampler = VK_NULL_HANDLE
+		};
+		historyInfos[j] = gbufferInfos[j];
+		historyInfos[j].imageView = engine->historyImages[slots[j]].imageView;
+	}
+	VkWriteDescriptorSet writeSets[2] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = engine->descriptorSet[frame],
+			.dstBinding = BINDING_GBUFFER_IMAGES,
+			.dstArrayElement = 0,
+			.descriptorCount = HISTORY_IMAGE_PAIR,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			.pImageInfo = gbufferInfos
+		}
+	};
+	writeSets[1] = writeSets[0];
+	writeSets[1].dstBinding = BINDING_HISTORY_IMAGES;
+	writeSets[1].pImageInfo = historyInfos;
+	vkUpdateDescriptorSets(engine->device, 2, writeSets, 0, NULL);
+}
+//device must be idle
+EngineResult createWavefrontBuffer(Engine *engine) {
+	VkDeviceSize pathCount = engine->wavefrontLoaded ? (VkDeviceSize)engine->pixelResolution.width * engine->pixelResolution.height : 1;
+	VkBufferCreateInfo buffCI = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = NULL,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.size = WAVEFRONT_HEADER_SIZE + pathCount * WAVEFRONT_SLOT_SIZE,
+		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+	};
+	VmaAllocationCreateInfo allocCI = {
+		.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+	};
+	res = vmaCreateBuffer(engine->allocator, &buffCI, &allocCI, &engine->wavefrontBuffer, &engine->wavefrontAllocation, NULL);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_BUFFER_CREATION_FAILED, res);
+	VkDescriptorBufferInfo bufferInfo = {
+		.buffer = engine->wavefrontBuffer,
+		.offset = 0,
+		.range = VK_WHOLE_SIZE
+	};
+	VkWriteDescriptorSet writeSets[ENGINE_MAX_FRAMES_IN_FLIGHT] = {0};
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		writeSets[i] = (VkWriteDescriptorSet) {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.pNext = NULL,
+			.dstSet = engine->descriptorSet[i],
+			.dstBinding = BINDING_SECONDARY_RAYS_BUFFER,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &bufferInfo
+		};
+	}
+	vkUpdateDescriptorSets(engine->device, engine->frameCount, writeSets, 0, NULL);
+	return ENGINE_RESULT_SUCCESS;
+}
+void destroyWavefrontBuffer(Engine *engine) {
+	if(engine->wavefrontBuffer == VK_NULL_HANDLE)
+		return;
+	vmaDestroyBuffer(engine->allocator, engine->wavefrontBuffer, engine->wavefrontAllocation);
+	engine->wavefrontBuffer = VK_NULL_HANDLE;
+}
+EngineResult createRenderImages(Engine *engine) {
+	for(int i = 0; i < engine->frameCount; i++) {
+		engine->renderImages[i].imageExtent = (VkExtent3D){
+			.width = engine->pixelResolution.width,
+			.height = engine->pixelResolution.height,
+			.depth = 1,
+		};
+		engine->renderImages[i].imageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+		
+		VkImageCreateInfo renderImageCI = imageCreateInfo(engine->renderImages[i].imageFormat, 
+			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT | (engine->hardwareRayTracing ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT : 0),
+			engine->renderImages[i].imageExtent
+		);
+		renderImageCI.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT | (engine->hardwareRayTracing ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT : 0);
+		VmaAllocationCreateInfo renderImageAllocationCI = {
+			.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+			.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		};
+		res = vmaCreateImage(engine->allocator, &renderImageCI, &renderImageAllocationCI, &engine->renderImages[i].image, &engine->renderImages[i].allocation, NULL);
+		ERR_CHECK(res == VK_SUCCESS, ENGINE_SWAPCHAIN_FAILED, res);
+		VkImageViewCreateInfo imageViewCI = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+			.image = engine->renderImages[i].image,
+			.viewType = VK_IMAGE_VIEW_TYPE_2D,
+			.format = engine->renderImages[i].imageFormat,
+			.components = {VK_COMPONENT_SWIZZLE_IDENTITY,VK_COMPONENT_SWIZZLE_IDENTITY,VK_COMPONENT_SWIZZLE_IDENTITY,VK_COMPONENT_SWIZZLE_IDENTITY},
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			},
+		};
+		res = vkCreateImageView(engine->device, &imageViewCI, NULL, &engine->renderImages[i].imageView);
+		ERR_CHECK(res == VK_SUCCESS, ENGINE_SWAPCHAIN_FAILED, res);
+	}
+
+	//full float precision so thousands of samples can still be averaged
+	EngineResult eRes = createStorageImage(engine, &engine->accumulationImage, VK_FORMAT_R32G32B32A32_SFLOAT);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	for(size_t i = 0; i < engine->historySlotCount; i++) {
+		//normal in rgb, distance to the camera in a
+		eRes = createStorageImage(engine, &engine->gbufferImages[i], VK_FORMAT_R32G32B32A32_SFLOAT);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+		eRes = createStorageImage(engine, &engine->historyImages[i], engine->renderImages[0].imageFormat);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	}
+	engine->storageImagesReady = false;
+	engine->accumulationReset = true;
+	engine->historyFrames = 0;
+	invalidateFrameCommands(engine);
+
+	vkDeviceWaitIdle(engine->device);
+	VkDescriptorImageInfo imageInfos[ENGINE_MAX_FRAMES_IN_FLIGHT] = {0};
+	VkDescriptorImageInfo accumulationInfo = {
+		.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.imageView = engine->accumulationImage.imageView,
+		.sampler = VK_NULL_HANDLE
+	};
+	VkWriteDescriptorSet writeSets[2 * ENGINE_MAX_FRAMES_IN_FLIGHT] = {0};
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		imageInfos[i] = (VkDescriptorImageInfo) {
+			.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+			.imageView = engine->renderImages[i].imageView,
+			.sampler = VK_NULL_HANDLE
+		};
+		writeSets[2 * i] = (VkWriteDescriptorSet) {
+			.dstSet = engine->descriptorSet[i],
+			.dstBinding = 0,
+			.pImageInfo = &imageInfos[i],
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			.pNext = NULL,
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstArrayElement = 0,
+			.descriptorCount = 1
+		};
+		writeSets[2 * i + 1] = writeSets[2 * i];
+		writeSets[2 * i + 1].dstBinding = BINDING_ACCUMULATION_IMAGE;
+		writeSets[2 * i + 1].pImageInfo = &accumulationInfo;
+	}
+	vkUpdateDescriptorSets(engine->device, 2 * engine->frameCount, writeSets, 0, NULL);
+	//frames are always drawn in order, so with a slot per frame the one before frame i is the one before it in the ring
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		writeHistoryPair(engine, i, i);
+	}
+	//sized by the resolution once the wavefront is loaded
+	return createWavefrontBuffer(engine);
+}
+void destroyRenderImages(Engine *engine) {
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		vkDestroyImageView(engine->device, engine->renderImages[i].imageView, NULL);
+		vmaDestroyImage(engine->allocator, engine->renderImages[i].image, engine->renderImages[i].allocation);
+	}
+	destroyStorageImage(engine, engine->accumulationImage);
+	for(size_t i = 0; i < engine->historySlotCount; i++) {
+		destroyStorageImage(engine, engine->gbufferImages[i]);
+		destroyStorageImage(engine, engine->historyImages[i]);
+	}
+	destroyWavefrontBuffer(engine);
+}
 EngineResult EngineSwapchainCreate(Engine *engine, uint32_t frameBufferWidth, uint32_t frameBufferHeight) {
 	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(engine->physicalDevice, engine->surface, &engine->swapchainDetails.capabilities);
 	
@@ -470,71 +1027,11 @@ EngineResult EngineSwapchainCreate(Engine *engine, uint32_t frameBufferWidth, ui
 		};
 		vkCreateImageView(engine->device, &imageViewCI, NULL, &engine->swapchainImageViews[i]);
 	}
-	for(int i = 0; i < FRAME_OVERLAP; i++) {
-		engine->renderImages[i].imageExtent = (VkExtent3D){
-			.width = engine->pixelResolution.width,
-			.height = engine->pixelResolution.height,
-			.depth = 1,
-		};
-		engine->renderImages[i].imageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
-		
-		VkImageCreateInfo renderImageCI = imageCreateInfo(engine->renderImages[i].imageFormat, 
-			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT | (engine->hardwareRayTracing ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT : 0),
-			engine->renderImages[i].imageExtent
-		);
-		renderImageCI.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT | (engine->hardwareRayTracing ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT : 0);
-		VmaAllocationCreateInfo renderImageAllocationCI = {
-			.usage = VMA_MEMORY_USAGE_GPU_ONLY,
-			.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		};
-		res = vmaCreateImage(engine->allocator, &renderImageCI, &renderImageAllocationCI, &engine->renderImages[i].image, &engine->renderImages[i].allocation, NULL);
-		ERR_CHECK(res == VK_SUCCESS, ENGINE_SWAPCHAIN_FAILED, res);
-		VkImageViewCreateInfo imageViewCI = {
-			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-			.image = engine->renderImages[i].image,
-			.viewType = VK_IMAGE_VIEW_TYPE_2D,
-			.format = engine->renderImages[i].imageFormat,
-			.components = {VK_COMPONENT_SWIZZLE_IDENTITY,VK_COMPONENT_SWIZZLE_IDENTITY,VK_COMPONENT_SWIZZLE_IDENTITY,VK_COMPONENT_SWIZZLE_IDENTITY},
-			.subresourceRange = {
-				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-				.baseMipLevel = 0,
-				.levelCount = 1,
-				.baseArrayLayer = 0,
-				.layerCount = 1
-			},
-		};
-		res = vkCreateImageView(engine->device, &imageViewCI, NULL, &engine->renderImages[i].imageView);
-		ERR_CHECK(res == VK_SUCCESS, ENGINE_SWAPCHAIN_FAILED, res);
-	}
-	vkDeviceWaitIdle(engine->device);
-	VkDescriptorImageInfo imageInfos[FRAME_OVERLAP] = {0};
-	VkWriteDescriptorSet writeSets[FRAME_OVERLAP] = {0};
-	for(size_t i = 0; i < FRAME_OVERLAP; i++) {
-		imageInfos[i] = (VkDescriptorImageInfo) {
-			.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
-			.imageView = engine->renderImages[i].imageView,
-			.sampler = VK_NULL_HANDLE
-		};
-		writeSets[i] = (VkWriteDescriptorSet) {
-			.dstSet = engine->descriptorSet[i],
-			.dstBinding = 0,
-			.pImageInfo = &imageInfos[i],
-			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-			.pNext = NULL,
-			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-			.dstArrayElement = 0,
-			.descriptorCount = 1
-		};
-	}
-	vkUpdateDescriptorSets(engine->device, FRAME_OVERLAP, writeSets, 0, NULL);
-	return ENGINE_RESULT_SUCCESS;
+	return createRenderImages(engine);
 }
 void EngineSwapchainDestroy(Engine *engine) {
 	vkQueueWaitIdle(engine->graphics.queue);
-	for(size_t i = 0; i < FRAME_OVERLAP; i++) {
-		vkDestroyImageView(engine->device, engine->renderImages[i].imageView, NULL);
-		vmaDestroyImage(engine->allocator, engine->renderImages[i].image, engine->renderImages[i].allocation);
-	}
+	destroyRenderImages(engine);
 	for(int i = 0; i < engine->swapchainImageCount; i++) {
 		vkDestroyImageView(engine->device, engine->swapchainImageViews[i], NULL);
 	}
@@ -543,45 +1040,1197 @@ void EngineSwapchainDestroy(Engine *engine) {
 	vkDestroySwapchainKHR(engine->device, engine->swapchain, NULL);
 }
 
-EngineResult CreateQueue(Engine *engine, vulkanQueue *queue) {
-	vkGetDeviceQueue(engine->device, queue->index, 0, &queue->queue);
+//whether the device can read its timestamps together with the clock EngineTraceNow uses
+bool checkCalibratedTimestamps(Engine *engine) {
+	engine->calibratedTimestamps = false;
+	#ifdef _WIN32
+	engine->hostTimeDomain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+	#else
+	engine->hostTimeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+	#endif
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(engine->physicalDevice, NULL, &extensionCount, NULL);
+	VkExtensionProperties *extensionProps = malloc(sizeof(VkExtensionProperties) * extensionCount);
+	if(extensionProps == NULL)
+		return false;
+	vkEnumerateDeviceExtensionProperties(engine->physicalDevice, NULL, &extensionCount, extensionProps);
+	bool found = false;
+	for(uint32_t i = 0; i < extensionCount && !found; i++) {
+		found = !strcmp(extensionProps[i].extensionName, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+	}
+	free(extensionProps);
+	PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(engine->instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+	if(!found || getTimeDomains == NULL)
+		return false;
+
+	uint32_t domainCount = 0;
+	getTimeDomains(engine->physicalDevice, &domainCount, NULL);
+	VkTimeDomainEXT *domains = malloc(sizeof(VkTimeDomainEXT) * domainCount);
+	if(domains == NULL)
+		return false;
+	getTimeDomains(engine->physicalDevice, &domainCount, domains);
+	bool device = false, host = false;
+	for(uint32_t i = 0; i < domainCount; i++) {
+		device |= domains[i] == VK_TIME_DOMAIN_DEVICE_EXT;
+		host |= domains[i] == engine->hostTimeDomain;
+	}
+	free(domains);
+	engine->calibratedTimestamps = device && host;
+	debug_msg("Calibrated timestamps: %d\n", engine->calibratedTimestamps);
+	return engine->calibratedTimestamps;
+}
 
-	VkCommandPoolCreateInfo commandPoolCI = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+EngineResult createTimingQueries(Engine *engine) {
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(engine->physicalDevice, &familyCount, NULL);
+	VkQueueFamilyProperties *families = malloc(sizeof(VkQueueFamilyProperties) * familyCount);
+	ERR_CHECK(families != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	vkGetPhysicalDeviceQueueFamilyProperties(engine->physicalDevice, &familyCount, families);
+	//the clear and blit go to the graphics queue, the dispatches to the compute queue
+	uint32_t validBits = families[engine->graphics.index].timestampValidBits;
+	if(families[engine->compute.index].timestampValidBits < validBits)
+		validBits = families[engine->compute.index].timestampValidBits;
+	free(families);
+
+	engine->timestampsSupported = validBits > 0 && engine->physicalDeviceProperties.limits.timestampPeriod > 0;
+	engine->timestampMask = validBits >= 64 ? UINT64_MAX : ((uint64_t)1 << validBits) - 1;
+	debug_msg("Timestamp queries: %d (%u valid bits), pipeline statistics: %d, host query reset: %d\n",
+		engine->timestampsSupported, validBits, engine->pipelineStatisticsSupported, engine->hostQueryReset);
+
+	VkQueryPoolCreateInfo timestampPoolCI = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
 		.pNext = NULL,
-		.queueFamilyIndex = queue->index
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = TIMESTAMP_QUERY_COUNT,
 	};
-	res = vkCreateCommandPool(engine->device, &commandPoolCI, NULL, &queue->pool);
-	ERR_CHECK(res == VK_SUCCESS, ENGINE_QUEUECOMMAND_CREATION_FAILED, res);
+	VkQueryPoolCreateInfo statisticsPoolCI = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+		.queryCount = MAX_TIMED_DISPATCHES,
+		.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT,
+	};
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		engine->timestampPools[i] = VK_NULL_HANDLE;
+		engine->statisticsPools[i] = VK_NULL_HANDLE;
+		engine->timedDispatchCount[i] = 0;
+		engine->queriesPending[i] = false;
+		if(engine->timestampsSupported) {
+			res = vkCreateQueryPool(engine->device, &timestampPoolCI, NULL, &engine->timestampPools[i]);
+			ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_CREATE_SYNCHRONISING_VARIABLES, res);
+			if(engine->hostQueryReset)
+				vkResetQueryPool(engine->device, engine->timestampPools[i], 0, TIMESTAMP_QUERY_COUNT);
+		}
+		if(engine->pipelineStatisticsSupported) {
+			res = vkCreateQueryPool(engine->device, &statisticsPoolCI, NULL, &engine->statisticsPools[i]);
+			ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_CREATE_SYNCHRONISING_VARIABLES, res);
+			if(engine->hostQueryReset)
+				vkResetQueryPool(engine->device, engine->statisticsPools[i], 0, MAX_TIMED_DISPATCHES);
+		}
+	}
+	engine->frameTimings = (EngineFrameTimings){.available = false};
 	return ENGINE_RESULT_SUCCESS;
 }
-EngineResult DestroyQueue(Engine *engine, vulkanQueue *queue) {
-	vkQueueWaitIdle(queue->queue);
-	vkDestroyCommandPool(engine->device, queue->pool, NULL);
-	return ENGINE_RESULT_SUCCESS;
+
+//milliseconds between two timestamp slots, -1 if either of them was not written
+double timestampSpan(Engine *engine, uint64_t (*results)[2], uint32_t start, uint32_t end) {
+	if(!results[start][1] || !results[end][1])
+		return -1;
+	uint64_t ticks = (results[end][0] - results[start][0]) & engine->timestampMask;
+	return (double)ticks * engine->physicalDeviceProperties.limits.timestampPeriod / 1000000.0;
 }
 
-EngineResult ChangeImageLayout(VkCommandBuffer cmd, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags2 pipelineStage) {
-	VkImageSubresourceRange subresourceRange = {
-		.aspectMask = (newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT, //idk why but for now i keep
-		.baseMipLevel = 0,
-		.levelCount = VK_REMAINING_MIP_LEVELS,
-		.baseArrayLayer = 0,
-		.layerCount = VK_REMAINING_ARRAY_LAYERS
-	};
-	VkImageMemoryBarrier2 imageBarrier = {
-		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-		.pNext = NULL,
-		.srcStageMask = pipelineStage,
-		.dstStageMask = pipelineStage,
-		.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
-		.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
-		.oldLayout = oldLayout,
-		.newLayout = newLayout,
-		.subresourceRange = subresourceRange,
-		.image = image
-	};
+//puts the frame's GPU work on the GPU track of the trace, every timestamp is taken relative to the end of the blit
+void traceGpuFrame(Engine *engine, uint64_t (*results)[2], uint32_t dispatchCount) {
+	if(!results[TIMESTAMP_BLIT_END][1])
+		return;
+	double period = engine->physicalDeviceProperties.limits.timestampPeriod;
+	uint64_t reference = results[TIMESTAMP_BLIT_END][0];
+	double referenceNs = -1;
+	if(engine->calibratedTimestamps) {
+		VkCalibratedTimestampInfoEXT infos[2] = {
+			{.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .pNext = NULL, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT},
+			{.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .pNext = NULL, .timeDomain = engine->hostTimeDomain},
+		};
+		uint64_t now[2], maxDeviation;
+		res = engine->getCalibratedTimestamps(engine->device, 2, infos, now, &maxDeviation);
+		if(res == VK_SUCCESS) {
+			uint64_t ticksAgo = (now[0] - reference) & engine->timestampMask;
+			referenceNs = (double)EngineTraceHostTicksToNs(now[1]) - (double)ticksAgo * period;
+		}
+	}
+	if(referenceNs < 0) {
+		//the blit finished before we got here, so the smallest offset seen so far is the closest one
+		double offset = (double)EngineTraceNow() - (double)reference * period;
+		if(!engine->gpuToHostOffsetValid || offset < engine->gpuToHostOffsetNs) {
+			engine->gpuToHostOffsetNs = offset;
+			engine->gpuToHostOffsetValid = true;
+		}
+		referenceNs = (double)reference * period + engine->gpuToHostOffsetNs;
+	}
+
+	uint32_t slots[][2] = {{TIMESTAMP_CLEAR_START, TIMESTAMP_CLEAR_END}, {TIMESTAMP_BLIT_START, TIMESTAMP_BLIT_END}};
+	const char *names[] = {"clear", "blit"};
+	for(uint32_t i = 0; i < 2 + dispatchCount; i++) {
+		uint32_t start = i < 2 ? slots[i][0] : TIMESTAMP_DISPATCH_START + 2 * (i - 2);
+		uint32_t end = i < 2 ? slots[i][1] : start + 1;
+		if(!results[start][1] || !results[end][1])
+			continue;
+		double startNs = referenceNs - (double)((reference - results[start][0]) & engine->timestampMask) * period;
+		double endNs = referenceNs - (double)((reference - results[end][0]) & engine->timestampMask) * period;
+		if(startNs < 0 || endNs < startNs)
+			continue;
+		EngineTraceGpuZone(i < 2 ? names[i] : "dispatch", (uint64_t)startNs, (uint64_t)endNs);
+	}
+}
+
+/*Pipeline cache file: a pipelineCacheFileHeader naming the device and driver it was written on, then the cache data.
+Anything that doesn't match this device and driver exactly is ignored and the cache starts out empty*/
+#define PIPELINE_CACHE_MAGIC 0x43505256 //"VRPC"
+#define PIPELINE_CACHE_FORMAT 1
+#define PIPELINE_CACHE_MAX_SIZE (256u << 20)
+typedef struct {
+	uint32_t magic, format;
+	uint32_t vendorID, deviceID, driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t dataSize, checksum; //FNV-1a of the data
+} pipelineCacheFileHeader;
+
+uint64_t fnv1a(const uint8_t *data, size_t size) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for(size_t i = 0; i < size; i++) {
+		hash = (hash ^ data[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+//zeroed first, so the padding in front of dataSize is written the same way every time
+pipelineCacheFileHeader pipelineCacheHeader(Engine *engine, const void *data, size_t dataSize) {
+	VkPhysicalDeviceProperties *props = &engine->physicalDeviceProperties;
+	pipelineCacheFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = PIPELINE_CACHE_MAGIC;
+	header.format = PIPELINE_CACHE_FORMAT;
+	header.vendorID = props->vendorID;
+	header.deviceID = props->deviceID;
+	header.driverVersion = props->driverVersion;
+	header.dataSize = dataSize;
+	header.checksum = fnv1a(data, dataSize);
+	memcpy(header.pipelineCacheUUID, props->pipelineCacheUUID, VK_UUID_SIZE);
+	return header;
+}
+//every device and driver gets a file of its own next to base, so jobs that switch between them don't throw each other's away:
+//<base>.<vendorID>-<deviceID>-<driverVersion>-<pipelineCacheUUID>, all in hex
+char *devicePipelineCachePath(Engine *engine, const char *base) {
+	VkPhysicalDeviceProperties *props = &engine->physicalDeviceProperties;
+	size_t length = strlen(base) + 3 * 9 + 2 * VK_UUID_SIZE + 2;
+	char *path = malloc(length);
+	if(path == NULL)
+		return NULL;
+	int written = snprintf(path, length, "%s.%x-%x-%x-", base, props->vendorID, props->deviceID, props->driverVersion);
+	for(size_t i = 0; i < VK_UUID_SIZE; i++) {
+		written += snprintf(path + written, length - written, "%02x", props->pipelineCacheUUID[i]);
+	}
+	return path;
+}
+//the data starts with Vulkan's own VkPipelineCacheHeaderVersionOne, which has to agree with the device too
+bool vulkanCacheHeaderMatches(Engine *engine, const uint8_t *data, size_t dataSize) {
+	uint32_t fields[4]; //headerSize, headerVersion, vendorID, deviceID
+	if(dataSize < sizeof(fields) + VK_UUID_SIZE)
+		return false;
+	memcpy(fields, data, sizeof(fields));
+	VkPhysicalDeviceProperties *props = &engine->physicalDeviceProperties;
+	return fields[0] >= sizeof(fields) + VK_UUID_SIZE && fields[0] <= dataSize && fields[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& fields[2] == props->vendorID && fields[3] == props->deviceID
+		&& memcmp(data + sizeof(fields), props->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+//NULL when there is no usable cache at path
+void *readPipelineCache(Engine *engine, const char *path, size_t *dataSize) {
+	FILE *file = fopen(path, "rb");
+	if(file == NULL)
+		return NULL;
+	pipelineCacheFileHeader header;
+	pipelineCacheFileHeader expected = pipelineCacheHeader(engine, NULL, 0);
+	uint8_t *data = NULL;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == expected.magic && header.format == expected.format
+		&& header.vendorID == expected.vendorID && header.deviceID == expected.deviceID && header.driverVersion == expected.driverVersion
+		&& memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0
+		&& header.dataSize > 0 && header.dataSize <= PIPELINE_CACHE_MAX_SIZE;
+	if(valid) {
+		data = malloc(header.dataSize);
+		valid = data != NULL && fread(data, 1, header.dataSize, file) == header.dataSize
+			&& fnv1a(data, header.dataSize) == header.checksum && vulkanCacheHeaderMatches(engine, data, header.dataSize);
+	}
+	fclose(file);
+	if(!valid) {
+		debug_msg("pipeline cache %s is from another device or driver, or damaged; starting empty\n", path);
+		free(data);
+		return NULL;
+	}
+	*dataSize = header.dataSize;
+	return data;
+}
+EngineResult createPipelineCache(Engine *engine) {
+	size_t dataSize = 0;
+	void *data = NULL;
+	if(engine->pipelineCachePath != NULL) {
+		//the device is known from here on, so the path the app gave becomes the one of this device's file
+		char *path = devicePipelineCachePath(engine, engine->pipelineCachePath);
+		ERR_CHECK(path != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+		free(engine->pipelineCachePath);
+		engine->pipelineCachePath = path;
+		data = readPipelineCache(engine, engine->pipelineCachePath, &dataSize);
+	}
+	VkPipelineCacheCreateInfo cacheCI = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.initialDataSize = dataSize,
+		.pInitialData = data,
+	};
+	res = vkCreatePipelineCache(engine->device, &cacheCI, NULL, &engine->pipelineCache);
+	free(data);
+	if(res != VK_SUCCESS && dataSize > 0) {
+		//the driver can still refuse data that passed our checks
+		cacheCI.initialDataSize = 0;
+		cacheCI.pInitialData = NULL;
+		res = vkCreatePipelineCache(engine->device, &cacheCI, NULL, &engine->pipelineCache);
+	}
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_SHADER_CREATION_FAILED, res);
+	if(dataSize > 0)
+		debug_msg("pipeline cache: %zu bytes from %s\n", dataSize, engine->pipelineCachePath);
+	return ENGINE_RESULT_SUCCESS;
+}
+//written next to the old file and renamed over it, so a job killed halfway never leaves a broken cache behind
+bool writePipelineCache(Engine *engine, const char *path) {
+	size_t dataSize = 0;
+	if(vkGetPipelineCacheData(engine->device, engine->pipelineCache, &dataSize, NULL) != VK_SUCCESS || dataSize == 0)
+		return false;
+	uint8_t *data = malloc(dataSize);
+	size_t tmpLength = strlen(path) + sizeof(".tmp");
+	char *tmpPath = malloc(tmpLength);
+	bool written = data != NULL && tmpPath != NULL && vkGetPipelineCacheData(engine->device, engine->pipelineCache, &dataSize, data) == VK_SUCCESS;
+	FILE *file = NULL;
+	if(written) {
+		snprintf(tmpPath, tmpLength, "%s.tmp", path);
+		file = fopen(tmpPath, "wb");
+		written = file != NULL;
+	}
+	if(written) {
+		pipelineCacheFileHeader header = pipelineCacheHeader(engine, data, dataSize);
+		written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data, 1, dataSize, file) == dataSize;
+		written = fclose(file) == 0 && written;
+		#ifdef _WIN32
+		//rename doesn't replace existing files here
+		if(written)
+			remove(path);
+		#endif
+		written = written && rename(tmpPath, path) == 0;
+		if(!written)
+			remove(tmpPath);
+	}
+	free(data);
+	free(tmpPath);
+	return written;
+}
+EngineResult EngineSavePipelineCache(Engine *engine) {
+	if(engine->pipelineCachePath == NULL || engine->pipelineCache == VK_NULL_HANDLE)
+		return ENGINE_RESULT_SUCCESS;
+	ERR_CHECK(writePipelineCache(engine, engine->pipelineCachePath), ENGINE_FILE_WRITE_FAILED, VK_SUCCESS);
+	return ENGINE_RESULT_SUCCESS;
+}
+
+//constants 1 to 7, in the order raytrace.comp numbers them
+VkSpecializationInfo shaderSpecialisation(specialisationConstants *constants, pipelineKey key) {
+	uint32_t data[] = {
+		key.sizeX, key.sizeY, key.materialCount, key.sunlightCount, key.wavefrontStage, key.bounceDepth, key.flags
+	};
+	for(uint32_t i = 0; i < ARR_SIZE(data); i++) {
+		constants->data[i] = data[i];
+		constants->mapEntries[i] = (VkSpecializationMapEntry) {
+			.constantID = i + 1,
+			.offset = i * sizeof(uint32_t),
+			.size = sizeof(uint32_t)
+		};
+	}
+	return (VkSpecializationInfo) {
+		.dataSize = sizeof(constants->data),
+		.pData = constants->data,
+		.mapEntryCount = ARR_SIZE(constants->mapEntries),
+		.pMapEntries = constants->mapEntries
+	};
+}
+//what the shaders' own pipelines should be built with; shaderPipelines.key is what they are built with right now
+pipelineKey defaultPipelineKey(Engine *engine) {
+	return (pipelineKey) {
+		.sizeX = engine->workgroupSizeX,
+		.sizeY = engine->workgroupSizeY,
+		.materialCount = engine->materialBuffer.length,
+		.sunlightCount = engine->sunlightBuffer.length,
+		.wavefrontStage = 0,
+		.bounceDepth = SHADER_MAX_BOUNCES,
+		.flags = 0
+	};
+}
+bool samePipelineKey(pipelineKey a, pipelineKey b) {
+	return memcmp(&a, &b, sizeof(pipelineKey)) == 0;
+}
+VkComputePipelineCreateInfo computePipelineCI(Engine *engine, VkShaderModule module, const VkSpecializationInfo *specialInfo) {
+	return (VkComputePipelineCreateInfo) {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.layout = engine->pipelineLayout,
+		.stage = (VkPipelineShaderStageCreateInfo) {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pName = "main",
+			.pNext = NULL,
+			.pSpecializationInfo = specialInfo,
+			.module = module,
+		},
+	};
+}
+
+/*Pipeline compiler: a single thread working through the queue in order. The pipeline cache synchronises itself,
+so the render thread can keep using it meanwhile; the modules and the layout stay alive until the thread is joined*/
+int pipelineCompilerMain(void *data) {
+	Engine *engine = data;
+	EngineTraceSetThreadName("pipeline compiler");
+	mtx_lock(&engine->compilerLock);
+	while(true) {
+		while(engine->compilerQueue == NULL && !engine->compilerQuitting) {
+			cnd_wait(&engine->compilerWake, &engine->compilerLock);
+		}
+		//whatever is still queued gets built before quitting, so every job ends up done
+		pipelineJob *job = engine->compilerQueue;
+		if(job == NULL)
+			break;
+		engine->compilerQueue = job->next;
+		if(engine->compilerQueue == NULL)
+			engine->compilerQueueTail = NULL;
+		mtx_unlock(&engine->compilerLock);
+
+		EngineTraceZone zone = EngineTraceBegin("vkCreateComputePipelines");
+		job->result = vkCreateComputePipelines(engine->device, engine->pipelineCache, job->count, job->pipelineCIs, NULL, job->pipelines);
+		EngineTraceEnd(zone);
+		atomic_store(&job->done, true);
+
+		mtx_lock(&engine->compilerLock);
+		engine->compilerPending--;
+		cnd_broadcast(&engine->compilerJobDone);
+	}
+	mtx_unlock(&engine->compilerLock);
+	return 0;
+}
+EngineResult startPipelineCompiler(Engine *engine) {
+	if(engine->compilerStarted)
+		return ENGINE_RESULT_SUCCESS;
+	engine->compilerQueue = NULL;
+	engine->compilerQueueTail = NULL;
+	engine->compilerPending = 0;
+	engine->compilerQuitting = false;
+	ERR_CHECK(mtx_init(&engine->compilerLock, mtx_plain) == thrd_success, ENGINE_THREAD_CREATION_FAILED, VK_SUCCESS);
+	cnd_init(&engine->compilerWake);
+	cnd_init(&engine->compilerJobDone);
+	if(thrd_create(&engine->compilerThread, pipelineCompilerMain, engine) != thrd_success) {
+		cnd_destroy(&engine->compilerWake);
+		cnd_destroy(&engine->compilerJobDone);
+		mtx_destroy(&engine->compilerLock);
+		return (EngineResult) {ENGINE_THREAD_CREATION_FAILED, VK_SUCCESS};
+	}
+	engine->compilerStarted = true;
+	return ENGINE_RESULT_SUCCESS;
+}
+void stopPipelineCompiler(Engine *engine) {
+	if(!engine->compilerStarted)
+		return;
+	mtx_lock(&engine->compilerLock);
+	engine->compilerQuitting = true;
+	cnd_broadcast(&engine->compilerWake);
+	mtx_unlock(&engine->compilerLock);
+	thrd_join(engine->compilerThread, NULL);
+	cnd_destroy(&engine->compilerWake);
+	cnd_destroy(&engine->compilerJobDone);
+	mtx_destroy(&engine->compilerLock);
+	engine->compilerStarted = false;
+}
+void destroyPipelineJob(pipelineJob *job) {
+	free(job->pipelineCIs);
+	free(job->specialInfos);
+	free(job->constants);
+	free(job->pipelines);
+	free(job);
+}
+//count pipelines, each filled in with setJobPipeline before the job is submitted
+pipelineJob *createPipelineJob(uint32_t count) {
+	pipelineJob *job = malloc(sizeof(pipelineJob));
+	if(job == NULL)
+		return NULL;
+	job->count = count;
+	job->pipelineCIs = malloc(sizeof(VkComputePipelineCreateInfo) * count);
+	job->specialInfos = malloc(sizeof(VkSpecializationInfo) * count);
+	job->constants = malloc(sizeof(specialisationConstants) * count);
+	job->pipelines = calloc(count, sizeof(VkPipeline));
+	job->result = VK_NOT_READY;
+	atomic_init(&job->done, false);
+	job->next = NULL;
+	if(job->pipelineCIs == NULL || job->specialInfos == NULL || job->constants == NULL || job->pipelines == NULL) {
+		destroyPipelineJob(job);
+		return NULL;
+	}
+	return job;
+}
+void setJobPipeline(Engine *engine, pipelineJob *job, uint32_t index, VkShaderModule module, pipelineKey key) {
+	job->specialInfos[index] = shaderSpecialisation(&job->constants[index], key);
+	job->pipelineCIs[index] = computePipelineCI(engine, module, &job->specialInfos[index]);
+}
+void submitPipelineJob(Engine *engine, pipelineJob *job) {
+	mtx_lock(&engine->compilerLock);
+	if(engine->compilerQueueTail != NULL) {
+		engine->compilerQueueTail->next = job;
+	} else {
+		engine->compilerQueue = job;
+	}
+	engine->compilerQueueTail = job;
+	engine->compilerPending++;
+	cnd_signal(&engine->compilerWake);
+	mtx_unlock(&engine->compilerLock);
+}
+
+void destroyRetiredObject(Engine *engine, retiredObject retired) {
+	if(retired.pipeline != VK_NULL_HANDLE)
+		vkDestroyPipeline(engine->device, retired.pipeline, NULL);
+	if(retired.buffer != VK_NULL_HANDLE)
+		vmaDestroyBuffer(engine->allocator, retired.buffer, retired.allocation);
+}
+void retireObject(Engine *engine, retiredObject retired) {
+	retired.asyncValue = engine->asyncValue;
+	if(engine->retiredObjectCount == engine->retiredObjectCapacity) {
+		size_t capacity = engine->retiredObjectCapacity == 0 ? 8 : 2 * engine->retiredObjectCapacity;
+		retiredObject *objects = realloc(engine->retiredObjects, sizeof(retiredObject) * capacity);
+		if(objects == NULL) {
+			vkDeviceWaitIdle(engine->device);
+			destroyRetiredObject(engine, retired);
+			return;
+		}
+		engine->retiredObjects = objects;
+		engine->retiredObjectCapacity = capacity;
+	}
+	engine->retiredObjects[engine->retiredObjectCount++] = retired;
+}
+//a pipeline the frames in flight or an async command may still be using; the frame being started gets its replacement
+void retirePipeline(Engine *engine, VkPipeline pipeline) {
+	if(pipeline == VK_NULL_HANDLE)
+		return;
+	retireObject(engine, (retiredObject) {.pipeline = pipeline, .frameEnd = engine->frameIndex});
+}
+//the frame being recorded may still use the buffer as well
+void retireBuffer(Engine *engine, VkBuffer buffer, VmaAllocation allocation) {
+	if(buffer == VK_NULL_HANDLE)
+		return;
+	retireObject(engine, (retiredObject) {.buffer = buffer, .allocation = allocation, .frameEnd = engine->frameIndex + 1});
+}
+void destroyRetiredObjects(Engine *engine) {
+	if(engine->retiredObjectCount == 0)
+		return;
+	uint64_t asyncValue = 0;
+	vkGetSemaphoreCounterValue(engine->device, engine->asyncTimeline, &asyncValue);
+	size_t kept = 0;
+	for(size_t i = 0; i < engine->retiredObjectCount; i++) {
+		retiredObject retired = engine->retiredObjects[i];
+		bool framesDone = retired.frameEnd == 0 || EngineFrameFinished(engine, retired.frameEnd - 1);
+		if(framesDone && asyncValue >= retired.asyncValue) {
+			destroyRetiredObject(engine, retired);
+		} else {
+			engine->retiredObjects[kept++] = retired;
+		}
+	}
+	engine->retiredObjectCount = kept;
+}
+
+EngineResult createPipelineSet(pipelineSet *set, uint32_t count, pipelineKey key) {
+	set->pipelines = calloc(count, sizeof(VkPipeline));
+	ERR_CHECK(set->pipelines != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	set->count = count;
+	set->key = key;
+	set->job = NULL;
+	set->jobFailed = false;
+	return ENGINE_RESULT_SUCCESS;
+}
+//only once the compiler is stopped
+void destroyPipelineSet(Engine *engine, pipelineSet *set) {
+	for(uint32_t i = 0; i < set->count; i++) {
+		if(set->pipelines[i] != VK_NULL_HANDLE)
+			vkDestroyPipeline(engine->device, set->pipelines[i], NULL);
+		if(set->job != NULL && set->job->pipelines[i] != VK_NULL_HANDLE)
+			vkDestroyPipeline(engine->device, set->job->pipelines[i], NULL);
+	}
+	if(set->job != NULL)
+		destroyPipelineJob(set->job);
+	free(set->pipelines);
+	set->pipelines = NULL;
+	set->count = 0;
+}
+//a build is started when the set's pipelines are missing or were built with another key, unless one is running already
+bool pipelineSetNeedsBuild(pipelineSet *set, pipelineKey key) {
+	if(set->job != NULL || (set->jobFailed && samePipelineKey(set->jobKey, key)))
+		return false;
+	return set->pipelines[0] == VK_NULL_HANDLE || !samePipelineKey(set->key, key);
+}
+void startPipelineSetBuild(Engine *engine, pipelineSet *set, pipelineJob *job, pipelineKey key) {
+	set->job = job;
+	set->jobKey = key;
+	set->jobFailed = false;
+	submitPipelineJob(engine, job);
+}
+//true when the set changed
+bool swapPipelineSet(Engine *engine, pipelineSet *set) {
+	pipelineJob *job = set->job;
+	if(job == NULL || !atomic_load(&job->done))
+		return false;
+	set->job = NULL;
+	bool swapped = job->result == VK_SUCCESS;
+	for(uint32_t i = 0; i < set->count; i++) {
+		if(swapped) {
+			retirePipeline(engine, set->pipelines[i]);
+			set->pipelines[i] = job->pipelines[i];
+		} else if(job->pipelines[i] != VK_NULL_HANDLE) {
+			vkDestroyPipeline(engine->device, job->pipelines[i], NULL);
+		}
+	}
+	if(swapped) {
+		set->key = set->jobKey;
+		invalidateFrameCommands(engine);
+	} else {
+		debug_msg("pipeline build failed: %d, keeping the pipelines from before\n", job->result);
+		set->jobFailed = true;
+	}
+	destroyPipelineJob(job);
+	return swapped;
+}
+
+/*The shaders' own pipelines follow defaultPipelineKey, the wavefront kernels the same key with their stage.
+With a new material count the old pipelines keep going until the new ones are there: MATERIALCOUNT only sizes the array
+behind the material address, the materials themselves are read from the new buffer*/
+EngineResult startPipelineBuilds(Engine *engine) {
+	pipelineKey key = defaultPipelineKey(engine);
+	if(engine->shaderModulesCount > 0 && pipelineSetNeedsBuild(&engine->shaderPipelines, key)) {
+		pipelineJob *job = createPipelineJob(engine->shaderModulesCount);
+		ERR_CHECK(job != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+		for(uint32_t i = 0; i < engine->shaderModulesCount; i++) {
+			setJobPipeline(engine, job, i, engine->shaderModules[i], key);
+		}
+		startPipelineSetBuild(engine, &engine->shaderPipelines, job, key);
+	}
+	if(engine->wavefrontLoaded && pipelineSetNeedsBuild(&engine->wavefrontPipelines, key)) {
+		pipelineJob *job = createPipelineJob(WAVEFRONT_STAGE_COUNT);
+		ERR_CHECK(job != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+		for(uint32_t i = 0; i < WAVEFRONT_STAGE_COUNT; i++) {
+			pipelineKey stageKey = key;
+			stageKey.wavefrontStage = i + 1;
+			setJobPipeline(engine, job, i, engine->shaderModules[engine->wavefrontShader], stageKey);
+		}
+		startPipelineSetBuild(engine, &engine->wavefrontPipelines, job, key);
+	}
+	return ENGINE_RESULT_SUCCESS;
+}
+
+shaderVariant *findShaderVariant(Engine *engine, size_t index, pipelineKey key) {
+	for(size_t i = 0; i < engine->shaderVariantCount; i++) {
+		shaderVariant *variant = &engine->shaderVariants[i];
+		if(variant->shaderIndex == index && samePipelineKey(variant->key, key))
+			return variant;
+	}
+	return NULL;
+}
+//starts building the variant unless it was requested before; NULL when there is no memory left for it
+shaderVariant *requestShaderVariant(Engine *engine, size_t index, pipelineKey key) {
+	shaderVariant *variant = findShaderVariant(engine, index, key);
+	if(variant != NULL)
+		return variant;
+	if(engine->shaderVariantCount == engine->shaderVariantCapacity) {
+		size_t capacity = engine->shaderVariantCapacity == 0 ? 8 : 2 * engine->shaderVariantCapacity;
+		shaderVariant *variants = realloc(engine->shaderVariants, sizeof(shaderVariant) * capacity);
+		if(variants == NULL)
+			return NULL;
+		engine->shaderVariants = variants;
+		engine->shaderVariantCapacity = capacity;
+	}
+	pipelineJob *job = createPipelineJob(1);
+	if(job == NULL)
+		return NULL;
+	setJobPipeline(engine, job, 0, engine->shaderModules[index], key);
+	submitPipelineJob(engine, job);
+	variant = &engine->shaderVariants[engine->shaderVariantCount++];
+	*variant = (shaderVariant) {
+		.shaderIndex = index,
+		.key = key,
+		.pipeline = VK_NULL_HANDLE,
+		.job = job
+	};
+	return variant;
+}
+//variants that got built since the last frame; true when any did
+bool collectShaderVariants(Engine *engine) {
+	bool collected = false;
+	for(size_t i = 0; i < engine->shaderVariantCount; i++) {
+		shaderVariant *variant = &engine->shaderVariants[i];
+		if(variant->job == NULL || !atomic_load(&variant->job->done))
+			continue;
+		if(variant->job->result == VK_SUCCESS) {
+			variant->pipeline = variant->job->pipelines[0];
+			collected = true;
+		} else {
+			pipelineKey key = variant->key;
+			debug_msg("shader variant (%ux%u, %u bounces, flags %u) failed: %d\n", key.sizeX, key.sizeY, key.bounceDepth, key.flags, variant->job->result);
+			if(variant->job->pipelines[0] != VK_NULL_HANDLE)
+				vkDestroyPipeline(engine->device, variant->job->pipelines[0], NULL);
+		}
+		destroyPipelineJob(variant->job);
+		variant->job = NULL;
+	}
+	return collected;
+}
+//variants of other workgroup sizes were only there for tuning or for the size before
+void dropShaderVariants(Engine *engine, uint32_t sizeX, uint32_t sizeY) {
+	size_t kept = 0;
+	for(size_t i = 0; i < engine->shaderVariantCount; i++) {
+		shaderVariant variant = engine->shaderVariants[i];
+		if((variant.key.sizeX == sizeX && variant.key.sizeY == sizeY) || variant.job != NULL) {
+			engine->shaderVariants[kept++] = variant;
+		} else {
+			retirePipeline(engine, variant.pipeline);
+		}
+	}
+	engine->shaderVariantCount = kept;
+}
+//at the start of a frame: finished builds replace what the frames dispatch, and builds for changed keys are started
+EngineResult updatePipelines(Engine *engine) {
+	if(engine->shaderModulesCount == 0)
+		return ENGINE_RESULT_SUCCESS;
+	pipelineKey oldKey = engine->shaderPipelines.key;
+	bool shadersSwapped = swapPipelineSet(engine, &engine->shaderPipelines);
+	if(shadersSwapped && !engine->tuning && (oldKey.sizeX != engine->shaderPipelines.key.sizeX || oldKey.sizeY != engine->shaderPipelines.key.sizeY))
+		dropShaderVariants(engine, engine->shaderPipelines.key.sizeX, engine->shaderPipelines.key.sizeY);
+	if(engine->wavefrontLoaded)
+		swapPipelineSet(engine, &engine->wavefrontPipelines);
+	//recordings that fell back to another pipeline pick the variant now
+	if(collectShaderVariants(engine))
+		invalidateFrameCommands(engine);
+	return startPipelineBuilds(engine);
+}
+bool EnginePipelinesPending(Engine *engine) {
+	if(!engine->compilerStarted)
+		return false;
+	mtx_lock(&engine->compilerLock);
+	bool pending = engine->compilerPending > 0;
+	mtx_unlock(&engine->compilerLock);
+	return pending;
+}
+EngineResult EngineWaitForPipelines(Engine *engine) {
+	EngineTraceZone zone = EngineTraceBegin("wait for pipelines");
+	//swapping a build in can start the next one, when the key changed again while it was running
+	do {
+		if(engine->compilerStarted) {
+			mtx_lock(&engine->compilerLock);
+			while(engine->compilerPending > 0) {
+				cnd_wait(&engine->compilerJobDone, &engine->compilerLock);
+			}
+			mtx_unlock(&engine->compilerLock);
+		}
+		EngineResult eRes = updatePipelines(engine);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	} while(EnginePipelinesPending(engine));
+	EngineTraceEnd(zone);
+	return ENGINE_RESULT_SUCCESS;
+}
+
+bool workgroupSizeSupported(Engine *engine, uint32_t sizeX, uint32_t sizeY) {
+	VkPhysicalDeviceLimits *limits = &engine->physicalDeviceProperties.limits;
+	return sizeX > 0 && sizeY > 0 && sizeX <= limits->maxComputeWorkGroupSize[0] && sizeY <= limits->maxComputeWorkGroupSize[1]
+		&& sizeX * sizeY <= limits->maxComputeWorkGroupInvocations;
+}
+//the pipelines are rebuilt in the background, the frames keep the old size until they are swapped in
+EngineResult applyWorkgroupSize(Engine *engine, uint32_t sizeX, uint32_t sizeY) {
+	if(sizeX == engine->workgroupSizeX && sizeY == engine->workgroupSizeY)
+		return ENGINE_RESULT_SUCCESS;
+	engine->workgroupSizeX = sizeX;
+	engine->workgroupSizeY = sizeY;
+	debug_msg("workgroup size: %ux%u\n", sizeX, sizeY);
+	return startPipelineBuilds(engine);
+}
+
+/*The tuning file has a "<vendorID>:<deviceID> <driverVersion> <sizeX> <sizeY>" line per device*/
+#define TUNING_LINE_LENGTH 128
+#define TUNING_MAX_DEVICES 32
+bool tuningLineMatches(Engine *engine, const char *line, uint32_t *sizeX, uint32_t *sizeY) {
+	unsigned vendorID = 0, deviceID = 0, driverVersion = 0, x = 0, y = 0;
+	if(sscanf(line, "%x:%x %u %u %u", &vendorID, &deviceID, &driverVersion, &x, &y) != 5)
+		return false;
+	*sizeX = x;
+	*sizeY = y;
+	return vendorID == engine->physicalDeviceProperties.vendorID && deviceID == engine->physicalDeviceProperties.deviceID
+		&& driverVersion == engine->physicalDeviceProperties.driverVersion;
+}
+bool readWorkgroupTuning(Engine *engine, const char *path, uint32_t *sizeX, uint32_t *sizeY) {
+	FILE *file = fopen(path, "r");
+	if(file == NULL)
+		return false;
+	char line[TUNING_LINE_LENGTH];
+	bool found = false;
+	while(!found && fgets(line, sizeof(line), file) != NULL) {
+		found = tuningLineMatches(engine, line, sizeX, sizeY);
+	}
+	fclose(file);
+	return found;
+}
+//replaces this device's line and keeps the others
+bool writeWorkgroupTuning(Engine *engine, const char *path) {
+	char lines[TUNING_MAX_DEVICES][TUNING_LINE_LENGTH];
+	uint32_t lineCount = 0, sizeX = 0, sizeY = 0;
+	FILE *file = fopen(path, "r");
+	if(file != NULL) {
+		while(lineCount < TUNING_MAX_DEVICES - 1 && fgets(lines[lineCount], TUNING_LINE_LENGTH, file) != NULL) {
+			if(!tuningLineMatches(engine, lines[lineCount], &sizeX, &sizeY) && strchr(lines[lineCount], '\n') != NULL)
+				lineCount++;
+		}
+		fclose(file);
+	}
+	VkPhysicalDeviceProperties *props = &engine->physicalDeviceProperties;
+	snprintf(lines[lineCount++], TUNING_LINE_LENGTH, "%x:%x %u %u %u\n", props->vendorID, props->deviceID, props->driverVersion, engine->workgroupSizeX, engine->workgroupSizeY);
+	file = fopen(path, "w");
+	if(file == NULL)
+		return false;
+	for(uint32_t i = 0; i < lineCount; i++) {
+		fputs(lines[i], file);
+	}
+	return fclose(file) == 0;
+}
+
+int compareMs(const void *a, const void *b) {
+	double left = *(const double*)a, right = *(const double*)b;
+	return (left > right) - (left < right);
+}
+EngineResult finishWorkgroupTuning(Engine *engine) {
+	uint32_t best = 0;
+	double bestMs = 0;
+	for(uint32_t i = 0; i < engine->tuneCandidateCount; i++) {
+		workgroupCandidate *candidate = &engine->tuneCandidates[i];
+		qsort(candidate->samplesMs, TUNE_SAMPLES, sizeof(double), compareMs);
+		double medianMs = candidate->samplesMs[TUNE_SAMPLES / 2];
+		debug_msg("workgroup size %ux%u: %.3f ms\n", candidate->sizeX, candidate->sizeY, medianMs);
+		if(i == 0 || medianMs < bestMs) {
+			best = i;
+			bestMs = medianMs;
+		}
+	}
+	engine->tuning = false;
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		engine->frameCandidate[i] = TUNE_NONE;
+	}
+	EngineResult eRes = applyWorkgroupSize(engine, engine->tuneCandidates[best].sizeX, engine->tuneCandidates[best].sizeY);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	//with another size the other variants go once its pipelines are swapped in
+	pipelineKey key = engine->shaderPipelines.key;
+	if(key.sizeX == engine->workgroupSizeX && key.sizeY == engine->workgroupSizeY)
+		dropShaderVariants(engine, key.sizeX, key.sizeY);
+	invalidateFrameCommands(engine);
+	if(engine->tunePath != NULL && !writeWorkgroupTuning(engine, engine->tunePath))
+		debug_msg("couldn't write the workgroup size to %s\n", engine->tunePath);
+	return ENGINE_RESULT_SUCCESS;
+}
+//right after the frame's previous timings were collected
+EngineResult advanceWorkgroupTuning(Engine *engine, size_t frame) {
+	if(!engine->tuning)
+		return ENGINE_RESULT_SUCCESS;
+	bool done = true;
+	for(uint32_t i = 0; i < engine->tuneCandidateCount; i++) {
+		done &= engine->tuneCandidates[i].sampleCount >= TUNE_SAMPLES;
+	}
+	if(done)
+		return finishWorkgroupTuning(engine);
+	//the candidates take turns, so a clock change hits all of them alike
+	do {
+		engine->tuneNext = (engine->tuneNext + 1) % engine->tuneCandidateCount;
+	} while(engine->tuneCandidates[engine->tuneNext].sampleCount >= TUNE_SAMPLES);
+	//a candidate only gets frames once its pipelines are built, so anything the frame falls back to has its size
+	pipelineKey key = defaultPipelineKey(engine);
+	key.sizeX = engine->tuneCandidates[engine->tuneNext].sizeX;
+	key.sizeY = engine->tuneCandidates[engine->tuneNext].sizeY;
+	bool ready = true;
+	for(size_t i = 0; i < engine->shaderModulesCount; i++) {
+		shaderVariant *variant = requestShaderVariant(engine, i, key);
+		ready &= variant != NULL && variant->pipeline != VK_NULL_HANDLE;
+	}
+	engine->frameCandidate[frame] = ready ? engine->tuneNext : TUNE_NONE;
+	engine->frameCandidateUsed[frame] = false;
+	engine->frameCommandRecorded[frame] = false;
+	return ENGINE_RESULT_SUCCESS;
+}
+void addTuningSample(Engine *engine, size_t frame, double dispatchMs) {
+	if(!engine->tuning || !engine->frameCandidateUsed[frame] || engine->frameCandidate[frame] == TUNE_NONE || dispatchMs < 0)
+		return;
+	workgroupCandidate *candidate = &engine->tuneCandidates[engine->frameCandidate[frame]];
+	if(candidate->sampleCount < TUNE_SAMPLES)
+		candidate->samplesMs[candidate->sampleCount++] = dispatchMs;
+}
+//the shaders' own key with the size their pipelines have right now, or that of the frame's candidate while tuning
+pipelineKey framePipelineKey(Engine *engine) {
+	pipelineKey key = defaultPipelineKey(engine);
+	if(engine->shaderModulesCount > 0) {
+		key.sizeX = engine->shaderPipelines.key.sizeX;
+		key.sizeY = engine->shaderPipelines.key.sizeY;
+	}
+	uint32_t candidate = engine->frameCandidate[engine->cur_frame];
+	if(engine->tuning && candidate != TUNE_NONE) {
+		key.sizeX = engine->tuneCandidates[candidate].sizeX;
+		key.sizeY = engine->tuneCandidates[candidate].sizeY;
+	}
+	return key;
+}
+EngineResult EngineAutotuneWorkgroupSize(Engine *engine, const char *path) {
+	free(engine->tunePath);
+	engine->tunePath = NULL;
+	if(path != NULL) {
+		size_t length = strlen(path) + 1;
+		engine->tunePath = malloc(length);
+		ERR_CHECK(engine->tunePath != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+		memcpy(engine->tunePath, path, length);
+	}
+	uint32_t sizeX = 0, sizeY = 0;
+	if(path != NULL && readWorkgroupTuning(engine, path, &sizeX, &sizeY) && workgroupSizeSupported(engine, sizeX, sizeY))
+		return applyWorkgroupSize(engine, sizeX, sizeY);
+	if(!engine->timestampsSupported) {
+		debug_msg("no timestamps to tune the workgroup size with, keeping %ux%u\n", engine->workgroupSizeX, engine->workgroupSizeY);
+		return ENGINE_RESULT_SUCCESS;
+	}
+	uint32_t candidates[][2] = {{8, 8}, {16, 8}, {8, 16}, {16, 16}, {32, 8}, {32, 16}, {32, 32}};
+	engine->tuneCandidateCount = 0;
+	for(size_t i = 0; i < ARR_SIZE(candidates); i++) {
+		if(!workgroupSizeSupported(engine, candidates[i][0], candidates[i][1]))
+			continue;
+		engine->tuneCandidates[engine->tuneCandidateCount++] = (workgroupCandidate) {
+			.sizeX = candidates[i][0],
+			.sizeY = candidates[i][1],
+			.sampleCount = 0
+		};
+	}
+	engine->tuning = engine->tuneCandidateCount > 1;
+	engine->tuneNext = 0;
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		engine->frameCandidate[i] = TUNE_NONE;
+	}
+	return ENGINE_RESULT_SUCCESS;
+}
+bool EngineWorkgroupTuning(Engine *engine) {
+	return engine->tuning;
+}
+void EngineGetWorkgroupSize(Engine *engine, uint32_t *sizeX, uint32_t *sizeY) {
+	pipelineKey key = framePipelineKey(engine);
+	*sizeX = key.sizeX;
+	*sizeY = key.sizeY;
+}
+EngineShaderRunInfo EngineDispatchGrid(Engine *engine, uint32_t width, uint32_t height) {
+	uint32_t sizeX = 0, sizeY = 0;
+	EngineGetWorkgroupSize(engine, &sizeX, &sizeY);
+	return (EngineShaderRunInfo) {
+		.groupSizeX = (width + sizeX - 1) / sizeX,
+		.groupSizeY = (height + sizeY - 1) / sizeY,
+		.groupSizeZ = 1
+	};
+}
+//has to be called only once the frame is known to be finished, so nothing here ever waits
+void collectFrameTimings(Engine *engine, size_t frame) {
+	if(!engine->queriesPending[frame])
+		return;
+	engine->queriesPending[frame] = false;
+	uint32_t dispatchCount = engine->timedDispatchCount[frame];
+	EngineFrameTimings timings = {
+		.available = true,
+		.frameIndex = engine->queryFrameIndex[frame],
+		.clearMs = -1,
+		.dispatchMs = -1,
+		.blitMs = -1,
+		.frameMs = -1,
+		.dispatchCount = dispatchCount,
+		.invocationsAvailable = false,
+		.computeInvocations = 0
+	};
+	if(engine->timestampsSupported) {
+		uint64_t results[TIMESTAMP_QUERY_COUNT][2] = {0};
+		uint32_t queryCount = TIMESTAMP_DISPATCH_START + 2 * dispatchCount;
+		res = vkGetQueryPoolResults(engine->device, engine->timestampPools[frame], 0, queryCount, sizeof(results), results, sizeof(results[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		if(res == VK_SUCCESS || res == VK_NOT_READY) {
+			timings.clearMs = timestampSpan(engine, results, TIMESTAMP_CLEAR_START, TIMESTAMP_CLEAR_END);
+			timings.blitMs = timestampSpan(engine, results, TIMESTAMP_BLIT_START, TIMESTAMP_BLIT_END);
+			timings.frameMs = timestampSpan(engine, results, TIMESTAMP_CLEAR_START, TIMESTAMP_BLIT_END);
+			for(uint32_t i = 0; i < dispatchCount; i++) {
+				double span = timestampSpan(engine, results, TIMESTAMP_DISPATCH_START + 2 * i, TIMESTAMP_DISPATCH_START + 2 * i + 1);
+				if(span < 0)
+					continue;
+				timings.dispatchMs = (timings.dispatchMs < 0 ? 0 : timings.dispatchMs) + span;
+			}
+			if(EngineTraceEnabled())
+				traceGpuFrame(engine, results, dispatchCount);
+		}
+		if(engine->hostQueryReset)
+			vkResetQueryPool(engine->device, engine->timestampPools[frame], 0, TIMESTAMP_QUERY_COUNT);
+	}
+	if(engine->pipelineStatisticsSupported) {
+		uint64_t results[MAX_TIMED_DISPATCHES][2] = {0};
+		if(dispatchCount > 0) {
+			res = vkGetQueryPoolResults(engine->device, engine->statisticsPools[frame], 0, dispatchCount, sizeof(results), results, sizeof(results[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+			for(uint32_t i = 0; i < dispatchCount && (res == VK_SUCCESS || res == VK_NOT_READY); i++) {
+				if(!results[i][1])
+					continue;
+				timings.invocationsAvailable = true;
+				timings.computeInvocations += results[i][0];
+			}
+		}
+		if(engine->hostQueryReset)
+			vkResetQueryPool(engine->device, engine->statisticsPools[frame], 0, MAX_TIMED_DISPATCHES);
+	}
+	engine->frameTimings = timings;
+	addTuningSample(engine, frame, timings.dispatchMs);
+}
+
+EngineFrameTimings EngineGetFrameTimings(Engine *engine) {
+	return engine->frameTimings;
+}
+
+EngineResult EngineHeadlessCreate(Engine *engine, uint32_t width, uint32_t height) {
+	engine->pixelResolution.width = width;
+	engine->pixelResolution.height = height;
+	EngineResult eRes = createRenderImages(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+
+	for(int i = 0; i < engine->frameCount; i++) {
+		engine->headlessImages[i].imageExtent = engine->renderImages[i].imageExtent;
+		engine->headlessImages[i].imageFormat = engine->swapchainDetails.format.format;
+		VkImageCreateInfo headlessImageCI = imageCreateInfo(engine->headlessImages[i].imageFormat,
+			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			engine->headlessImages[i].imageExtent
+		);
+		headlessImageCI.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		VmaAllocationCreateInfo imageAllocationCI = {
+			.usage = VMA_MEMORY_USAGE_GPU_ONLY,
+			.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		};
+		res = vmaCreateImage(engine->allocator, &headlessImageCI, &imageAllocationCI, &engine->headlessImages[i].image, &engine->headlessImages[i].allocation, NULL);
+		ERR_CHECK(res == VK_SUCCESS, ENGINE_SWAPCHAIN_FAILED, res);
+		engine->headlessImages[i].imageView = VK_NULL_HANDLE;
+
+		VkBufferCreateInfo readbackCI = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.pNext = NULL,
+			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+			.size = (VkDeviceSize)width * height * 4,
+			.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		};
+		VmaAllocationCreateInfo readbackAllocationCI = {
+			.usage = VMA_MEMORY_USAGE_AUTO,
+			.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT,
+		};
+		res = vmaCreateBuffer(engine->allocator, &readbackCI, &readbackAllocationCI, &engine->readback[i].buffer, &engine->readback[i].allocation, NULL);
+		ERR_CHECK(res == VK_SUCCESS, ENGINE_BUFFER_CREATION_FAILED, res);
+		res = vmaMapMemory(engine->allocator, engine->readback[i].allocation, &engine->readback[i].data);
+		ERR_CHECK(res == VK_SUCCESS, ENGINE_BUFFER_CREATION_FAILED, res);
+		engine->readback[i].pending = false;
+	}
+	return ENGINE_RESULT_SUCCESS;
+}
+void EngineHeadlessDestroy(Engine *engine) {
+	vkQueueWaitIdle(engine->graphics.queue);
+	destroyRenderImages(engine);
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		vmaDestroyImage(engine->allocator, engine->headlessImages[i].image, engine->headlessImages[i].allocation);
+		vmaUnmapMemory(engine->allocator, engine->readback[i].allocation);
+		vmaDestroyBuffer(engine->allocator, engine->readback[i].buffer, engine->readback[i].allocation);
+		engine->readback[i].pending = false;
+	}
+}
+
+void EngineSetFrameCallback(Engine *engine, EngineFrameCallback callback, void *userData) {
+	engine->frameCallback = callback;
+	engine->frameCallbackUserData = userData;
+}
+
+//has to be called only once the frame is known to be finished
+void deliverHeadlessFrame(Engine *engine, size_t frame) {
+	if(!engine->readback[frame].pending)
+		return;
+	engine->readback[frame].pending = false;
+	vmaInvalidateAllocation(engine->allocator, engine->readback[frame].allocation, 0, VK_WHOLE_SIZE);
+	if(engine->frameCallback == NULL)
+		return;
+	EngineFrameData frameData = {
+		.pixels = engine->readback[frame].data,
+		.width = engine->headlessImages[frame].imageExtent.width,
+		.height = engine->headlessImages[frame].imageExtent.height,
+		.frameIndex = engine->readback[frame].frameIndex
+	};
+	engine->frameCallback(frameData, engine->frameCallbackUserData);
+}
+
+VkResult waitTimeline(Engine *engine, size_t frame, uint64_t value, uint64_t timeout) {
+	VkSemaphoreWaitInfo waitInfo = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.semaphoreCount = 1,
+		.pSemaphores = &engine->frameTimelines[frame],
+		.pValues = &value
+	};
+	return vkWaitSemaphores(engine->device, &waitInfo, timeout);
+}
+//frames run side by side unless they share something: the accumulation image, the history the next frame reprojects,
+//the wavefront buffer, or whatever a frame wrote for all of them (staged uploads, the storage images' layouts)
+bool frameSharesState(Engine *engine) {
+	if(engine->frameCount == 1)
+		return false;
+	return engine->accumulationEnabled || engine->temporalEnabled || engine->wavefrontLoaded || engine->frameIndex <= engine->sharedWriteFrame;
+}
+//the frames after the current one see what it wrote, each of them waits for all the others until the slot comes around again
+void markSharedWrite(Engine *engine) {
+	engine->sharedWriteFrame = engine->frameIndex + engine->frameCount - 1;
+}
+//puts the next submission of the current frame behind the frame's previous one, and behind every other frame in flight when
+//frameSharesState; appends the waits to waits, which needs room for ENGINE_MAX_FRAMES_IN_FLIGHT of them,
+//waitStage is the first stage that has to wait, the signal covers everything
+void chainSubmission(Engine *engine, VkPipelineStageFlags2 waitStage, VkSemaphoreSubmitInfo *waits, uint32_t *waitCount, VkSemaphoreSubmitInfo *signal) {
+	size_t frame = engine->cur_frame;
+	waits[(*waitCount)++] = (VkSemaphoreSubmitInfo) {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+		.pNext = NULL,
+		.semaphore = engine->frameTimelines[frame],
+		.value = engine->frameDoneValue[frame],
+		.stageMask = waitStage,
+		.deviceIndex = 0
+	};
+	//not just the previous frame: the ones before it may not have shared anything, so nothing ordered them behind each other.
+	//the other frames have been submitted in full, their last values are final
+	for(size_t other = 0; other < engine->frameCount && frameSharesState(engine); other++) {
+		if(other == frame)
+			continue;
+		waits[(*waitCount)++] = (VkSemaphoreSubmitInfo) {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+			.pNext = NULL,
+			.semaphore = engine->frameTimelines[other],
+			.value = engine->frameDoneValue[other],
+			.stageMask = waitStage,
+			.deviceIndex = 0
+		};
+	}
+	engine->frameDoneValue[frame]++;
+	*signal = (VkSemaphoreSubmitInfo) {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+		.pNext = NULL,
+		.semaphore = engine->frameTimelines[frame],
+		.value = engine->frameDoneValue[frame],
+		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		.deviceIndex = 0
+	};
+}
+
+//frames that left their slot to a newer one have been waited on already
+bool frameSlotReused(Engine *engine, uint64_t frameIndex) {
+	return frameIndex + engine->frameCount <= engine->frameIndex;
+}
+//frames can finish out of order, so the ones before frameIndex that are still in flight are checked as well
+bool EngineFrameFinished(Engine *engine, uint64_t frameIndex) {
+	if(frameIndex >= engine->frameIndex)
+		return false;
+	for(uint64_t i = frameIndex + 1; i-- > 0 && !frameSlotReused(engine, i);) {
+		uint64_t value = 0;
+		size_t frame = i % engine->frameCount;
+		vkGetSemaphoreCounterValue(engine->device, engine->frameTimelines[frame], &value);
+		if(value < engine->frameDoneValue[frame])
+			return false;
+	}
+	return true;
+}
+EngineResult EngineWaitForFrame(Engine *engine, uint64_t frameIndex) {
+	//the frame being recorded has not been submitted in full, waiting for it could never return
+	ERR_CHECK(frameIndex < engine->frameIndex, ENGINE_FENCE_NOT_WORKING, VK_SUCCESS);
+	VkSemaphore semaphores[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	uint64_t values[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	uint32_t count = 0;
+	for(uint64_t i = frameIndex + 1; i-- > 0 && !frameSlotReused(engine, i);) {
+		semaphores[count] = engine->frameTimelines[i % engine->frameCount];
+		values[count++] = engine->frameDoneValue[i % engine->frameCount];
+	}
+	if(count == 0)
+		return ENGINE_RESULT_SUCCESS;
+	VkSemaphoreWaitInfo waitInfo = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.semaphoreCount = count,
+		.pSemaphores = semaphores,
+		.pValues = values
+	};
+	EngineTraceZone zone = EngineTraceBegin("vkWaitSemaphores");
+	res = vkWaitSemaphores(engine->device, &waitInfo, UINT64_MAX);
+	EngineTraceEnd(zone);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_FENCE_NOT_WORKING, res);
+	return ENGINE_RESULT_SUCCESS;
+}
+
+EngineResult EngineHeadlessFlush(Engine *engine) {
+	//oldest frame in flight is the one that is going to be reused next
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		size_t frame = (engine->cur_frame + i) % engine->frameCount;
+		if(!engine->readback[frame].pending)
+			continue;
+		EngineTraceZone zone = EngineTraceBegin("vkWaitSemaphores");
+		res = waitTimeline(engine, frame, engine->frameDoneValue[frame], UINT64_MAX);
+		EngineTraceEnd(zone);
+		ERR_CHECK(res == VK_SUCCESS, ENGINE_FENCE_NOT_WORKING, res);
+		collectFrameTimings(engine, frame);
+		deliverHeadlessFrame(engine, frame);
+	}
+	return ENGINE_RESULT_SUCCESS;
+}
+
+EngineResult CreateQueue(Engine *engine, vulkanQueue *queue) {
+	vkGetDeviceQueue(engine->device, queue->index, 0, &queue->queue);
+
+	VkCommandPoolCreateInfo commandPoolCI = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		.pNext = NULL,
+		.queueFamilyIndex = queue->index
+	};
+	res = vkCreateCommandPool(engine->device, &commandPoolCI, NULL, &queue->pool);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_QUEUECOMMAND_CREATION_FAILED, res);
+	return ENGINE_RESULT_SUCCESS;
+}
+EngineResult DestroyQueue(Engine *engine, vulkanQueue *queue) {
+	vkQueueWaitIdle(queue->queue);
+	vkDestroyCommandPool(engine->device, queue->pool, NULL);
+	return ENGINE_RESULT_SUCCESS;
+}
+
+EngineResult ChangeImageLayout(VkCommandBuffer cmd, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags2 pipelineStage) {
+	VkImageSubresourceRange subresourceRange = {
+		.aspectMask = (newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT, //idk why but for now i keep
+		.baseMipLevel = 0,
+		.levelCount = VK_REMAINING_MIP_LEVELS,
+		.baseArrayLayer = 0,
+		.layerCount = VK_REMAINING_ARRAY_LAYERS
+	};
+	VkImageMemoryBarrier2 imageBarrier = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+		.pNext = NULL,
+		.srcStageMask = pipelineStage,
+		.dstStageMask = pipelineStage,
+		.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+		.oldLayout = oldLayout,
+		.newLayout = newLayout,
+		.subresourceRange = subresourceRange,
+		.image = image
+	};
 	VkDependencyInfo depInfo = {
 		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
 		.pNext = NULL,
@@ -593,87 +2242,584 @@ EngineResult ChangeImageLayout(VkCommandBuffer cmd, VkImage image, VkImageLayout
 }
 
 typedef struct {
-	VkWriteDescriptorSet writeSet;
+	VkWriteDescriptorSet writeSet; //pBufferInfo and pImageInfo are only filled in when it is written
+	union {
+		VkDescriptorBufferInfo bufferInfo;
+		VkDescriptorImageInfo imageInfo;
+	};
 	size_t frame;
 	size_t updateLeft;
 } writeQueueElement;
 
+//frame_state in raytrace.comp
+typedef struct {
+	uint32_t accumulatedSamples;
+	uint32_t accumulate;
+	uint32_t temporal, historyValid;
+	float temporalWeight;
+	float padding[3];
+	float previousOrigin[4], previousDirection[4];
+} EngineFrameState;
+
+
+//refitting makes the tree slower to walk the further spheres move, past this much of the cost after the last build it gets rebuilt
+#define BVH_REBUILD_COST_RATIO 1.4
+//a frame with more refitted nodes than this fraction of the tree waiting copies all of it
+#define BVH_FULL_UPLOAD_FRACTION 4
+
+void queueBvhNodes(Engine *engine, const uint32_t *nodes, uint32_t count) {
+	for(size_t frame = 0; frame < engine->frameCount; frame++) {
+		if(engine->bvhFullUpload[frame])
+			continue;
+		for(uint32_t i = 0; i < count; i++) {
+			if(engine->bvhNodePending[frame][nodes[i]])
+				continue;
+			engine->bvhNodePending[frame][nodes[i]] = true;
+			engine->bvhPendingNodes[frame][engine->bvhPendingCount[frame]++] = nodes[i];
+		}
+		if(engine->bvhPendingCount[frame] > engine->bvh.nodeCount / BVH_FULL_UPLOAD_FRACTION)
+			engine->bvhFullUpload[frame] = true;
+	}
+}
+
+//refits the tree around the spheres marked dirty, or rebuilds it when that is not enough
+EngineResult updateSphereBvh(Engine *engine) {
+	if(engine->bvh.nodes == NULL)
+		return ENGINE_RESULT_SUCCESS;
+	EngineSphere *spheres = engine->sphereBuffer.data;
+	for(uint32_t i = 0; i < engine->dirtySphereCount; i++) {
+		uint32_t index = engine->dirtySpheres[i];
+		engine->sphereDirty[index] = false;
+		//only a rebuild adds spheres to the tree
+		uint32_t flags = spheres[index].flags;
+		if(engine->bvh.sphereLeaves[index] == ENGINE_BVH_NONE && (flags & ENGINE_EXISTS_FLAG) && (flags & ENGINE_ISACTIVE_FLAG))
+			engine->bvhDirty = true;
+	}
+	if(!engine->bvhDirty && engine->dirtySphereCount > 0) {
+		EngineTraceZone zone = EngineTraceBegin("EngineBvhRefit");
+		uint32_t changedCount = EngineBvhRefit(&engine->bvh, spheres, engine->dirtySpheres, engine->dirtySphereCount, engine->bvhChangedNodes);
+		queueBvhNodes(engine, engine->bvhChangedNodes, changedCount);
+		EngineTraceEnd(zone);
+		if(EngineBvhCost(&engine->bvh) > engine->bvhBuildCost * BVH_REBUILD_COST_RATIO) {
+			debug_msg("Sphere BVH cost went from %f to %f, rebuilding\n", engine->bvhBuildCost, EngineBvhCost(&engine->bvh));
+			engine->bvhDirty = true;
+		}
+	}
+	engine->dirtySphereCount = 0;
+	if(engine->bvhDirty)
+		return EngineBuildSphereBVH(engine);
+	return ENGINE_RESULT_SUCCESS;
+}
+
+//has to be called once the frame has been waited on
+void uploadSphereBvh(Engine *engine, size_t frame) {
+	if(engine->bvh.nodes == NULL)
+		return;
+	EngineBvhNode *nodes = engine->bvhNodeBuffers[frame].data;
+	if(engine->bvhFullUpload[frame]) {
+		memcpy(nodes, engine->bvh.nodes, sizeof(EngineBvhNode) * engine->bvh.nodeCount);
+		memcpy(engine->bvhIndexBuffers[frame].data, engine->bvh.indices, sizeof(uint32_t) * engine->bvh.indexCount);
+		vmaFlushAllocation(engine->allocator, engine->bvhIndexBuffers[frame]._allocation, 0, VK_WHOLE_SIZE);
+	} else if(engine->bvhPendingCount[frame] > 0) {
+		//refits only move bounds, the indices stay the same
+		for(uint32_t i = 0; i < engine->bvhPendingCount[frame]; i++) {
+			uint32_t node = engine->bvhPendingNodes[frame][i];
+			nodes[node] = engine->bvh.nodes[node];
+		}
+	} else {
+		return;
+	}
+	vmaFlushAllocation(engine->allocator, engine->bvhNodeBuffers[frame]._allocation, 0, VK_WHOLE_SIZE);
+	for(uint32_t i = 0; i < engine->bvhPendingCount[frame]; i++) {
+		engine->bvhNodePending[frame][engine->bvhPendingNodes[frame][i]] = false;
+	}
+	engine->bvhPendingCount[frame] = 0;
+	engine->bvhFullUpload[frame] = false;
+}
 
 void updateDescriptorSets(Engine *engine) {
 	if(!engine->writeQueue.count)
 		return;
+	//the arena is sized for a full queue, so none of the allocations below can fail
+	EngineArenaReset(&engine->frameArena);
+	VkWriteDescriptorSet *writeSets = EngineArenaAlloc(&engine->frameArena, sizeof(VkWriteDescriptorSet) * engine->writeQueue.count, _Alignof(VkWriteDescriptorSet));
 	size_t writeSetCount = 0;
-	VkWriteDescriptorSet *writeSets = malloc(sizeof(VkWriteDescriptorSet)*engine->writeQueue.count);
-	bool *shouldFree = malloc(sizeof(bool) * engine->writeQueue.count);
-	debug_msg("queue element info:\n\t===\n\tcur_frame: %d\n", engine->cur_frame);
-	for(size_t i = 0; i < engine->writeQueue.count; i++) {
-		writeQueueElement cur = ((writeQueueElement*)engine->writeQueue.arr)[i];
-		debug_msg("\tbinding: %d\n\ttype: %d\n\tframe: %d\n", cur.writeSet.dstBinding, cur.writeSet.descriptorType, cur.frame);
-		debug_msg("\t===\n");
-	}
-	debug_msg("Descriptor sets:\n");
-	for(size_t i = 0; i < FRAME_OVERLAP; i++) {
-		debug_msg("\t0x%zX\n", engine->descriptorSet[i]);
-	}
-	while(engine->writeQueue.count > 0) {
-		writeQueueElement cur = ENGINE_HEAPARR(engine->writeQueue, writeQueueElement)[0];
+	//every element is looked at once, the ones aimed at other frames go back to the end in the same order
+	size_t queued = engine->writeQueue.count;
+	for(size_t i = 0; i < queued; i++) {
+		writeQueueElement cur;
+		EngineRingQueuePop(&engine->writeQueue, &cur);
 		if(cur.frame != engine->cur_frame) {
-			break;
+			EngineRingQueuePush(&engine->writeQueue, &cur);
+			continue;
 		}
-		EngineHeapArrayDequeue(&engine->writeQueue, &cur);
-		writeSets[writeSetCount] = cur.writeSet;
-		writeSets[writeSetCount].dstSet = engine->descriptorSet[engine->cur_frame];
-		debug_msg("index: %d\n\tbinding: %d\n\tset: 0x%zX\n\ttype: %d\n\tbufferAddress: 0x%zX\n\timageAddress: 0x%zX\n\tupdateLeft: %llu\n", 
-			writeSetCount, 
-			writeSets[writeSetCount].dstBinding, 
-			writeSets[writeSetCount].dstSet,
-			writeSets[writeSetCount].descriptorType,
-			writeSets[writeSetCount].pBufferInfo != NULL ? cur.writeSet.pBufferInfo->buffer : NULL,
-			writeSets[writeSetCount].pImageInfo,
-			cur.updateLeft
-		);
-		if(cur.updateLeft <= 1) {
-			shouldFree[writeSetCount] = true;
-			writeSetCount++;
+		VkWriteDescriptorSet *writeSet = &writeSets[writeSetCount++];
+		*writeSet = cur.writeSet;
+		writeSet->dstSet = engine->descriptorSet[engine->cur_frame];
+		//the element itself moves around the queue, so the write gets a copy of its info
+		if(cur.writeSet.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE) {
+			VkDescriptorImageInfo *imageInfo = EngineArenaAlloc(&engine->frameArena, sizeof(VkDescriptorImageInfo), _Alignof(VkDescriptorImageInfo));
+			*imageInfo = cur.imageInfo;
+			writeSet->pImageInfo = imageInfo;
+		} else {
+			VkDescriptorBufferInfo *bufferInfo = EngineArenaAlloc(&engine->frameArena, sizeof(VkDescriptorBufferInfo), _Alignof(VkDescriptorBufferInfo));
+			*bufferInfo = cur.bufferInfo;
+			writeSet->pBufferInfo = bufferInfo;
+		}
+		if(cur.updateLeft > 1) {
+			cur.updateLeft--;
+			cur.frame = NextFrame(engine, engine->cur_frame);
+			EngineRingQueuePush(&engine->writeQueue, &cur);
+		}
+	}
+	if(writeSetCount == 0)
+		return;
+	vkUpdateDescriptorSets(engine->device, writeSetCount, writeSets, 0, NULL);
+	//a recording that bound the set can't be submitted after it changed
+	engine->frameCommandRecorded[engine->cur_frame] = false;
+}
+
+//the camera, every sphere there can be and the app's share; host visible, since everything in it is rewritten every frame
+EngineResult createUploadRing(Engine *engine) {
+	size_t appBytes = engine->limits.uploadBytesPerFrame > 0 ? engine->limits.uploadBytesPerFrame : 64 * 1024;
+	size_t sphereBytes = engine->limits.maxSphereCount * sizeof(EngineSphere);
+	engine->uploadRingFrameSize = 2 * UPLOAD_RING_ALIGNMENT + sizeof(EngineCamera) + sphereBytes + appBytes;
+	engine->uploadRingFrameSize = (engine->uploadRingFrameSize + UPLOAD_RING_ALIGNMENT - 1) & ~(size_t)(UPLOAD_RING_ALIGNMENT - 1);
+	engine->uploadRing = (EngineBuffer) {
+		.isAccessible = true,
+		.length = engine->uploadRingFrameSize * engine->frameCount,
+		.elementByteSize = 1,
+		.count = 0
+	};
+	EngineResult eRes = EngineCreateBuffer(engine, &engine->uploadRing, ENGINE_BUFFER_STORAGE);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		engine->uploadRingUsed[i] = 0;
+		engine->cameraUpload[i] = engine->sphereUpload[i] = engine->transformationUpload[i] = UPLOAD_RING_NONE;
+		engine->frameSceneAddresses[i] = (EngineSceneAddresses){0};
+	}
+	return ENGINE_RESULT_SUCCESS;
+}
+//offset into the ring, UPLOAD_RING_NONE once the frame's region is full; alignment is a power of two
+//and applies to the offset in the whole ring, since the frames' regions are only UPLOAD_RING_ALIGNMENT aligned
+size_t uploadRingReserve(Engine *engine, size_t frame, size_t byteSize, size_t alignment) {
+	size_t base = frame * engine->uploadRingFrameSize;
+	size_t offset = ((base + engine->uploadRingUsed[frame] + alignment - 1) & ~(alignment - 1)) - base;
+	if(offset > engine->uploadRingFrameSize || byteSize > engine->uploadRingFrameSize - offset)
+		return UPLOAD_RING_NONE;
+	engine->uploadRingUsed[frame] = offset + byteSize;
+	return base + offset;
+}
+//all of the buffer is reserved, so the addresses are the same every time the frame comes around and its recording stays valid
+size_t reserveSceneUpload(Engine *engine, size_t frame, EngineBuffer buffer, uint64_t *address) {
+	//a staged buffer is only written between frames already
+	if(buffer.data == NULL || buffer.isStaged)
+		return UPLOAD_RING_NONE;
+	size_t offset = uploadRingReserve(engine, frame, buffer.length * buffer.elementByteSize, UPLOAD_RING_ALIGNMENT);
+	if(offset == UPLOAD_RING_NONE) {
+		debug_msg("upload ring full, the frame reads the buffer itself\n");
+		return UPLOAD_RING_NONE;
+	}
+	*address = engine->uploadRing.deviceAddress + offset;
+	return offset;
+}
+//the frame was waited for, so its whole region is free again
+void reserveSceneUploads(Engine *engine, size_t frame) {
+	engine->uploadRingUsed[frame] = 0;
+	engine->cameraUpload[frame] = engine->sphereUpload[frame] = engine->transformationUpload[frame] = UPLOAD_RING_NONE;
+	EngineSceneAddresses addresses = engine->sceneAddresses;
+	if(!engine->sceneAddressesSet) {
+		engine->cameraUpload[frame] = reserveSceneUpload(engine, frame, engine->cameraBuffer, &addresses.camera);
+		engine->sphereUpload[frame] = reserveSceneUpload(engine, frame, engine->sphereBuffer, &addresses.spheres);
+		engine->transformationUpload[frame] = reserveSceneUpload(engine, frame, engine->transformationBuffer, &addresses.transformations);
+	}
+	if(memcmp(&engine->frameSceneAddresses[frame], &addresses, sizeof(EngineSceneAddresses)) != 0) {
+		engine->frameSceneAddresses[frame] = addresses;
+		engine->frameCommandRecorded[frame] = false;
+	}
+}
+void copySceneUpload(Engine *engine, size_t offset, EngineBuffer buffer, size_t count) {
+	if(offset != UPLOAD_RING_NONE)
+		memcpy((char*)engine->uploadRing.data + offset, buffer.data, count * buffer.elementByteSize);
+}
+//what the app wrote up to the frame's first submission is what the frame draws
+void copySceneUploads(Engine *engine, size_t frame) {
+	copySceneUpload(engine, engine->cameraUpload[frame], engine->cameraBuffer, engine->cameraBuffer.length);
+	copySceneUpload(engine, engine->sphereUpload[frame], engine->sphereBuffer, engine->sphereBuffer.count);
+	copySceneUpload(engine, engine->transformationUpload[frame], engine->transformationBuffer, engine->transformationBuffer.length);
+	if(engine->uploadRingUsed[frame] > 0)
+		vmaFlushAllocation(engine->allocator, engine->uploadRing._allocation, frame * engine->uploadRingFrameSize, engine->uploadRingUsed[frame]);
+}
+EngineResult EngineUploadAlloc(Engine *engine, size_t byteSize, size_t alignment, void **data, uint64_t *deviceAddress) {
+	//the offset is rounded up with a mask
+	ERR_CHECK((alignment & (alignment - 1)) == 0, ENGINE_INVALID_ARGUMENT, VK_SUCCESS);
+	size_t offset = uploadRingReserve(engine, engine->cur_frame, byteSize, alignment > 0 ? alignment : 1);
+	ERR_CHECK(offset != UPLOAD_RING_NONE, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	*data = (char*)engine->uploadRing.data + offset;
+	*deviceAddress = engine->uploadRing.deviceAddress + offset;
+	return ENGINE_RESULT_SUCCESS;
+}
+
+EngineResult createStaging(Engine *engine) {
+	VkCommandBufferAllocateInfo allocateInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandBufferCount = engine->frameCount,
+		.commandPool = engine->transfer.pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.pNext = NULL
+	};
+	res = vkAllocateCommandBuffers(engine->device, &allocateInfo, engine->stagingCmd);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_QUEUECOMMAND_ALLOCATION_FAILED, res);
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		engine->stagingBuffers[i] = (EngineBuffer){0};
+	}
+	return ENGINE_RESULT_SUCCESS;
+}
+//the whole buffer starts out dirty, so the device copy begins as zeroes like the host one
+EngineResult registerStagedBuffer(Engine *engine, EngineBuffer *buffer) {
+	if(engine->stagedBufferCount == engine->stagedBufferCapacity) {
+		size_t capacity = engine->stagedBufferCapacity > 0 ? engine->stagedBufferCapacity * 2 : 8;
+		stagedBuffer *stagedBuffers = realloc(engine->stagedBuffers, sizeof(stagedBuffer) * capacity);
+		ERR_CHECK(stagedBuffers != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+		engine->stagedBuffers = stagedBuffers;
+		engine->stagedBufferCapacity = capacity;
+	}
+	size_t byteSize = buffer->length * buffer->elementByteSize;
+	stagedBuffer *staged = &engine->stagedBuffers[engine->stagedBufferCount];
+	staged->buffer = (VkBuffer)buffer->_buffer;
+	staged->byteSize = byteSize;
+	staged->shadow = calloc(byteSize > 0 ? byteSize : 1, 1);
+	ERR_CHECK(staged->shadow != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	staged->rangeCount = byteSize > 0 ? 1 : 0;
+	staged->ranges[0] = (stagedRange){0, byteSize};
+	engine->stagedBufferCount++;
+	buffer->data = staged->shadow;
+	buffer->isAccessible = false;
+	return ENGINE_RESULT_SUCCESS;
+}
+stagedBuffer *findStagedBuffer(Engine *engine, EngineBuffer buffer) {
+	for(size_t i = 0; i < engine->stagedBufferCount; i++) {
+		if(engine->stagedBuffers[i].buffer == (VkBuffer)buffer._buffer)
+			return &engine->stagedBuffers[i];
+	}
+	return NULL;
+}
+void unregisterStagedBuffer(Engine *engine, EngineBuffer buffer) {
+	stagedBuffer *staged = findStagedBuffer(engine, buffer);
+	if(staged == NULL)
+		return;
+	free(staged->shadow);
+	*staged = engine->stagedBuffers[--engine->stagedBufferCount];
+}
+void EngineBufferMarkDirty(Engine *engine, EngineBuffer buffer, size_t byteOffset, size_t byteSize) {
+	stagedBuffer *staged = buffer.isStaged ? findStagedBuffer(engine, buffer) : NULL;
+	if(staged == NULL || byteOffset >= staged->byteSize)
+		return;
+	size_t begin = byteOffset;
+	size_t end = byteSize > staged->byteSize - byteOffset ? staged->byteSize : byteOffset + byteSize;
+	//whatever overlaps or touches the new range is folded into it
+	for(size_t i = 0; i < staged->rangeCount;) {
+		stagedRange range = staged->ranges[i];
+		if(range.begin <= end && begin <= range.end) {
+			begin = range.begin < begin ? range.begin : begin;
+			end = range.end > end ? range.end : end;
+			staged->ranges[i] = staged->ranges[--staged->rangeCount];
+		} else {
+			i++;
+		}
+	}
+	if(staged->rangeCount == STAGED_MAX_RANGES) {
+		for(size_t i = 0; i < staged->rangeCount; i++) {
+			begin = staged->ranges[i].begin < begin ? staged->ranges[i].begin : begin;
+			end = staged->ranges[i].end > end ? staged->ranges[i].end : end;
+		}
+		staged->rangeCount = 0;
+	}
+	staged->ranges[staged->rangeCount++] = (stagedRange){begin, end};
+}
+//the frame has been waited on, so its old staging buffer can go right away
+EngineResult reserveStaging(Engine *engine, size_t frame, size_t byteSize) {
+	EngineBuffer *staging = &engine->stagingBuffers[frame];
+	if(staging->length >= byteSize)
+		return ENGINE_RESULT_SUCCESS;
+	size_t length = staging->length > 0 ? staging->length : STAGING_MIN_SIZE;
+	while(length < byteSize) {
+		length *= 2;
+	}
+	if(staging->_buffer)
+		vmaDestroyBuffer(engine->allocator, (VkBuffer)staging->_buffer, (VmaAllocation)staging->_allocation);
+	*staging = (EngineBuffer){0};
+	VkBufferCreateInfo buffCI = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = NULL,
+		.pQueueFamilyIndices = &engine->transfer.index,
+		.queueFamilyIndexCount = 1,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.size = length,
+		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+	};
+	VmaAllocationCreateInfo allocCI = {
+		.usage = VMA_MEMORY_USAGE_AUTO,
+		.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+	};
+	VmaAllocationInfo allocInfo;
+	res = vmaCreateBuffer(engine->allocator, &buffCI, &allocCI, (VkBuffer*)&staging->_buffer, (VmaAllocation*)&staging->_allocation, &allocInfo);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_BUFFER_CREATION_FAILED, res);
+	staging->length = length;
+	staging->elementByteSize = 1;
+	staging->data = allocInfo.pMappedData;
+	return ENGINE_RESULT_SUCCESS;
+}
+//goes to the transfer queue ahead of the frame's first submission, which waits for it on the timeline like for any earlier one;
+//markSharedWrite makes the copy itself wait for every frame in flight, so nothing still reads the bytes being overwritten
+EngineResult submitStagedUploads(Engine *engine) {
+	size_t frame = engine->cur_frame;
+	size_t byteSize = 0;
+	for(size_t i = 0; i < engine->stagedBufferCount; i++) {
+		for(size_t j = 0; j < engine->stagedBuffers[i].rangeCount; j++) {
+			byteSize += engine->stagedBuffers[i].ranges[j].end - engine->stagedBuffers[i].ranges[j].begin;
+		}
+	}
+	if(byteSize == 0)
+		return ENGINE_RESULT_SUCCESS;
+	EngineResult eRes = reserveStaging(engine, frame, byteSize);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+
+	VkCommandBuffer cmd = engine->stagingCmd[frame];
+	VkCommandBufferBeginInfo beginInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = NULL,
+		.pNext = NULL
+	};
+	vkResetCommandBuffer(cmd, 0);
+	res = vkBeginCommandBuffer(cmd, &beginInfo);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_START_COMMAND, res);
+	EngineTraceZone zone = EngineTraceBegin("staged uploads");
+	EngineBuffer *staging = &engine->stagingBuffers[frame];
+	size_t offset = 0;
+	for(size_t i = 0; i < engine->stagedBufferCount; i++) {
+		stagedBuffer *staged = &engine->stagedBuffers[i];
+		if(staged->rangeCount == 0)
 			continue;
+		VkBufferCopy regions[STAGED_MAX_RANGES];
+		for(size_t j = 0; j < staged->rangeCount; j++) {
+			size_t size = staged->ranges[j].end - staged->ranges[j].begin;
+			memcpy((char*)staging->data + offset, (char*)staged->shadow + staged->ranges[j].begin, size);
+			regions[j] = (VkBufferCopy) {
+				.srcOffset = offset,
+				.dstOffset = staged->ranges[j].begin,
+				.size = size
+			};
+			offset += size;
 		}
-		shouldFree[writeSetCount] = false;
-		writeSetCount++;
-		cur.updateLeft--;
-		cur.frame = NextFrame(engine->cur_frame);
-		EngineHeapArrayEnqueue(&engine->writeQueue, &cur);
+		vkCmdCopyBuffer(cmd, (VkBuffer)staging->_buffer, staged->buffer, staged->rangeCount, regions);
+		staged->rangeCount = 0;
+	}
+	vmaFlushAllocation(engine->allocator, (VmaAllocation)staging->_allocation, 0, offset);
+	EngineTraceEnd(zone);
+	res = vkEndCommandBuffer(cmd);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_PREPARE_FOR_SUBMISSION, res);
+
+	VkCommandBufferSubmitInfo cmdSubmitInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+		.commandBuffer = cmd,
+		.deviceMask = 0,
+		.pNext = NULL
+	};
+	VkSemaphoreSubmitInfo waitInfo[ENGINE_MAX_FRAMES_IN_FLIGHT], signalInfo;
+	//the copies overwrite what any frame in flight may still read
+	markSharedWrite(engine);
+	uint32_t waitCount = 0;
+	chainSubmission(engine, VK_PIPELINE_STAGE_2_COPY_BIT, waitInfo, &waitCount, &signalInfo);
+	VkSubmitInfo2 queueSubmitInfo = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+		.commandBufferInfoCount = 1,
+		.pCommandBufferInfos = &cmdSubmitInfo,
+		.signalSemaphoreInfoCount = 1,
+		.pSignalSemaphoreInfos = &signalInfo,
+		.waitSemaphoreInfoCount = waitCount,
+		.pWaitSemaphoreInfos = waitInfo,
+		.flags = 0
+	};
+	zone = EngineTraceBegin("submit uploads");
+	res = vkQueueSubmit2(engine->transfer.queue, 1, &queueSubmitInfo, NULL);
+	EngineTraceEnd(zone);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_SUBMIT_TO_GPU, res);
+	return ENGINE_RESULT_SUCCESS;
+}
+
+void writeFrameState(Engine *engine) {
+	size_t frame = engine->cur_frame;
+	if(engine->frameStateWritten[frame])
+		return;
+	engine->frameStateWritten[frame] = true;
+	copySceneUploads(engine, frame);
+	EngineCamera *camera = engine->cameraBuffer.data;
+	EngineFrameState *state = engine->frameStateBuffers[frame].data;
+	//the camera the previous frame was drawn with is still in accumulationCamera
+	memcpy(state->previousOrigin, engine->accumulationCamera.origin, sizeof(engine->accumulationCamera.origin));
+	memcpy(state->previousDirection, engine->accumulationCamera.direction, sizeof(engine->accumulationCamera.direction));
+	if(camera != NULL && memcmp(camera, &engine->accumulationCamera, sizeof(EngineCamera))) {
+		engine->accumulationCamera = *camera;
+		engine->accumulationReset = true;
+	}
+	state->temporal = engine->temporalEnabled;
+	state->historyValid = engine->temporalEnabled && engine->historyFrames > 0;
+	state->temporalWeight = engine->temporalWeight;
+	engine->historyFrames = engine->temporalEnabled ? engine->historyFrames + 1 : 0;
+	if(engine->accumulationReset || !engine->accumulationEnabled) {
+		engine->accumulatedSamples = 0;
+		engine->accumulationReset = false;
+	}
+	state->accumulatedSamples = engine->accumulatedSamples;
+	state->accumulate = engine->accumulationEnabled;
+	vmaFlushAllocation(engine->allocator, engine->frameStateBuffers[frame]._allocation, 0, VK_WHOLE_SIZE);
+	if(engine->accumulationEnabled && engine->accumulatedSamples < UINT32_MAX)
+		engine->accumulatedSamples++;
+}
+
+bool createBindlessSlots(BindlessSlots *slots, uint32_t capacity) {
+	slots->capacity = capacity;
+	slots->used = 0;
+	slots->freeCount = 0;
+	slots->freeSlots = malloc(sizeof(uint32_t) * capacity);
+	return slots->freeSlots != NULL && EngineCreateRingQueue(&slots->retired, capacity, sizeof(bindlessRetiredSlot));
+}
+void destroyBindlessSlots(BindlessSlots *slots) {
+	free(slots->freeSlots);
+	EngineDestroyRingQueue(&slots->retired);
+}
+//freed slots are reused first, so the arrays stay as dense as the shader's accesses allow
+bool acquireBindlessSlot(BindlessSlots *slots, uint32_t *index) {
+	if(slots->freeCount > 0) {
+		*index = slots->freeSlots[--slots->freeCount];
+		return true;
+	}
+	if(slots->used == slots->capacity)
+		return false;
+	*index = slots->used++;
+	return true;
+}
+//EngineFrameFinished covers the frames before as well, so only the front of the queue has to be checked
+void reclaimBindlessSlots(Engine *engine, BindlessSlots *slots) {
+	bindlessRetiredSlot retired;
+	while(slots->retired.count > 0) {
+		retired = ((bindlessRetiredSlot*)slots->retired.arr)[slots->retired.head];
+		if(!EngineFrameFinished(engine, retired.frameIndex))
+			break;
+		EngineRingQueuePop(&slots->retired, &retired);
+		slots->freeSlots[slots->freeCount++] = retired.slot;
+	}
+}
+
+//host side of starting a frame: waits until the GPU is done with it, then updates everything it is going to read
+EngineResult prepareFrame(Engine *engine) {
+	//no timeout, software drivers like lavapipe take seconds for a heavy frame
+	EngineTraceZone zone = EngineTraceBegin("vkWaitSemaphores");
+	res = waitTimeline(engine, engine->cur_frame, engine->frameDoneValue[engine->cur_frame], UINT64_MAX);
+	EngineTraceEnd(zone);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_FENCE_NOT_WORKING, res);
+	collectFrameTimings(engine, engine->cur_frame);
+	reclaimBindlessSlots(engine, &engine->bindlessBuffers);
+	reclaimBindlessSlots(engine, &engine->bindlessTextures);
+	reserveSceneUploads(engine, engine->cur_frame);
+	destroyRetiredObjects(engine);
+	EngineResult eRes = updatePipelines(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	eRes = advanceWorkgroupTuning(engine, engine->cur_frame);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	eRes = updateSphereBvh(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	uploadSphereBvh(engine, engine->cur_frame);
+	//a single frame in flight swaps its two history slots itself, only worth a re-recording while something reads them
+	if(engine->historySlotCount > engine->frameCount && engine->temporalEnabled) {
+		writeHistoryPair(engine, engine->cur_frame, engine->frameIndex % engine->historySlotCount);
+		engine->frameCommandRecorded[engine->cur_frame] = false;
+	}
+	if(engine->headless) {
+		deliverHeadlessFrame(engine, engine->cur_frame);
+	} else {
+		zone = EngineTraceBegin("vkAcquireNextImageKHR");
+		vkAcquireNextImageKHR(engine->device, engine->swapchain, 1000000000, engine->swapchainSemaphores[engine->cur_frame], NULL, &engine->cur_swapchainIndex);
+		EngineTraceEnd(zone);
+	}
+
+	zone = EngineTraceBegin("updateDescriptorSets");
+	updateDescriptorSets(engine);
+	EngineTraceEnd(zone);
+	return ENGINE_RESULT_SUCCESS;
+}
+//the frame's own set and the bindless one
+void bindDescriptorSets(Engine *engine, VkCommandBuffer cmd) {
+	VkDescriptorSet sets[] = {engine->descriptorSet[engine->cur_frame], engine->bindlessSet};
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, engine->pipelineLayout, 0, ARR_SIZE(sets), sets, 0, NULL);
+}
+//the first commands of every frame: query resets, the clear and the layouts of the images the shader writes
+void recordFrameStart(Engine *engine, VkCommandBuffer cmd, EngineColor background, bool clear) {
+	VkImageSubresourceRange backgroundSubresourceRange = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = 1,
+		.baseArrayLayer = 0,
+		.layerCount = 1
+	};
+
+	//this is the first submission of the frame, so the query pools get reset here when the host can't do it
+	if(!engine->hostQueryReset && engine->timestampsSupported)
+		vkCmdResetQueryPool(cmd, engine->timestampPools[engine->cur_frame], 0, TIMESTAMP_QUERY_COUNT);
+	if(!engine->hostQueryReset && engine->pipelineStatisticsSupported)
+		vkCmdResetQueryPool(cmd, engine->statisticsPools[engine->cur_frame], 0, MAX_TIMED_DISPATCHES);
+	engine->timedDispatchCount[engine->cur_frame] = 0;
+	engine->queriesPending[engine->cur_frame] = engine->timestampsSupported || engine->pipelineStatisticsSupported;
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, engine->timestampPools[engine->cur_frame], TIMESTAMP_CLEAR_START);
+	
+	//without the clear the image keeps whatever the frame showed last time, once it has a layout
+	VkImageMemoryBarrier2 renderBarrier = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+		.pNext = NULL,
+		.srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+		.srcAccessMask = VK_ACCESS_2_NONE,
+		.dstStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		.oldLayout = clear || !engine->storageImagesReady ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_GENERAL,
+		.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = engine->renderImages[engine->cur_frame].image,
+		.subresourceRange = backgroundSubresourceRange
+	};
+	VkDependencyInfo renderDependency = {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = NULL,
+		.imageMemoryBarrierCount = 1,
+		.pImageMemoryBarriers = &renderBarrier
+	};
+	vkCmdPipelineBarrier2(cmd, &renderDependency);
+	if(clear) {
+		VkClearColorValue backgroundColor = {
+			.float32 = {background[0], background[1], background[2], background[3]}
+		};
+		vkCmdClearColorImage(cmd, engine->renderImages[engine->cur_frame].image, VK_IMAGE_LAYOUT_GENERAL, &backgroundColor, 1, &backgroundSubresourceRange);
 	}
-	debug_msg("writeSetCount = %llu\n", writeSetCount);
-	vkUpdateDescriptorSets(engine->device, writeSetCount, writeSets, 0, NULL);
-	for(size_t i = 0; i < writeSetCount; i++) {
-		if(!shouldFree[i]) {
-			continue;
-		}
-		switch(writeSets[i].descriptorType) {
-			case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
-			case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
-				free(writeSets[i].pBufferInfo);
-				break;
-			case ENGINE_IMAGE:
-				free(writeSets[i].pImageInfo);
-				break;
+	//the images the shader keeps between frames only need their layout once, their contents are only read once written
+	if(!engine->storageImagesReady) {
+		ChangeImageLayout(cmd, engine->accumulationImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+		for(size_t i = 0; i < engine->historySlotCount; i++) {
+			ChangeImageLayout(cmd, engine->gbufferImages[i].image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+			ChangeImageLayout(cmd, engine->historyImages[i].image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
 		}
+		engine->storageImagesReady = true;
+		markSharedWrite(engine);
 	}
-	free(writeSets);
-	free(shouldFree);
-	debug_msg("update ended\n");
-};
-
-EngineResult EngineDrawStart(Engine *engine, EngineColor background, EngineSemaphore *signalSemaphore) {
-	res = vkWaitForFences(engine->device, 1, &engine->frameFence, true, 1000000000);
-	ERR_CHECK(res == VK_SUCCESS, ENGINE_FENCE_NOT_WORKING, res);
-	EngineResult eRes = {0};
-	vkAcquireNextImageKHR(engine->device, engine->swapchain, 1000000000, engine->swapchainSemaphores[engine->cur_frame], NULL, &engine->cur_swapchainIndex);
-
-	updateDescriptorSets(engine);
-
-	res = vkResetFences(engine->device, 1, &engine->frameFence[engine->cur_frame]);
-	ERR_CHECK(res == VK_SUCCESS, ENGINE_FENCE_NOT_WORKING, res);	
+	engine->frameStateWritten[engine->cur_frame] = false;
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, engine->timestampPools[engine->cur_frame], TIMESTAMP_CLEAR_END);
+}
+EngineResult EngineDrawStart(Engine *engine, EngineColor background) {
+	EngineResult eRes = prepareFrame(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
 
 	VkCommandBufferBeginInfo beginInfo = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -681,27 +2827,9 @@ EngineResult EngineDrawStart(Engine *engine, EngineColor background, EngineSemap
 		.pInheritanceInfo = NULL,
 		.pNext = NULL
 	};
-
-	VkImageSubresourceRange backgroundSubresourceRange = {
-		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-		.baseMipLevel = 0,
-		.levelCount = 1,
-		.baseArrayLayer = 0,
-		.layerCount = 1
-	};
-	
 	vkResetCommandBuffer(engine->backgroundBufferCmd[engine->cur_frame], 0);
 	vkBeginCommandBuffer(engine->backgroundBufferCmd[engine->cur_frame], &beginInfo);
-	
-	VkClearColorValue backgroundColor = {
-		.float32 = {background[0], background[1], background[2], background[3]}
-	};
-	ChangeImageLayout(engine->backgroundBufferCmd[engine->cur_frame], 
-				engine->renderImages[engine->cur_frame].image, 
-				VK_IMAGE_LAYOUT_UNDEFINED, 
-				VK_IMAGE_LAYOUT_GENERAL,
-				VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT);
-	vkCmdClearColorImage(engine->backgroundBufferCmd[engine->cur_frame], engine->renderImages[engine->cur_frame].image, VK_IMAGE_LAYOUT_GENERAL, &backgroundColor, 1, &backgroundSubresourceRange);
+	recordFrameStart(engine, engine->backgroundBufferCmd[engine->cur_frame], background, true);
 	res = vkEndCommandBuffer(engine->backgroundBufferCmd[engine->cur_frame]);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_PREPARE_FOR_SUBMISSION, res);
 
@@ -712,13 +2840,9 @@ EngineResult EngineDrawStart(Engine *engine, EngineColor background, EngineSemap
 		.pNext = NULL
 	};
 
-	VkSemaphoreSubmitInfo signalInfo = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-		.deviceIndex = 0,
-		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-		.semaphore = engine->frameReadySemaphores[engine->cur_frame]
-	};
-	*signalSemaphore = engine->frameReadySemaphores[engine->cur_frame];
+	VkSemaphoreSubmitInfo waitInfo[ENGINE_MAX_FRAMES_IN_FLIGHT], signalInfo;
+	uint32_t waitCount = 0;
+	chainSubmission(engine, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, waitInfo, &waitCount, &signalInfo);
 
 	VkSubmitInfo2 queueSubmitInfo = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
@@ -726,16 +2850,137 @@ EngineResult EngineDrawStart(Engine *engine, EngineColor background, EngineSemap
 		.pCommandBufferInfos = &cmdSubmitInfo,
 		.signalSemaphoreInfoCount = 1,
 		.pSignalSemaphoreInfos = &signalInfo,
-		.waitSemaphoreInfoCount = 0,
-		.pWaitSemaphoreInfos = NULL,
+		.waitSemaphoreInfoCount = waitCount,
+		.pWaitSemaphoreInfos = waitInfo,
 		.flags = 0
 	};
 
+	EngineTraceZone zone = EngineTraceBegin("submit clear");
 	res = vkQueueSubmit2(engine->graphics.queue, 1, &queueSubmitInfo, NULL);
+	EngineTraceEnd(zone);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_SUBMIT_TO_GPU, res);
+	return ENGINE_RESULT_SUCCESS;
+}
+//blits the render image into the headless image and copies that into the readback buffer
+void recordHeadlessCopy(Engine *engine, VkCommandBuffer cmd) {
+	AllocatedImage *renderImage = &engine->renderImages[engine->cur_frame];
+	AllocatedImage *headlessImage = &engine->headlessImages[engine->cur_frame];
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, engine->timestampPools[engine->cur_frame], TIMESTAMP_BLIT_START);
+	ChangeImageLayout(cmd, renderImage->image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+	ChangeImageLayout(cmd, headlessImage->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+	//blitting rather than copying so the readback gets the exact same conversion a swapchain image would
+	ImageCopy(cmd, renderImage->image, headlessImage->image, (VkExtent2D){
+		.height = renderImage->imageExtent.height,
+		.width = renderImage->imageExtent.width
+	}, (VkExtent2D){
+		.height = headlessImage->imageExtent.height,
+		.width = headlessImage->imageExtent.width
+	});
+	ChangeImageLayout(cmd, headlessImage->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+	VkBufferImageCopy copyRegion = {
+		.bufferOffset = 0,
+		.bufferRowLength = 0,
+		.bufferImageHeight = 0,
+		.imageSubresource = (VkImageSubresourceLayers) {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+			.mipLevel = 0
+		},
+		.imageOffset = {0, 0, 0},
+		.imageExtent = headlessImage->imageExtent
+	};
+	vkCmdCopyImageToBuffer(cmd, headlessImage->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, engine->readback[engine->cur_frame].buffer, 1, &copyRegion);
+	VkMemoryBarrier2 hostBarrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.pNext = NULL,
+		.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+		.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT
+	};
+	VkDependencyInfo hostDependency = {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = NULL,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &hostBarrier
+	};
+	vkCmdPipelineBarrier2(cmd, &hostDependency);
+	ChangeImageLayout(cmd, renderImage->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, engine->timestampPools[engine->cur_frame], TIMESTAMP_BLIT_END);
+}
+//what is left once the last submission of a headless frame went out
+void finishHeadlessFrame(Engine *engine) {
+	engine->readback[engine->cur_frame].pending = true;
+	engine->readback[engine->cur_frame].frameIndex = engine->frameIndex;
+	engine->queryFrameIndex[engine->cur_frame] = engine->frameIndex++;
+	updateCurrentFrame_(engine);
+}
+EngineResult drawEndHeadless(Engine *engine) {
+	VkCommandBuffer cmd = engine->copyBufferCmd[engine->cur_frame];
+	VkCommandBufferBeginInfo cmdBeginInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pNext = NULL,
+		.pInheritanceInfo = NULL
+	};
+	vkResetCommandBuffer(cmd, 0);
+	vkBeginCommandBuffer(cmd, &cmdBeginInfo);
+	recordHeadlessCopy(engine, cmd);
+	res = vkEndCommandBuffer(cmd);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_PREPARE_FOR_SUBMISSION, res);
+
+	VkCommandBufferSubmitInfo cmdSubmitInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+		.commandBuffer = cmd,
+		.deviceMask = 0,
+		.pNext = NULL
+	};
+	VkSemaphoreSubmitInfo waitInfo[ENGINE_MAX_FRAMES_IN_FLIGHT], signalInfo;
+	uint32_t waitCount = 0;
+	chainSubmission(engine, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, waitInfo, &waitCount, &signalInfo);
+	VkSubmitInfo2 queueSubmitInfo = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+		.commandBufferInfoCount = 1,
+		.pCommandBufferInfos = &cmdSubmitInfo,
+		.signalSemaphoreInfoCount = 1,
+		.pSignalSemaphoreInfos = &signalInfo,
+		.waitSemaphoreInfoCount = waitCount,
+		.pWaitSemaphoreInfos = waitInfo,
+		.flags = 0
+	};
+	EngineTraceZone zone = EngineTraceBegin("submit blit");
+	res = vkQueueSubmit2(engine->graphics.queue, 1, &queueSubmitInfo, VK_NULL_HANDLE);
+	EngineTraceEnd(zone);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_SUBMIT_TO_GPU, res);
+	finishHeadlessFrame(engine);
+	return ENGINE_RESULT_SUCCESS;
+}
+//presents the frame once its blit signalled bufferCopySemaphores
+EngineResult presentFrame(Engine *engine) {
+	VkPresentInfoKHR presentInfo = {
+		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+		.pNext = NULL,
+		.swapchainCount = 1,
+		.pSwapchains = &engine->swapchain,
+		.waitSemaphoreCount = 1,
+		.pWaitSemaphores = &engine->bufferCopySemaphores[engine->cur_frame],
+		.pImageIndices = &engine->cur_swapchainIndex,
+	};
+	engine->queryFrameIndex[engine->cur_frame] = engine->frameIndex++;
+	EngineTraceZone zone = EngineTraceBegin("vkQueuePresentKHR");
+	res = vkQueuePresentKHR(engine->graphics.queue, &presentInfo);
+	EngineTraceEnd(zone);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_DISPLAY, res);	
+	updateCurrentFrame_(engine);
 	return ENGINE_RESULT_SUCCESS;
 }
-EngineResult EngineDrawEnd(Engine *engine, EngineSemaphore *waitSemaphore) {
+EngineResult EngineDrawEnd(Engine *engine) {
+	if(engine->headless) {
+		return drawEndHeadless(engine);
+	}
 	VkCommandBufferBeginInfo cmdBeginInfo = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
 		.flags = 0,
@@ -744,6 +2989,8 @@ EngineResult EngineDrawEnd(Engine *engine, EngineSemaphore *waitSemaphore) {
 	};
 
 	vkBeginCommandBuffer(engine->copyBufferCmd[engine->cur_frame], &cmdBeginInfo);
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(engine->copyBufferCmd[engine->cur_frame], VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, engine->timestampPools[engine->cur_frame], TIMESTAMP_BLIT_START);
 	ChangeImageLayout(engine->copyBufferCmd[engine->cur_frame], engine->renderImages[engine->cur_frame].image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT);
 	ChangeImageLayout(engine->copyBufferCmd[engine->cur_frame], engine->swapchainImages[engine->cur_swapchainIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT);
 	ImageCopy(engine->copyBufferCmd[engine->cur_frame], engine->renderImages[engine->cur_frame].image, engine->swapchainImages[engine->cur_swapchainIndex], (VkExtent2D){
@@ -752,6 +2999,8 @@ EngineResult EngineDrawEnd(Engine *engine, EngineSemaphore *waitSemaphore) {
 	}, engine->pixelResolution);
 	ChangeImageLayout(engine->copyBufferCmd[engine->cur_frame], engine->swapchainImages[engine->cur_swapchainIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT);
 	ChangeImageLayout(engine->copyBufferCmd[engine->cur_frame], engine->renderImages[engine->cur_frame].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT);
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(engine->copyBufferCmd[engine->cur_frame], VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, engine->timestampPools[engine->cur_frame], TIMESTAMP_BLIT_END);
 	vkEndCommandBuffer(engine->copyBufferCmd[engine->cur_frame]);
 	VkCommandBufferSubmitInfo cmdSubmitInfo = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
@@ -759,63 +3008,295 @@ EngineResult EngineDrawEnd(Engine *engine, EngineSemaphore *waitSemaphore) {
 		.deviceMask = 0,
 		.pNext = NULL
 	};
-	VkSemaphoreSubmitInfo waitSemaphoreInfo[2] = {
+	VkSemaphoreSubmitInfo waitSemaphoreInfo[ENGINE_MAX_FRAMES_IN_FLIGHT + 1] = {
 		{
 			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
 			.deviceIndex = 0,
 			.pNext = NULL,
-			.stageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
+			.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
 			.semaphore = engine->swapchainSemaphores[engine->cur_frame]
-		}, 
+		}
+	}, 					
+	signalSemaphoreInfo[2] = {
 		{
 			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
 			.deviceIndex = 0,
 			.pNext = NULL,
-			.stageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
-			.semaphore = *waitSemaphore
+			.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+			.semaphore = engine->bufferCopySemaphores[engine->cur_frame]
 		}
-	}, 					
-	signalSemaphoreInfo = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-		.deviceIndex = 0,
-		.pNext = NULL,
-		.stageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
-		.semaphore = engine->bufferCopySemaphores[engine->cur_frame]
 	};
+	uint32_t waitCount = 1;
+	chainSubmission(engine, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, waitSemaphoreInfo, &waitCount, &signalSemaphoreInfo[1]);
 
 	VkSubmitInfo2 queueSubmitInfo = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
 		.commandBufferInfoCount = 1,
 		.pCommandBufferInfos = &cmdSubmitInfo,
-		.signalSemaphoreInfoCount = 1,
-		.pSignalSemaphoreInfos = &signalSemaphoreInfo,
-		.waitSemaphoreInfoCount = 2,
+		.signalSemaphoreInfoCount = 2,
+		.pSignalSemaphoreInfos = signalSemaphoreInfo,
+		.waitSemaphoreInfoCount = waitCount,
 		.pWaitSemaphoreInfos = waitSemaphoreInfo,
 		.flags = 0
 	};
-	res = vkQueueSubmit2(engine->graphics.queue, 1, &queueSubmitInfo, engine->frameFence[engine->cur_frame]);
+	EngineTraceZone zone = EngineTraceBegin("submit blit");
+	res = vkQueueSubmit2(engine->graphics.queue, 1, &queueSubmitInfo, VK_NULL_HANDLE);
+	EngineTraceEnd(zone);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_SUBMIT_TO_GPU, res);
-	VkPresentInfoKHR presentInfo = {
-		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+	return presentFrame(engine);
+}
+
+bool EngineSingleSubmitSupported(Engine *engine) {
+	return engine->graphics.index == engine->compute.index;
+}
+EngineResult EngineFrameBegin(Engine *engine, EngineFrameInfo info, EngineCommand *cmdOut) {
+	//the buffers are exclusive to the compute family, so the graphics queue can only use them when it is the same one
+	ERR_CHECK(EngineSingleSubmitSupported(engine), ENGINE_UNSUPPORTED_BY_DEVICE, VK_SUCCESS);
+	EngineResult eRes = prepareFrame(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+
+	//backgroundBufferCmd holds the whole frame here
+	VkCommandBuffer cmd = engine->backgroundBufferCmd[engine->cur_frame];
+	VkCommandBufferBeginInfo beginInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = NULL,
+		.pNext = NULL
+	};
+	vkResetCommandBuffer(cmd, 0);
+	res = vkBeginCommandBuffer(cmd, &beginInfo);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_START_COMMAND, res);
+	recordFrameStart(engine, cmd, info.background, info.clear);
+
+	//the dispatches wait for the clear; the other frames are waited for by the timeline when they share something
+	VkImageMemoryBarrier2 clearBarrier = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
 		.pNext = NULL,
-		.swapchainCount = 1,
-		.pSwapchains = &engine->swapchain,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = &engine->bufferCopySemaphores[engine->cur_frame],
-		.pImageIndices = &engine->cur_swapchainIndex,
+		.srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = engine->renderImages[engine->cur_frame].image,
+		.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
 	};
-	res = vkQueuePresentKHR(engine->graphics.queue, &presentInfo);
-	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_DISPLAY, res);	
-	updateCurrentFrame_(engine);
+	VkDependencyInfo dependency = {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = NULL,
+		.imageMemoryBarrierCount = 1,
+		.pImageMemoryBarriers = &clearBarrier
+	};
+	if(info.clear)
+		vkCmdPipelineBarrier2(cmd, &dependency);
+	bindDescriptorSets(engine, cmd);
+	*cmdOut = (EngineCommand)cmd;
 	return ENGINE_RESULT_SUCCESS;
 }
+//the dispatches' writes to the render image are made visible to the blit, and the swapchain image waits for the acquire semaphore's stage
+void recordPresentBlit(Engine *engine, VkCommandBuffer cmd) {
+	VkImageMemoryBarrier2 blitBarriers[2] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+			.pNext = NULL,
+			.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+			.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = engine->renderImages[engine->cur_frame].image,
+			.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+			.pNext = NULL,
+			.srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+			.srcAccessMask = VK_ACCESS_2_NONE,
+			.dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+			.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = engine->swapchainImages[engine->cur_swapchainIndex],
+			.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+		}
+	};
+	VkDependencyInfo blitDependency = {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = NULL,
+		.imageMemoryBarrierCount = ARR_SIZE(blitBarriers),
+		.pImageMemoryBarriers = blitBarriers
+	};
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, engine->timestampPools[engine->cur_frame], TIMESTAMP_BLIT_START);
+	vkCmdPipelineBarrier2(cmd, &blitDependency);
+	ImageCopy(cmd, engine->renderImages[engine->cur_frame].image, engine->swapchainImages[engine->cur_swapchainIndex], (VkExtent2D){
+		.height = engine->renderImages[engine->cur_frame].imageExtent.height,
+		.width = engine->renderImages[engine->cur_frame].imageExtent.width
+	}, engine->pixelResolution);
+
+	//the render image is only touched again after the frame has been waited on, so going back to GENERAL needs no access
+	blitBarriers[0] = (VkImageMemoryBarrier2) {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+		.pNext = NULL,
+		.srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+		.srcAccessMask = VK_ACCESS_2_NONE,
+		.dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+		.dstAccessMask = VK_ACCESS_2_NONE,
+		.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = engine->renderImages[engine->cur_frame].image,
+		.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+	};
+	//presentation waits on the semaphore signalled at the end of the submission, which covers the transition
+	blitBarriers[1] = (VkImageMemoryBarrier2) {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+		.pNext = NULL,
+		.srcStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+		.dstAccessMask = VK_ACCESS_2_NONE,
+		.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = engine->swapchainImages[engine->cur_swapchainIndex],
+		.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+	};
+	vkCmdPipelineBarrier2(cmd, &blitDependency);
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, engine->timestampPools[engine->cur_frame], TIMESTAMP_BLIT_END);
+}
+EngineResult EngineFrameEnd(Engine *engine) {
+	//the camera is usually only moved once the frame has begun
+	writeFrameState(engine);
+	EngineResult eRes = submitStagedUploads(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	VkCommandBuffer cmd = engine->backgroundBufferCmd[engine->cur_frame];
+	if(engine->headless) {
+		recordHeadlessCopy(engine, cmd);
+	} else {
+		recordPresentBlit(engine, cmd);
+	}
+	res = vkEndCommandBuffer(cmd);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_PREPARE_FOR_SUBMISSION, res);
+
+	VkCommandBufferSubmitInfo cmdSubmitInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+		.commandBuffer = cmd,
+		.deviceMask = 0,
+		.pNext = NULL
+	};
+	//only the blit needs the swapchain image, everything before it runs while the image is still being presented
+	VkSemaphoreSubmitInfo waitInfo[ENGINE_MAX_FRAMES_IN_FLIGHT + 1] = {0}, signalInfo[2] = {0};
+	uint32_t waitCount = 0;
+	chainSubmission(engine, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, waitInfo, &waitCount, &signalInfo[0]);
+	if(!engine->headless) {
+		waitInfo[waitCount++] = (VkSemaphoreSubmitInfo) {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+			.deviceIndex = 0,
+			.pNext = NULL,
+			.stageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+			.semaphore = engine->swapchainSemaphores[engine->cur_frame]
+		};
+	}
+	signalInfo[1] = (VkSemaphoreSubmitInfo) {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+		.deviceIndex = 0,
+		.pNext = NULL,
+		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		.semaphore = engine->bufferCopySemaphores[engine->cur_frame]
+	};
+	VkSubmitInfo2 queueSubmitInfo = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+		.commandBufferInfoCount = 1,
+		.pCommandBufferInfos = &cmdSubmitInfo,
+		.signalSemaphoreInfoCount = engine->headless ? 1 : 2,
+		.pSignalSemaphoreInfos = signalInfo,
+		.waitSemaphoreInfoCount = waitCount,
+		.pWaitSemaphoreInfos = waitInfo,
+		.flags = 0
+	};
+	EngineTraceZone zone = EngineTraceBegin("submit frame");
+	res = vkQueueSubmit2(engine->graphics.queue, 1, &queueSubmitInfo, VK_NULL_HANDLE);
+	EngineTraceEnd(zone);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_SUBMIT_TO_GPU, res);
+	if(engine->headless) {
+		finishHeadlessFrame(engine);
+		return ENGINE_RESULT_SUCCESS;
+	}
+	return presentFrame(engine);
+}
 EngineResult EngineInit(Engine **engine_instance, EngineCI engineCI, uintptr_t *vkInstance) {
 	Engine *engine = malloc(sizeof(Engine));
 	*engine_instance = engine;
+	ERR_CHECK(engine != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
 	
 	engine->oldSwapchain = VK_NULL_HANDLE;
 	engine->swapchain = VK_NULL_HANDLE;
 	engine->shaderModulesCount = 0;
+	engine->wavefrontLoaded = false;
+	engine->wavefrontBuffer = VK_NULL_HANDLE;
+	engine->shaderVariants = NULL;
+	engine->shaderPipelines.pipelines = NULL;
+	engine->shaderPipelines.count = 0;
+	engine->shaderPipelines.job = NULL;
+	engine->wavefrontPipelines = engine->shaderPipelines;
+	engine->compilerStarted = false;
+	engine->retiredObjects = NULL;
+	engine->retiredObjectCount = 0;
+	engine->retiredObjectCapacity = 0;
+	engine->tuning = false;
+	engine->tunePath = NULL;
+	engine->pipelineCache = VK_NULL_HANDLE;
+	engine->pipelineCachePath = NULL;
+	for(size_t i = 0; i < ENGINE_MAX_FRAMES_IN_FLIGHT; i++) {
+		engine->frameCandidate[i] = TUNE_NONE;
+		engine->frameCandidateUsed[i] = false;
+	}
+	engine->shaderVariantCount = 0;
+	engine->shaderVariantCapacity = 0;
+	engine->sceneRefractive = true;
+	engine->shadowRays = true;
+	engine->headless = false;
+	engine->frameCallback = NULL;
+	engine->frameCallbackUserData = NULL;
+	engine->frameIndex = 0;
+	engine->stagedScene = engineCI.stagedScene;
+	engine->stagedBuffers = NULL;
+	engine->stagedBufferCount = 0;
+	engine->stagedBufferCapacity = 0;
+	//more frames in flight keep the GPU busier, at the cost of memory and latency
+	engine->frameCount = engineCI.framesInFlight == 0 ? 2 : engineCI.framesInFlight;
+	if(engine->frameCount > ENGINE_MAX_FRAMES_IN_FLIGHT)
+		engine->frameCount = ENGINE_MAX_FRAMES_IN_FLIGHT;
+	engine->historySlotCount = engine->frameCount < HISTORY_IMAGE_PAIR ? HISTORY_IMAGE_PAIR : engine->frameCount;
+	engine->timestampsSupported = false;
+	engine->pipelineStatisticsSupported = false;
+	engine->hostQueryReset = false;
+	engine->calibratedTimestamps = false;
+	engine->getCalibratedTimestamps = NULL;
+	engine->gpuToHostOffsetValid = false;
+	engine->instance = VK_NULL_HANDLE;
+	//nothing else is allocated yet, so the engine can go again without EngineDestroy
+	if(engineCI.pipelineCachePath != NULL) {
+		size_t length = strlen(engineCI.pipelineCachePath) + 1;
+		engine->pipelineCachePath = malloc(length);
+		if(engine->pipelineCachePath == NULL) {
+			free(engine);
+			*engine_instance = NULL;
+			return (EngineResult) {ENGINE_OUT_OF_MEMORY, VK_SUCCESS};
+		}
+		memcpy(engine->pipelineCachePath, engineCI.pipelineCachePath, length);
+	}
 
 	#ifndef NDEBUG
 	ERR_CHECK(checkValidationSupport(), ENGINE_DEBUG_CREATION_FAILED, VK_SUCCESS);
@@ -845,8 +3326,6 @@ EngineResult EngineInit(Engine **engine_instance, EngineCI engineCI, uintptr_t *
 		.pNext = NULL,
 		.flags = 0
 	};
-	ERR_CHECK(engine != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
-	engine->instance = VK_NULL_HANDLE;
 	res = vkCreateInstance(&instanceCI, NULL, &engine->instance);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_INSTANCE_CREATION_FAILED, res);
 	debug_msg("Vulkan Instance created successfully\n");
@@ -857,22 +3336,20 @@ EngineResult EngineInit(Engine **engine_instance, EngineCI engineCI, uintptr_t *
 #define ENGINE_DATATYPE(B, T) (EngineDataTypeInfo) {.bindingIndex = B, .count = 1, .type = T}
 
 
-#define BINDING_SPHERE_BUFFER 1
-#define BINDING_MATERIAL_BUFFER 3
-#define BINDING_TRANSFORMATION_BUFFER 2
-#define BINDING_SUNLIGHT_BUFFER 4
-#define BINDING_MISC_BUFFER 5
-#define BINDING_CAMERA_BUFFER 6
-#define BINDING_SECONDARY_RAYS_BUFFER 7
-
 inline void EngineGenerateDataTypeInfo(EngineDataTypeInfo *dataTypeInfo) {
 	dataTypeInfo[0] = ENGINE_DATATYPE(0, ENGINE_IMAGE);
 	dataTypeInfo[BINDING_SPHERE_BUFFER] = ENGINE_DATATYPE(BINDING_SPHERE_BUFFER, ENGINE_BUFFER_STORAGE);
 	dataTypeInfo[BINDING_TRANSFORMATION_BUFFER] = ENGINE_DATATYPE(BINDING_TRANSFORMATION_BUFFER, ENGINE_BUFFER_STORAGE);
 	dataTypeInfo[BINDING_MATERIAL_BUFFER] = ENGINE_DATATYPE(BINDING_MATERIAL_BUFFER, ENGINE_BUFFER_UNIFORM);
 	dataTypeInfo[BINDING_SUNLIGHT_BUFFER] = ENGINE_DATATYPE(BINDING_SUNLIGHT_BUFFER, ENGINE_BUFFER_UNIFORM);
-	dataTypeInfo[BINDING_MISC_BUFFER] = ENGINE_DATATYPE(BINDING_MISC_BUFFER, ENGINE_BUFFER_UNIFORM);
 	dataTypeInfo[BINDING_CAMERA_BUFFER] = ENGINE_DATATYPE(BINDING_CAMERA_BUFFER, ENGINE_BUFFER_STORAGE);
+	dataTypeInfo[BINDING_SECONDARY_RAYS_BUFFER] = ENGINE_DATATYPE(BINDING_SECONDARY_RAYS_BUFFER, ENGINE_BUFFER_STORAGE);
+	dataTypeInfo[BINDING_BVH_NODE_BUFFER] = ENGINE_DATATYPE(BINDING_BVH_NODE_BUFFER, ENGINE_BUFFER_STORAGE);
+	dataTypeInfo[BINDING_BVH_INDEX_BUFFER] = ENGINE_DATATYPE(BINDING_BVH_INDEX_BUFFER, ENGINE_BUFFER_STORAGE);
+	dataTypeInfo[BINDING_ACCUMULATION_IMAGE] = ENGINE_DATATYPE(BINDING_ACCUMULATION_IMAGE, ENGINE_IMAGE);
+	dataTypeInfo[BINDING_FRAME_STATE_BUFFER] = ENGINE_DATATYPE(BINDING_FRAME_STATE_BUFFER, ENGINE_BUFFER_UNIFORM);
+	dataTypeInfo[BINDING_GBUFFER_IMAGES] = (EngineDataTypeInfo) {.bindingIndex = BINDING_GBUFFER_IMAGES, .count = HISTORY_IMAGE_PAIR, .type = ENGINE_IMAGE};
+	dataTypeInfo[BINDING_HISTORY_IMAGES] = (EngineDataTypeInfo) {.bindingIndex = BINDING_HISTORY_IMAGES, .count = HISTORY_IMAGE_PAIR, .type = ENGINE_IMAGE};
 }
 
 
@@ -881,7 +3358,11 @@ EngineResult EngineDeclareDataSet(Engine *engine) {
 	EngineGenerateDataTypeInfo(datatypes);
 	VkDescriptorSetLayoutBinding *bindings = malloc(sizeof(VkDescriptorSetLayoutBinding) * ENGINE_DATATYPE_INFO_LENGTH);
 	VkDescriptorPoolSize *poolSizes = malloc(sizeof(VkDescriptorPoolSize) * ENGINE_DATATYPE_INFO_LENGTH);
+	uint32_t bindingCount = 0;
 	for(int i = 0; i < ENGINE_DATATYPE_INFO_LENGTH; i++) {
+		//bindings that aren't declared (like 5) are left out
+		if(datatypes[i].count == 0)
+			continue;
 		VkDescriptorType type = 0;
 		switch(datatypes[i].type) {
 			case ENGINE_BUFFER_STORAGE:
@@ -894,22 +3375,23 @@ EngineResult EngineDeclareDataSet(Engine *engine) {
 				type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
 				break;
 		}
-		bindings[i] = (VkDescriptorSetLayoutBinding) {
+		bindings[bindingCount] = (VkDescriptorSetLayoutBinding) {
 			.binding = datatypes[i].bindingIndex,
 			.descriptorType = type,
 			.descriptorCount = datatypes[i].count,
 			.pImmutableSamplers = NULL, //for now we keep it NULL. Consider looking at it later
 			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT //consider ALL_SHADERS tho
 		};
-		poolSizes[i] = (VkDescriptorPoolSize) {
-			.descriptorCount = datatypes[i].count * FRAME_OVERLAP,
+		poolSizes[bindingCount] = (VkDescriptorPoolSize) {
+			.descriptorCount = datatypes[i].count * engine->frameCount,
 			.type = type
 		};
+		bindingCount++;
 	}
 	VkDescriptorSetLayoutCreateInfo layoutCI = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
 		.pNext = NULL,
-		.bindingCount = ENGINE_DATATYPE_INFO_LENGTH,
+		.bindingCount = bindingCount,
 		.pBindings = bindings,
 		.flags = 0
 	};
@@ -919,8 +3401,8 @@ EngineResult EngineDeclareDataSet(Engine *engine) {
 	free(bindings);
 	VkDescriptorPoolCreateInfo poolCI = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-		.maxSets = FRAME_OVERLAP,
-		.poolSizeCount = ENGINE_DATATYPE_INFO_LENGTH,
+		.maxSets = engine->frameCount,
+		.poolSizeCount = bindingCount,
 		.pPoolSizes = poolSizes,
 		.pNext = NULL,
 		.flags = 0
@@ -929,10 +3411,13 @@ EngineResult EngineDeclareDataSet(Engine *engine) {
 	debug_msg("Descriptor pool created\n");
 	free(poolSizes);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_DATASET_DECLARATION_FAILED, res);
-	VkDescriptorSetLayout layouts[2] = {engine->descriptorSetLayout, engine->descriptorSetLayout};
+	VkDescriptorSetLayout layouts[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		layouts[i] = engine->descriptorSetLayout;
+	}
 	VkDescriptorSetAllocateInfo allocateInfo = {
 		.descriptorPool = engine->descriptorPool,
-		.descriptorSetCount = 2,
+		.descriptorSetCount = engine->frameCount,
 		.pNext = NULL,
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
 		.pSetLayouts = layouts,
@@ -943,11 +3428,142 @@ EngineResult EngineDeclareDataSet(Engine *engine) {
 	return ENGINE_RESULT_SUCCESS;
 }
 
-EngineResult EngineFinishSetup(Engine *engine, uintptr_t surface, EngineObjectLimits limits) {
+//partially bound so unused slots can stay empty, update-after-bind so adding one doesn't touch the frames' recordings
+EngineResult createBindlessSet(Engine *engine) {
+	VkDescriptorSetLayoutBinding bindings[] = {
+		{
+			.binding = BINDING_BINDLESS_BUFFERS,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = ENGINE_BINDLESS_BUFFER_CAPACITY,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL
+		},
+		{
+			.binding = BINDING_BINDLESS_TEXTURES,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = ENGINE_BINDLESS_TEXTURE_CAPACITY,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL
+		}
+	};
+	VkDescriptorBindingFlags bindingFlags[] = {
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT
+	};
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCI = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+		.pNext = NULL,
+		.bindingCount = ARR_SIZE(bindingFlags),
+		.pBindingFlags = bindingFlags
+	};
+	VkDescriptorSetLayoutCreateInfo layoutCI = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = &bindingFlagsCI,
+		.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+		.bindingCount = ARR_SIZE(bindings),
+		.pBindings = bindings
+	};
+	res = vkCreateDescriptorSetLayout(engine->device, &layoutCI, NULL, &engine->bindlessSetLayout);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_DATASET_DECLARATION_FAILED, res);
+	VkDescriptorPoolSize poolSizes[] = {
+		{.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = ENGINE_BINDLESS_BUFFER_CAPACITY},
+		{.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = ENGINE_BINDLESS_TEXTURE_CAPACITY}
+	};
+	VkDescriptorPoolCreateInfo poolCI = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+		.maxSets = 1,
+		.poolSizeCount = ARR_SIZE(poolSizes),
+		.pPoolSizes = poolSizes
+	};
+	res = vkCreateDescriptorPool(engine->device, &poolCI, NULL, &engine->bindlessPool);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_DATASET_DECLARATION_FAILED, res);
+	VkDescriptorSetAllocateInfo allocateInfo = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = NULL,
+		.descriptorPool = engine->bindlessPool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &engine->bindlessSetLayout
+	};
+	res = vkAllocateDescriptorSets(engine->device, &allocateInfo, &engine->bindlessSet);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_DATASET_DECLARATION_FAILED, res);
+	VkSamplerCreateInfo samplerCI = {
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.pNext = NULL,
+		.magFilter = VK_FILTER_LINEAR,
+		.minFilter = VK_FILTER_LINEAR,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.anisotropyEnable = false,
+		.compareEnable = false,
+		.minLod = 0,
+		.maxLod = VK_LOD_CLAMP_NONE
+	};
+	res = vkCreateSampler(engine->device, &samplerCI, NULL, &engine->bindlessSampler);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_DATASET_DECLARATION_FAILED, res);
+	ERR_CHECK(createBindlessSlots(&engine->bindlessBuffers, ENGINE_BINDLESS_BUFFER_CAPACITY), ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	ERR_CHECK(createBindlessSlots(&engine->bindlessTextures, ENGINE_BINDLESS_TEXTURE_CAPACITY), ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	return ENGINE_RESULT_SUCCESS;
+}
+void destroyBindlessSet(Engine *engine) {
+	destroyBindlessSlots(&engine->bindlessBuffers);
+	destroyBindlessSlots(&engine->bindlessTextures);
+	vkDestroySampler(engine->device, engine->bindlessSampler, NULL);
+	vkDestroyDescriptorPool(engine->device, engine->bindlessPool, NULL);
+	vkDestroyDescriptorSetLayout(engine->device, engine->bindlessSetLayout, NULL);
+}
+
+//nothing has been submitted yet, so the descriptors can be written right away
+EngineResult createFrameStates(Engine *engine) {
+	engine->accumulationEnabled = false;
+	engine->accumulationReset = true;
+	engine->accumulatedSamples = 0;
+	engine->accumulationCamera = (EngineCamera){0};
+	engine->temporalEnabled = false;
+	engine->temporalWeight = 1;
+	engine->historyFrames = 0;
+	VkDescriptorBufferInfo bufferInfos[ENGINE_MAX_FRAMES_IN_FLIGHT] = {0};
+	VkWriteDescriptorSet writeSets[ENGINE_MAX_FRAMES_IN_FLIGHT] = {0};
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		engine->frameStateBuffers[i] = (EngineBuffer) {
+			.isAccessible = true,
+			.length = 1,
+			.elementByteSize = sizeof(EngineFrameState),
+			.count = 1
+		};
+		EngineResult eRes = EngineCreateBuffer(engine, &engine->frameStateBuffers[i], ENGINE_BUFFER_UNIFORM);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+		*(EngineFrameState*)engine->frameStateBuffers[i].data = (EngineFrameState){0};
+		engine->frameStateWritten[i] = false;
+		bufferInfos[i] = (VkDescriptorBufferInfo) {
+			.buffer = (VkBuffer)engine->frameStateBuffers[i]._buffer,
+			.offset = 0,
+			.range = VK_WHOLE_SIZE
+		};
+		writeSets[i] = (VkWriteDescriptorSet) {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.pNext = NULL,
+			.dstSet = engine->descriptorSet[i],
+			.dstBinding = BINDING_FRAME_STATE_BUFFER,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.pBufferInfo = &bufferInfos[i]
+		};
+	}
+	vkUpdateDescriptorSets(engine->device, engine->frameCount, writeSets, 0, NULL);
+	return ENGINE_RESULT_SUCCESS;
+}
+
+EngineResult finishSetup(Engine *engine, uintptr_t surface, bool headless, EngineObjectLimits limits) {
 
 	engine->limits = limits;
 
 	engine->surface = surface;
+	engine->headless = headless;
 	engine->physicalDevice = VK_NULL_HANDLE;
 	size_t physicalDeviceCount = 0;
 	vkEnumeratePhysicalDevices(engine->instance, &physicalDeviceCount, NULL);
@@ -964,8 +3580,8 @@ EngineResult EngineFinishSetup(Engine *engine, uintptr_t surface, EngineObjectLi
 	engine->swapchainImageCount = engine->swapchainDetails.capabilities.minImageCount + 1;
 
 	float queuePriority = 1;
-	debug_msg("Graphics queue index: %d\nCompute queue index: %d\nPresentation queue index: %d\n", engine->graphics.index, engine->compute.index, engine->presentation.index);
-	uint32_t queueI[] = {engine->graphics.index, engine->compute.index, engine->presentation.index};
+	debug_msg("Graphics queue index: %d\nCompute queue index: %d\nPresentation queue index: %d\nTransfer queue index: %d\nAsync compute queue index: %d\n", engine->graphics.index, engine->compute.index, engine->presentation.index, engine->transfer.index, engine->asyncCompute.index);
+	uint32_t queueI[] = {engine->graphics.index, engine->compute.index, engine->presentation.index, engine->transfer.index, engine->asyncCompute.index};
 	uint32_t uniqueQueueI[ARR_SIZE(queueI)] = {engine->graphics.index};
 
 	uint32_t queueCI_len = 1;
@@ -980,7 +3596,7 @@ EngineResult EngineFinishSetup(Engine *engine, uintptr_t surface, EngineObjectLi
 	};
 	for(int i = 1; i < ARR_SIZE(uniqueQueueI); i++) { //yes i'm looping it like an array, tho i prefer to keep it in class as struct
 		bool isUnique = true;
-		for(int j = 0; j < ARR_SIZE(uniqueQueueI); j++) {
+		for(int j = 0; j < queueCI_len; j++) {
 			if(uniqueQueueI[j] == queueI[i]) {
 				isUnique = false;
 				break;
@@ -1007,7 +3623,16 @@ EngineResult EngineFinishSetup(Engine *engine, uintptr_t surface, EngineObjectLi
 		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
 		.pNext = NULL,
 		.bufferDeviceAddress = true,
-		.descriptorIndexing = true
+		.descriptorIndexing = true,
+		//all part of what descriptorIndexing guarantees, used by the bindless set
+		.runtimeDescriptorArray = true,
+		.descriptorBindingPartiallyBound = true,
+		.descriptorBindingUpdateUnusedWhilePending = true,
+		.descriptorBindingStorageBufferUpdateAfterBind = true,
+		.descriptorBindingSampledImageUpdateAfterBind = true,
+		.shaderStorageBufferArrayNonUniformIndexing = true,
+		.shaderSampledImageArrayNonUniformIndexing = true,
+		.timelineSemaphore = true
 	};
 	VkPhysicalDeviceVulkan13Features desiredFeatures13 = {
 		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
@@ -1020,10 +3645,33 @@ EngineResult EngineFinishSetup(Engine *engine, uintptr_t surface, EngineObjectLi
 		.pNext = &desiredFeatures13,
 		.features = {0}
 	};
+	//optional features used for GPU timing
+	VkPhysicalDeviceVulkan12Features supportedFeatures12 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+		.pNext = NULL,
+	};
+	VkPhysicalDeviceFeatures2 supportedFeatures = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &supportedFeatures12,
+	};
+	vkGetPhysicalDeviceFeatures2(engine->physicalDevice, &supportedFeatures);
+	engine->hostQueryReset = supportedFeatures12.hostQueryReset;
+	engine->pipelineStatisticsSupported = supportedFeatures.features.pipelineStatisticsQuery;
+	desiredFeatures12.hostQueryReset = engine->hostQueryReset;
+	deviceFeatures.features.pipelineStatisticsQuery = engine->pipelineStatisticsSupported;
+	//no swapchain extension without a surface
+	const char *enabledExtensions[ARR_SIZE(deviceExtensions) + 1];
+	uint32_t enabledExtensionCount = 0;
+	for(uint32_t i = engine->headless ? MandatoryDeviceExtensionsCount : 0; i < (engine->hardwareRayTracing ? ARR_SIZE(deviceExtensions) : MandatoryDeviceExtensionsCount); i++) {
+		enabledExtensions[enabledExtensionCount++] = deviceExtensions[i];
+	}
+	if(checkCalibratedTimestamps(engine)) {
+		enabledExtensions[enabledExtensionCount++] = VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME;
+	}
 	VkDeviceCreateInfo deviceCI = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.enabledExtensionCount = engine->hardwareRayTracing ? ARR_SIZE(deviceExtensions) : MandatoryDeviceExtensionsCount,
-		.ppEnabledExtensionNames = deviceExtensions,
+		.enabledExtensionCount = enabledExtensionCount,
+		.ppEnabledExtensionNames = enabledExtensions,
 		.queueCreateInfoCount = queueCI_len,
 		.pQueueCreateInfos = queueCI,
 		.pEnabledFeatures = NULL,
@@ -1038,24 +3686,60 @@ EngineResult EngineFinishSetup(Engine *engine, uintptr_t surface, EngineObjectLi
 	res = vkCreateDevice(engine->physicalDevice, &deviceCI, NULL, &engine->device);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_DEVICE_CREATION_FAILED, res);
 	debug_msg("Device created\n");
+	EngineResult cacheRes = createPipelineCache(engine);
+	ERR_CHECK(cacheRes.EngineCode == ENGINE_SUCCESS, cacheRes.EngineCode, cacheRes.VulkanCode);
+	if(engine->calibratedTimestamps) {
+		engine->getCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(engine->device, "vkGetCalibratedTimestampsEXT");
+		engine->calibratedTimestamps = engine->getCalibratedTimestamps != NULL;
+	}
 
 	CreateQueue(engine, &engine->graphics);
 	CreateQueue(engine, &engine->compute);
 	CreateQueue(engine, &engine->presentation);
+	CreateQueue(engine, &engine->transfer);
+	CreateQueue(engine, &engine->asyncCompute);
+	engine->bufferFamilyCount = 0;
+	uint32_t bufferFamilies[] = {engine->compute.index, engine->transfer.index, engine->asyncCompute.index};
+	for(size_t i = 0; i < ARR_SIZE(bufferFamilies); i++) {
+		bool isUnique = true;
+		for(size_t j = 0; j < engine->bufferFamilyCount; j++) {
+			if(engine->bufferFamilies[j] == bufferFamilies[i])
+				isUnique = false;
+		}
+		if(isUnique)
+			engine->bufferFamilies[engine->bufferFamilyCount++] = bufferFamilies[i];
+	}
+
+	VkCommandBufferAllocateInfo frameCommandsInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandBufferCount = engine->frameCount,
+		.commandPool = engine->compute.pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.pNext = NULL
+	};
+	res = vkAllocateCommandBuffers(engine->device, &frameCommandsInfo, engine->frameCommands);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_QUEUECOMMAND_ALLOCATION_FAILED, res);
+	invalidateFrameCommands(engine);
 	
 	VkSemaphoreCreateInfo semaphoreCI = {
 		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
 		.flags = VK_SEMAPHORE_TYPE_BINARY,
 		.pNext = NULL
 	};
-	VkFenceCreateInfo fenceCI = {
-		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-		.flags = VK_FENCE_CREATE_SIGNALED_BIT,
-		.pNext = NULL
+	VkSemaphoreTypeCreateInfo timelineTypeCI = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.pNext = NULL,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		.initialValue = 0
+	};
+	VkSemaphoreCreateInfo timelineCI = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.flags = 0,
+		.pNext = &timelineTypeCI
 	};
 	VkCommandBufferAllocateInfo info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-		.commandBufferCount = FRAME_OVERLAP,
+		.commandBufferCount = engine->frameCount,
 		.commandPool = engine->graphics.pool,
 		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
 		.pNext = NULL
@@ -1073,82 +3757,85 @@ EngineResult EngineFinishSetup(Engine *engine, uintptr_t surface, EngineObjectLi
 		.vulkanApiVersion = VK_API_VERSION_1_3,
 		.pAllocationCallbacks = NULL,
 		.pDeviceMemoryCallbacks = NULL,
+		.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
 	};
 	vmaCreateAllocator(&allocatorCI, &engine->allocator);
 
-	for(int i = 0; i < FRAME_OVERLAP; i++) {
+	eRes = createTimingQueries(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+
+	engine->sharedWriteFrame = 0;
+	res = vkCreateSemaphore(engine->device, &timelineCI, NULL, &engine->asyncTimeline);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_CREATE_SYNCHRONISING_VARIABLES, res);
+	engine->asyncValue = 0;
+	engine->asyncCommandCount = 0;
+	for(int i = 0; i < engine->frameCount; i++) {
 		res = vkCreateSemaphore(engine->device, &semaphoreCI, NULL, &engine->swapchainSemaphores[i]);
 		ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_CREATE_SYNCHRONISING_VARIABLES, res);
-		res = vkCreateSemaphore(engine->device, &semaphoreCI, NULL, &engine->frameReadySemaphores[i]);
-		ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_CREATE_SYNCHRONISING_VARIABLES, res);
 		res = vkCreateSemaphore(engine->device, &semaphoreCI, NULL, &engine->bufferCopySemaphores[i]);
 		ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_CREATE_SYNCHRONISING_VARIABLES, res);
-		res = vkCreateSemaphore(engine->device, &semaphoreCI, NULL, &engine->tmpSemaphores[i]);
-		ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_CREATE_SYNCHRONISING_VARIABLES, res);
-		res = vkCreateFence(engine->device, &fenceCI, NULL, &engine->frameFence[i]);
+		res = vkCreateSemaphore(engine->device, &timelineCI, NULL, &engine->frameTimelines[i]);
 		ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_CREATE_SYNCHRONISING_VARIABLES, res);
+		engine->frameDoneValue[i] = 0;
 	}
 	engine->cur_frame = 0;
-	engine->writeQueue.byteSize = sizeof(writeQueueElement);
-	engine->writeQueue.length = 10;
 
 	engine->sphereBuffer.data = NULL;
+	engine->bvh = (EngineBvh){0};
+	engine->bvhDirty = false;
 	engine->materialBuffer = (EngineBuffer){0};
 	engine->cameraBuffer = (EngineBuffer){0};
+	engine->sceneAddresses = (EngineSceneAddresses){0};
+	engine->sceneAddressesSet = false;
+	engine->transformationBuffer = (EngineBuffer){0};
+	eRes = createUploadRing(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	eRes = createStaging(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
 
-	EngineCreateHeapArray(&engine->writeQueue);
+	ERR_CHECK(EngineCreateRingQueue(&engine->writeQueue, ENGINE_MAX_QUEUED_ATTACHMENTS, sizeof(writeQueueElement)), ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	//one write and one info for every element
+	ERR_CHECK(EngineCreateArena(&engine->frameArena, ENGINE_MAX_QUEUED_ATTACHMENTS * (sizeof(VkWriteDescriptorSet) + sizeof(VkDescriptorBufferInfo) + sizeof(VkDescriptorImageInfo))), ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
 	EngineDeclareDataSet(engine);
+	eRes = createBindlessSet(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	eRes = createFrameStates(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
 	debug_msg("Initialisation complete\n");
 	return ENGINE_RESULT_SUCCESS;
 }
+//a surface that failed to be created must not quietly turn into a headless engine
+EngineResult EngineFinishSetup(Engine *engine, uintptr_t surface, EngineObjectLimits limits) {
+	ERR_CHECK(surface != 0, ENGINE_INVALID_ARGUMENT, VK_SUCCESS);
+	return finishSetup(engine, surface, false, limits);
+}
+EngineResult EngineFinishSetupHeadless(Engine *engine, EngineObjectLimits limits) {
+	return finishSetup(engine, 0, true, limits);
+}
 
 EngineResult EngineLoadShaders(Engine *engine, EngineShaderInfo *shaders, size_t shaderCount) {
-	engine->shaderModulesCount = shaderCount;
 	engine->shaderModules = malloc(sizeof(VkShaderModule) * shaderCount);
-	engine->pipelines = malloc(sizeof(VkPipeline) * shaderCount);
-	VkComputePipelineCreateInfo *pipelineCIs = malloc(sizeof(VkComputePipelineCreateInfo) * shaderCount);
+	ERR_CHECK(engine->shaderModules != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	EngineResult eRes = createPipelineSet(&engine->shaderPipelines, shaderCount, defaultPipelineKey(engine));
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	eRes = startPipelineCompiler(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
 
-	engine->workgroupSize = ceil(sqrtl(engine->physicalDeviceProperties.limits.maxComputeWorkGroupInvocations));
-	debug_msg("workgroup size per axis: %lu\n", engine->workgroupSize);
+	debug_msg("workgroup size: %ux%u\n", engine->workgroupSizeX, engine->workgroupSizeY);
 	debug_msg("Light source length: %zu\n", engine->sunlightBuffer.length);
-	uint32_t specialisationData[] = {
-		engine->workgroupSize, engine->materialBuffer.length, engine->sunlightBuffer.length
-	};
-	VkSpecializationMapEntry mapEntries[] = {
-		{
-			.constantID = 1,
-			.offset = 0,
-			.size = sizeof(uint32_t)
-		},
-		{
-			.constantID = 2,
-			.offset = 0,
-			.size = sizeof(uint32_t)
-		},
-		{
-			.constantID = 3,
-			.offset = sizeof(uint32_t),
-			.size = sizeof(uint32_t)
-		}, 
-		{
-			.constantID = 4,
-			.offset = 2 * sizeof(uint32_t),
-			.size = sizeof(uint32_t)
-		}
-	};
-
-	VkSpecializationInfo specialInfo = {
-		.dataSize = sizeof(specialisationData),
-		.pData = specialisationData,
-		.mapEntryCount = ARR_SIZE(mapEntries),
-		.pMapEntries = mapEntries
+	VkDescriptorSetLayout setLayouts[] = {engine->descriptorSetLayout, engine->bindlessSetLayout};
+	VkPushConstantRange pushConstantRange = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(EngineSceneAddresses) + ENGINE_SHADER_PARAMS_MAX_SIZE
 	};
 	VkPipelineLayoutCreateInfo pipelineLayoutCI = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
 		.pNext = NULL,
-		.pushConstantRangeCount = 0,
-		.setLayoutCount = 1,
-		.pSetLayouts = &engine->descriptorSetLayout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &pushConstantRange,
+		.setLayoutCount = ARR_SIZE(setLayouts),
+		.pSetLayouts = setLayouts,
 	};
 	res = vkCreatePipelineLayout(engine->device, &pipelineLayoutCI, NULL, &engine->pipelineLayout);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_SHADER_CREATION_FAILED, res);
@@ -1161,98 +3848,190 @@ EngineResult EngineLoadShaders(Engine *engine, EngineShaderInfo *shaders, size_t
 		};
 		res = vkCreateShaderModule(engine->device, &shaderModuleCI, NULL, &engine->shaderModules[i]);
 		ERR_CHECK(res == VK_SUCCESS, ENGINE_SHADER_CREATION_FAILED, res);
-		pipelineCIs[i] = (VkComputePipelineCreateInfo) {
-			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-			.pNext = NULL,
-			.flags = 0,
-			.layout = engine->pipelineLayout,
-			.stage = (VkPipelineShaderStageCreateInfo) {
-				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
-				.pName = "main",
-				.pNext = NULL,
-				.pSpecializationInfo = &specialInfo,
-				.module = engine->shaderModules[i],
-			},
-		};
+		engine->shaderModulesCount = i + 1;
 	}
-	res = vkCreateComputePipelines(engine->device, NULL, shaderCount, pipelineCIs, NULL, engine->pipelines);
-	ERR_CHECK(res == VK_SUCCESS, ENGINE_SHADER_CREATION_FAILED, res);
-	
+	return startPipelineBuilds(engine);
+}
+EngineResult EngineLoadWavefront(Engine *engine, size_t index) {
+	ERR_CHECK(index < engine->shaderModulesCount && !engine->wavefrontLoaded, ENGINE_SHADER_CREATION_FAILED, VK_SUCCESS);
+	engine->wavefrontShader = index;
+	EngineResult eRes = createPipelineSet(&engine->wavefrontPipelines, WAVEFRONT_STAGE_COUNT, defaultPipelineKey(engine));
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	engine->wavefrontLoaded = true;
+	eRes = startPipelineBuilds(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
 
-	return ENGINE_RESULT_SUCCESS;
+	//without render images the buffer comes with them
+	if(engine->wavefrontBuffer == VK_NULL_HANDLE)
+		return ENGINE_RESULT_SUCCESS;
+	vkDeviceWaitIdle(engine->device);
+	destroyWavefrontBuffer(engine);
+	return createWavefrontBuffer(engine);
+}
+bool EngineWavefrontLoaded(Engine *engine) {
+	return engine->wavefrontLoaded;
+}
+/*The variant when it is built, otherwise the most general pipeline that is there with the key's workgroup size:
+the shader's own, or a variant without bounce depth and flags. VK_NULL_HANDLE before the shader's own pipeline is built*/
+VkPipeline getShaderVariant(Engine *engine, size_t index, pipelineKey key) {
+	shaderVariant *variant = requestShaderVariant(engine, index, key);
+	if(variant != NULL && variant->pipeline != VK_NULL_HANDLE)
+		return variant->pipeline;
+	pipelineSet *set = &engine->shaderPipelines;
+	if(set->key.sizeX == key.sizeX && set->key.sizeY == key.sizeY)
+		return set->pipelines[index];
+	VkPipeline fallback = VK_NULL_HANDLE;
+	for(size_t i = 0; i < engine->shaderVariantCount; i++) {
+		shaderVariant *general = &engine->shaderVariants[i];
+		pipelineKey generalKey = general->key;
+		if(general->shaderIndex != index || general->pipeline == VK_NULL_HANDLE || generalKey.sizeX != key.sizeX || generalKey.sizeY != key.sizeY
+			|| generalKey.wavefrontStage != key.wavefrontStage || generalKey.bounceDepth != SHADER_MAX_BOUNCES || generalKey.flags != 0)
+			continue;
+		fallback = general->pipeline;
+		if(generalKey.materialCount == key.materialCount && generalKey.sunlightCount == key.sunlightCount)
+			break;
+	}
+	return fallback != VK_NULL_HANDLE ? fallback : set->pipelines[index];
 }
 
-void EngineAttachData(Engine *engine, EngineAttachDataInfo info) {
-	VkWriteDescriptorSet writeSet = {
-		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-		.pNext = NULL,
-		.dstBinding = info.binding,
-		.dstSet = engine->descriptorSet,
-		.dstArrayElement = info.startingIndex,
-		.descriptorCount = info.endIndex - info.startingIndex + 1,
+void EngineSetShadowRays(Engine *engine, bool enabled) {
+	if(engine->shadowRays == enabled)
+		return;
+	engine->shadowRays = enabled;
+	engine->accumulationReset = true;
+	invalidateFrameCommands(engine);
+}
+
+//recordings bake the pushed addresses in, so they are only kept while nothing changes
+void setSceneAddress(Engine *engine, uint64_t *address, EngineBuffer buffer) {
+	if(*address == buffer.deviceAddress)
+		return;
+	*address = buffer.deviceAddress;
+	invalidateFrameCommands(engine);
+}
+EngineSceneAddresses EngineGetSceneAddresses(Engine *engine) {
+	return engine->sceneAddresses;
+}
+void EngineSetSceneAddresses(Engine *engine, EngineSceneAddresses addresses) {
+	if(!engine->sceneAddressesSet)
+		invalidateFrameCommands(engine); //EngineRunRaytrace stops relying on the engine's materials
+	engine->sceneAddressesSet = true;
+	if(memcmp(&engine->sceneAddresses, &addresses, sizeof(EngineSceneAddresses)) == 0)
+		return;
+	engine->sceneAddresses = addresses;
+	//the frame being recorded already reserved its copies, it switches right away too
+	engine->frameSceneAddresses[engine->cur_frame] = addresses;
+	invalidateFrameCommands(engine);
+}
+//queues the write for frame's set, info.nextFrame is ignored
+EngineResult attachData(Engine *engine, EngineAttachDataInfo info, size_t frame) {
+	writeQueueElement writeElement = {
+		.writeSet = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.pNext = NULL,
+			.dstBinding = info.binding,
+			.dstArrayElement = info.startingIndex,
+			.descriptorCount = info.endIndex - info.startingIndex + 1,
+		},
+		.frame = frame,
+		.updateLeft = info.applyCount == ENGINE_ATTACH_DATA_ALL_FRAMES ? engine->frameCount : info.applyCount,
 	};
-	
-	VkDescriptorImageInfo *imageInfo = NULL; 
-	VkDescriptorBufferInfo *bufferInfo = NULL;
-	
+	//the shader reads it through sceneAddresses, the descriptor is only written for other shaders
+	if((info.type == ENGINE_BUFFER_STORAGE || info.type == ENGINE_BUFFER_UNIFORM) && info.binding == BINDING_TRANSFORMATION_BUFFER) {
+		engine->transformationBuffer = info.content.buffer;
+		setSceneAddress(engine, &engine->sceneAddresses.transformations, info.content.buffer);
+	}
 	switch(info.type) {
 		case ENGINE_BUFFER_STORAGE:
-			bufferInfo = malloc(sizeof(VkDescriptorBufferInfo));
-			*bufferInfo = (VkDescriptorBufferInfo){
-				.buffer = info.content.buffer._buffer,
-				.offset = 0,
-				.range = VK_WHOLE_SIZE
-			};
-			writeSet.pBufferInfo = bufferInfo;
-			writeSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-			break;
 		case ENGINE_BUFFER_UNIFORM:
-			bufferInfo = malloc(sizeof(VkDescriptorBufferInfo));
-			*bufferInfo = (VkDescriptorBufferInfo){
+			writeElement.bufferInfo = (VkDescriptorBufferInfo){
 				.buffer = info.content.buffer._buffer,
 				.offset = 0,
 				.range = VK_WHOLE_SIZE
 			};
-			writeSet.pBufferInfo = bufferInfo;
-			writeSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			writeElement.writeSet.descriptorType = info.type == ENGINE_BUFFER_STORAGE ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 			break;
 		case ENGINE_IMAGE:
-			imageInfo = malloc(sizeof(VkDescriptorImageInfo));
-			*imageInfo = (VkDescriptorImageInfo){
-				.imageLayout = info.content.image.layout,
-				.imageView = info.content.image.view,
-				.sampler = VK_NULL_HANDLE
-			};
-			writeSet.pImageInfo = imageInfo;
-			writeSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-			break;
 		case ENGINE_SAMPLED_IMAGE_ARRAY:
-			imageInfo = malloc(sizeof(VkDescriptorImageInfo));
-			*imageInfo = (VkDescriptorImageInfo){
+			writeElement.imageInfo = (VkDescriptorImageInfo){
 				.imageLayout = info.content.image.layout,
 				.imageView = info.content.image.view,
 				.sampler = VK_NULL_HANDLE
 			};
-			writeSet.pImageInfo = imageInfo;
-			writeSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writeElement.writeSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
 			break;
 	}
-	writeQueueElement writeElement = {
-		.frame = info.nextFrame ? NextFrame(engine->cur_frame) : engine->cur_frame,
-		.updateLeft = info.applyCount == ENGINE_ATTACH_DATA_ALL_FRAMES ? FRAME_OVERLAP : info.applyCount,
-		.writeSet = writeSet
-	};
-	if(engine->writeQueue.count > 0) {
-		writeQueueElement *arr = engine->writeQueue.arr;
-		writeQueueElement cur = arr[engine->writeQueue.count-1];
-		if(NextFrame(writeElement.frame) == cur.frame && engine->cur_frame == writeElement.frame) {
-			arr[engine->writeQueue.count-1] = writeElement;
-			EngineHeapArrayEnqueue(&engine->writeQueue, &cur);
-			return;
-		}
+	ERR_CHECK(EngineRingQueuePush(&engine->writeQueue, &writeElement), ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	return ENGINE_RESULT_SUCCESS;
+}
+EngineResult EngineAttachData(Engine *engine, EngineAttachDataInfo info) {
+	return attachData(engine, info, info.nextFrame ? NextFrame(engine, engine->cur_frame) : engine->cur_frame);
+}
+
+EngineResult EngineBindlessAddBuffer(Engine *engine, EngineBuffer buffer, uint32_t *index) {
+	ERR_CHECK(acquireBindlessSlot(&engine->bindlessBuffers, index), ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	VkDescriptorBufferInfo bufferInfo = {
+		.buffer = (VkBuffer)buffer._buffer,
+		.offset = 0,
+		.range = VK_WHOLE_SIZE
+	};
+	VkWriteDescriptorSet writeSet = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = NULL,
+		.dstSet = engine->bindlessSet,
+		.dstBinding = BINDING_BINDLESS_BUFFERS,
+		.dstArrayElement = *index,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.pBufferInfo = &bufferInfo
+	};
+	vkUpdateDescriptorSets(engine->device, 1, &writeSet, 0, NULL);
+	return ENGINE_RESULT_SUCCESS;
+}
+EngineResult EngineBindlessAddTexture(Engine *engine, EngineImage image, uint32_t *index) {
+	ERR_CHECK(acquireBindlessSlot(&engine->bindlessTextures, index), ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	VkDescriptorImageInfo imageInfo = {
+		.imageLayout = (VkImageLayout)image.layout,
+		.imageView = (VkImageView)image.view,
+		.sampler = engine->bindlessSampler
+	};
+	VkWriteDescriptorSet writeSet = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = NULL,
+		.dstSet = engine->bindlessSet,
+		.dstBinding = BINDING_BINDLESS_TEXTURES,
+		.dstArrayElement = *index,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.pImageInfo = &imageInfo
+	};
+	vkUpdateDescriptorSets(engine->device, 1, &writeSet, 0, NULL);
+	return ENGINE_RESULT_SUCCESS;
+}
+//the frame being recorded may still use it, so it is the one that has to finish.
+//a full queue gives back the slots of finished frames first, waiting for the oldest submitted one if none are
+EngineResult retireBindlessSlot(Engine *engine, BindlessSlots *slots, uint32_t index) {
+	ERR_CHECK(index < slots->used, ENGINE_INVALID_ARGUMENT, VK_SUCCESS);
+	bindlessRetiredSlot retired = {.slot = index, .frameIndex = engine->frameIndex};
+	if(EngineRingQueuePush(&slots->retired, &retired))
+		return ENGINE_RESULT_SUCCESS;
+	reclaimBindlessSlots(engine, slots);
+	if(slots->retired.count == slots->retired.capacity) {
+		uint64_t oldest = ((bindlessRetiredSlot*)slots->retired.arr)[slots->retired.head].frameIndex;
+		//only slots removed more than once fill the queue with the frame being recorded
+		ERR_CHECK(oldest < engine->frameIndex, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+		EngineResult eRes = EngineWaitForFrame(engine, oldest);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+		reclaimBindlessSlots(engine, slots);
 	}
-	EngineHeapArrayEnqueue(&engine->writeQueue, &writeElement);
+	ERR_CHECK(EngineRingQueuePush(&slots->retired, &retired), ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	return ENGINE_RESULT_SUCCESS;
+}
+EngineResult EngineBindlessRemoveBuffer(Engine *engine, uint32_t index) {
+	return retireBindlessSlot(engine, &engine->bindlessBuffers, index);
+}
+EngineResult EngineBindlessRemoveTexture(Engine *engine, uint32_t index) {
+	return retireBindlessSlot(engine, &engine->bindlessTextures, index);
 }
 
 EngineResult EngineCreateCommand(Engine *engine, EngineCommand *cmd) {
@@ -1283,15 +4062,42 @@ EngineResult EngineCommandRecordingStart(Engine *engine, EngineCommand cmd, Engi
 	}
 	res = vkBeginCommandBuffer(cmd, &beginInfo);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_START_COMMAND, res);
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, engine->pipelineLayout, 0, 1, &engine->descriptorSet[engine->cur_frame], 0, NULL);
+	//no barrier against the other frames' dispatches, EngineSubmitCommand puts the timeline waits in front when they share something
+	bindDescriptorSets(engine, cmd);
 	return ENGINE_RESULT_SUCCESS;
 }
 EngineResult EngineCommandRecordingEnd(Engine *engine, EngineCommand cmd) {
 	res = vkEndCommandBuffer(cmd);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_PREPARE_FOR_SUBMISSION, res);	
+	size_t frame = engine->cur_frame;
+	if((VkCommandBuffer)cmd == engine->frameCommands[frame]) {
+		engine->frameCommandRecorded[frame] = engine->frameCommandType[frame] == ENGINE_COMMAND_REUSABLE;
+		engine->frameCommandDispatches[frame] = engine->timedDispatchCount[frame];
+	}
+	return ENGINE_RESULT_SUCCESS;
+}
+//has to be called after EngineDrawStart, which waits until the GPU is done with the frame's previous submission
+EngineResult EngineFrameCommand(Engine *engine, EngineCommandRecordingType type, EngineCommand *cmd, bool *needsRecording) {
+	size_t frame = engine->cur_frame;
+	*cmd = (EngineCommand)engine->frameCommands[frame];
+	if(type == ENGINE_COMMAND_REUSABLE && engine->frameCommandType[frame] == type && engine->frameCommandRecorded[frame]) {
+		//the timestamps of the dispatches are part of the recording, EngineDrawStart only forgot how many there are
+		engine->timedDispatchCount[frame] = engine->frameCommandDispatches[frame];
+		*needsRecording = false;
+		return ENGINE_RESULT_SUCCESS;
+	}
+	res = vkResetCommandBuffer(engine->frameCommands[frame], 0);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_START_COMMAND, res);
+	engine->frameCommandType[frame] = type;
+	engine->frameCommandRecorded[frame] = false;
+	*needsRecording = true;
 	return ENGINE_RESULT_SUCCESS;
 }
-EngineResult EngineSubmitCommand(Engine *engine, EngineCommand cmd, EngineSemaphore *waitSemaphore, EngineSemaphore *signalSemaphore) {
+//the first submission of a frame decides how many samples its dispatch blends with, by then the frame's camera is set
+EngineResult EngineSubmitCommand(Engine *engine, EngineCommand cmd) {
+	writeFrameState(engine);
+	EngineResult eRes = submitStagedUploads(engine);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
 	VkCommandBufferSubmitInfo cmdSubmitInfo = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
 		.commandBuffer = cmd,
@@ -1299,71 +4105,280 @@ EngineResult EngineSubmitCommand(Engine *engine, EngineCommand cmd, EngineSemaph
 		.pNext = NULL
 	};
 
-	VkSemaphoreSubmitInfo signalInfo = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-		.deviceIndex = 0,
-		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-		.semaphore = *signalSemaphore
-	};
-	VkSemaphoreSubmitInfo waitInfo = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-		.deviceIndex = 0,
-		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-		.semaphore = *waitSemaphore
-	};
+	VkSemaphoreSubmitInfo waitInfo[ENGINE_MAX_FRAMES_IN_FLIGHT], signalInfo;
+	uint32_t waitCount = 0;
+	chainSubmission(engine, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, waitInfo, &waitCount, &signalInfo);
 
 	VkSubmitInfo2 queueSubmitInfo = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
 		.commandBufferInfoCount = 1,
 		.pCommandBufferInfos = &cmdSubmitInfo,
-		.signalSemaphoreInfoCount = signalSemaphore != NULL ? 1 : 0,
+		.signalSemaphoreInfoCount = 1,
 		.pSignalSemaphoreInfos = &signalInfo,
-		.waitSemaphoreInfoCount = waitSemaphore != NULL ? 1 : 0,
-		.pWaitSemaphoreInfos = &waitInfo,
+		.waitSemaphoreInfoCount = waitCount,
+		.pWaitSemaphoreInfos = waitInfo,
 		.flags = 0
 	};
 
+	EngineTraceZone zone = EngineTraceBegin("submit compute");
 	res = vkQueueSubmit2(engine->compute.queue, 1, &queueSubmitInfo, NULL);
+	EngineTraceEnd(zone);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_SUBMIT_TO_GPU, res);
 	return ENGINE_RESULT_SUCCESS;
 }
 void EngineDestroyCommand(Engine *engine, EngineCommand cmd) {
+	for(size_t i = 0; i < engine->asyncCommandCount; i++) {
+		if(engine->asyncCommands[i] != (VkCommandBuffer)cmd)
+			continue;
+		vkQueueWaitIdle(engine->asyncCompute.queue);
+		vkFreeCommandBuffers(engine->device, engine->asyncCompute.pool, 1, (VkCommandBuffer*)&cmd);
+		engine->asyncCommands[i] = engine->asyncCommands[--engine->asyncCommandCount];
+		return;
+	}
 	vkQueueWaitIdle(engine->compute.queue);
-	vkResetCommandBuffer(cmd, NULL);
+	vkFreeCommandBuffers(engine->device, engine->compute.pool, 1, (VkCommandBuffer*)&cmd);
 }
-void EngineRunShader(Engine *engine, EngineCommand cmd, size_t index, EngineShaderRunInfo runInfo) {
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, engine->pipelines[index]);
-	vkCmdDispatch(cmd, runInfo.groupSizeX, runInfo.groupSizeY, runInfo.groupSizeZ);
+bool isAsyncCommand(Engine *engine, EngineCommand cmd) {
+	for(size_t i = 0; i < engine->asyncCommandCount; i++) {
+		if(engine->asyncCommands[i] == (VkCommandBuffer)cmd)
+			return true;
+	}
+	return false;
 }
-EngineResult EngineCreateSemaphore(Engine *engine, EngineSemaphore *semaphore) {
-	VkSemaphoreCreateInfo semaphoreCI = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+bool EngineAsyncComputeSupported(Engine *engine) {
+	return engine->asyncCompute.index != engine->compute.index;
+}
+EngineResult EngineCreateAsyncCommand(Engine *engine, EngineCommand *cmd) {
+	ERR_CHECK(engine->asyncCommandCount < ENGINE_MAX_ASYNC_COMMANDS, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	VkCommandBufferAllocateInfo allocateInfo = {
+		.commandBufferCount = 1,
+		.commandPool = engine->asyncCompute.pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = NULL
+	};
+	res = vkAllocateCommandBuffers(engine->device, &allocateInfo, cmd);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_START_COMMAND, res);
+	engine->asyncCommands[engine->asyncCommandCount++] = (VkCommandBuffer)*cmd;
+	return ENGINE_RESULT_SUCCESS;
+}
+EngineResult EngineSubmitAsyncCommand(Engine *engine, EngineCommand cmd, uint64_t *doneValue) {
+	VkCommandBufferSubmitInfo cmdSubmitInfo = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+		.commandBuffer = cmd,
+		.deviceMask = 0,
+		.pNext = NULL
+	};
+	VkSemaphoreSubmitInfo waitInfo[ENGINE_MAX_FRAMES_IN_FLIGHT];
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		waitInfo[i] = (VkSemaphoreSubmitInfo) {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+			.pNext = NULL,
+			.semaphore = engine->frameTimelines[i],
+			.value = engine->frameDoneValue[i],
+			.stageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			.deviceIndex = 0
+		};
+	}
+	engine->asyncValue++;
+	VkSemaphoreSubmitInfo signalInfo = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
 		.pNext = NULL,
-		.flags = VK_SEMAPHORE_TYPE_BINARY
+		.semaphore = engine->asyncTimeline,
+		.value = engine->asyncValue,
+		.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+		.deviceIndex = 0
 	};
-	res = vkCreateSemaphore(engine->device, &semaphoreCI, NULL, semaphore);
-	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_CREATE_SYNCHRONISING_VARIABLES, res);
+	VkSubmitInfo2 queueSubmitInfo = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+		.commandBufferInfoCount = 1,
+		.pCommandBufferInfos = &cmdSubmitInfo,
+		.signalSemaphoreInfoCount = 1,
+		.pSignalSemaphoreInfos = &signalInfo,
+		.waitSemaphoreInfoCount = engine->frameCount,
+		.pWaitSemaphoreInfos = waitInfo,
+		.flags = 0
+	};
+	EngineTraceZone zone = EngineTraceBegin("submit async compute");
+	res = vkQueueSubmit2(engine->asyncCompute.queue, 1, &queueSubmitInfo, NULL);
+	EngineTraceEnd(zone);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_CANNOT_SUBMIT_TO_GPU, res);
+	*doneValue = engine->asyncValue;
 	return ENGINE_RESULT_SUCCESS;
 }
-void EngineDestroySemaphore(Engine *engine, EngineSemaphore semaphore) {
-	vkDestroySemaphore(engine->device, semaphore, NULL);
+bool EngineAsyncCommandFinished(Engine *engine, uint64_t doneValue) {
+	uint64_t value = 0;
+	vkGetSemaphoreCounterValue(engine->device, engine->asyncTimeline, &value);
+	return value >= doneValue;
 }
-
+EngineResult EngineWaitForAsyncCommand(Engine *engine, uint64_t doneValue) {
+	VkSemaphoreWaitInfo waitInfo = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.semaphoreCount = 1,
+		.pSemaphores = &engine->asyncTimeline,
+		.pValues = &doneValue
+	};
+	res = vkWaitSemaphores(engine->device, &waitInfo, UINT64_MAX);
+	ERR_CHECK(res == VK_SUCCESS, ENGINE_FENCE_NOT_WORKING, res);
+	return ENGINE_RESULT_SUCCESS;
+}
+void EngineRunShaderWithParams(Engine *engine, EngineCommand cmd, size_t index, EngineShaderRunInfo runInfo, const void *params, uint32_t paramsSize) {
+	//the whole block is pushed so the shader never reads what an earlier dispatch left behind
+	uint8_t block[ENGINE_SHADER_PARAMS_MAX_SIZE] = {0};
+	if(paramsSize > ENGINE_SHADER_PARAMS_MAX_SIZE) {
+		debug_msg("shader parameters cut to %d bytes\n", ENGINE_SHADER_PARAMS_MAX_SIZE);
+		paramsSize = ENGINE_SHADER_PARAMS_MAX_SIZE;
+	}
+	memcpy(block, params, paramsSize);
+	vkCmdPushConstants(cmd, engine->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(EngineSceneAddresses), sizeof(block), block);
+	EngineRunShader(engine, cmd, index, runInfo);
+}
+//returns the query slot of the dispatch, or MAX_TIMED_DISPATCHES when it isn't timed
+uint32_t beginTimedDispatch(Engine *engine, EngineCommand cmd) {
+	size_t frame = engine->cur_frame;
+	uint32_t slot = engine->timedDispatchCount[frame];
+	//the query pools belong to the frames, async commands run outside of them
+	if(slot >= MAX_TIMED_DISPATCHES || isAsyncCommand(engine, cmd))
+		return MAX_TIMED_DISPATCHES;
+	engine->timedDispatchCount[frame]++;
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, engine->timestampPools[frame], TIMESTAMP_DISPATCH_START + 2 * slot);
+	if(engine->pipelineStatisticsSupported)
+		vkCmdBeginQuery(cmd, engine->statisticsPools[frame], slot, 0);
+	return slot;
+}
+void endTimedDispatch(Engine *engine, EngineCommand cmd, uint32_t slot) {
+	size_t frame = engine->cur_frame;
+	if(slot >= MAX_TIMED_DISPATCHES)
+		return;
+	if(engine->pipelineStatisticsSupported)
+		vkCmdEndQuery(cmd, engine->statisticsPools[frame], slot);
+	if(engine->timestampsSupported)
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, engine->timestampPools[frame], TIMESTAMP_DISPATCH_START + 2 * slot + 1);
+}
+void runPipeline(Engine *engine, EngineCommand cmd, VkPipeline pipeline, EngineShaderRunInfo runInfo) {
+	//still being built, the frame only gets its background
+	if(pipeline == VK_NULL_HANDLE)
+		return;
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdPushConstants(cmd, engine->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(EngineSceneAddresses), &engine->frameSceneAddresses[engine->cur_frame]);
+	uint32_t slot = beginTimedDispatch(engine, cmd);
+	vkCmdDispatch(cmd, runInfo.groupSizeX, runInfo.groupSizeY, runInfo.groupSizeZ);
+	endTimedDispatch(engine, cmd, slot);
+}
+void EngineRunShader(Engine *engine, EngineCommand cmd, size_t index, EngineShaderRunInfo runInfo) {
+	if(engine->tuning && engine->frameCandidate[engine->cur_frame] != TUNE_NONE) {
+		engine->frameCandidateUsed[engine->cur_frame] = true;
+		runPipeline(engine, cmd, getShaderVariant(engine, index, framePipelineKey(engine)), runInfo);
+		return;
+	}
+	runPipeline(engine, cmd, engine->shaderPipelines.pipelines[index], runInfo);
+}
+void EngineRunRaytrace(Engine *engine, EngineCommand cmd, size_t index, EngineShaderRunInfo runInfo, EngineRaytraceParams params) {
+	//nothing to specialise, the shader only shows the background
+	if(params.maxRays == 0) {
+		EngineRunShaderWithParams(engine, cmd, index, runInfo, &params, sizeof(params));
+		return;
+	}
+	pipelineKey key = framePipelineKey(engine);
+	key.bounceDepth = clampU32(params.maxRays, 1, SHADER_MAX_BOUNCES);
+	key.flags = VARIANT_EXACT_DEPTH;
+	//the engine can't see the materials of scenes set with EngineSetSceneAddresses
+	if(!engine->sceneRefractive && !engine->sceneAddressesSet)
+		key.flags |= VARIANT_NO_REFRACTION;
+	if(!engine->shadowRays)
+		key.flags |= VARIANT_NO_SHADOW_RAYS;
+	if(engine->tuning)
+		engine->frameCandidateUsed[engine->cur_frame] = true;
+	VkPipeline pipeline = getShaderVariant(engine, index, key);
+	uint8_t block[ENGINE_SHADER_PARAMS_MAX_SIZE] = {0};
+	memcpy(block, &params, sizeof(params));
+	vkCmdPushConstants(cmd, engine->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(EngineSceneAddresses), sizeof(block), block);
+	runPipeline(engine, cmd, pipeline, runInfo);
+}
+//indirectOffset is where the group counts are in the wavefront buffer, or 0 to dispatch runInfo
+void runWavefrontStage(Engine *engine, EngineCommand cmd, wavefrontStage stage, wavefrontParams params, EngineShaderRunInfo runInfo, VkDeviceSize indirectOffset) {
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, engine->wavefrontPipelines.pipelines[stage]);
+	vkCmdPushConstants(cmd, engine->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(EngineSceneAddresses), sizeof(params), &params);
+	if(indirectOffset != 0) {
+		vkCmdDispatchIndirect(cmd, engine->wavefrontBuffer, indirectOffset);
+	} else {
+		vkCmdDispatch(cmd, runInfo.groupSizeX, runInfo.groupSizeY, runInfo.groupSizeZ);
+	}
+	//every stage reads the queues and arguments the one before it wrote
+	VkMemoryBarrier2 barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+		.pNext = NULL,
+		.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+		.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT
+	};
+	VkDependencyInfo dependencyInfo = {
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.pNext = NULL,
+		.memoryBarrierCount = 1,
+		.pMemoryBarriers = &barrier
+	};
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+void EngineRunWavefront(Engine *engine, EngineCommand cmd, EngineRaytraceParams params) {
+	//until the kernels are built the megakernel renders the frame
+	if(engine->wavefrontPipelines.pipelines[0] == VK_NULL_HANDLE) {
+		EngineShaderRunInfo grid = EngineDispatchGrid(engine, engine->pixelResolution.width, engine->pixelResolution.height);
+		EngineRunRaytrace(engine, cmd, engine->wavefrontShader, grid, params);
+		return;
+	}
+	//the kernels keep the workgroup size they were built with while the others are tuned
+	pipelineKey key = engine->wavefrontPipelines.key;
+	EngineShaderRunInfo runInfo = {
+		.groupSizeX = (engine->pixelResolution.width + key.sizeX - 1) / key.sizeX,
+		.groupSizeY = (engine->pixelResolution.height + key.sizeY - 1) / key.sizeY,
+		.groupSizeZ = 1
+	};
+	EngineShaderRunInfo single = {1, 1, 1};
+	//as deep as the megakernel goes, every bounce is recorded whether any path is left or not
+	params.maxRays = clampU32(params.maxRays, 0, SHADER_MAX_BOUNCES);
+	wavefrontParams stageParams = {.raytrace = params, .bounce = 0, .phase = WAVEFRONT_PHASE_RESET};
+	vkCmdPushConstants(cmd, engine->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(EngineSceneAddresses), &engine->frameSceneAddresses[engine->cur_frame]);
+	uint32_t slot = beginTimedDispatch(engine, cmd);
+	runWavefrontStage(engine, cmd, WAVEFRONT_ARGS, stageParams, single, 0);
+	runWavefrontStage(engine, cmd, WAVEFRONT_GENERATE, stageParams, runInfo, 0);
+	stageParams.phase = WAVEFRONT_PHASE_GENERATED;
+	runWavefrontStage(engine, cmd, WAVEFRONT_ARGS, stageParams, single, 0);
+	//the paths that ended leave empty dispatches behind, the bounces themselves can't be skipped without reading the counters back
+	for(uint32_t bounce = 0; bounce < params.maxRays; bounce++) {
+		stageParams.bounce = bounce;
+		runWavefrontStage(engine, cmd, WAVEFRONT_EXTEND, stageParams, single, WAVEFRONT_EXTEND_ARGS);
+		stageParams.phase = WAVEFRONT_PHASE_EXTENDED;
+		runWavefrontStage(engine, cmd, WAVEFRONT_ARGS, stageParams, single, 0);
+		runWavefrontStage(engine, cmd, WAVEFRONT_SHADE, stageParams, single, WAVEFRONT_SHADE_ARGS);
+		stageParams.phase = WAVEFRONT_PHASE_SHADED;
+		runWavefrontStage(engine, cmd, WAVEFRONT_ARGS, stageParams, single, 0);
+		runWavefrontStage(engine, cmd, WAVEFRONT_SHADOW, stageParams, single, WAVEFRONT_SHADOW_ARGS);
+	}
+	runWavefrontStage(engine, cmd, WAVEFRONT_FINISH, stageParams, runInfo, 0);
+	endTimedDispatch(engine, cmd, slot);
+}
+//concurrent instead of moving ownership around, since staged uploads and async commands touch buffers from other families every frame
 EngineResult EngineCreateBuffer(Engine *engine, EngineBuffer *buffer, EngineDataType type) {
 	VkBufferCreateInfo buffCI = {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
 		.pNext = NULL,
-		.pQueueFamilyIndices = &engine->compute.index,
-		.queueFamilyIndexCount = 1,
-		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.pQueueFamilyIndices = engine->bufferFamilies,
+		.queueFamilyIndexCount = engine->bufferFamilyCount,
+		.sharingMode = engine->bufferFamilyCount > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
 		.size = buffer->length * buffer->elementByteSize,
+		.usage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
 	};
 	switch(type) {
 		case ENGINE_BUFFER_STORAGE:
-			buffCI.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+			buffCI.usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 			break;
 		case ENGINE_BUFFER_UNIFORM:
-			buffCI.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+			buffCI.usage |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 			break;
 	}
 
@@ -1371,12 +4386,29 @@ EngineResult EngineCreateBuffer(Engine *engine, EngineBuffer *buffer, EngineData
 		.usage = VMA_MEMORY_USAGE_AUTO,
 		.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT,
 	};
+	//never mapped, so VMA is free to pick memory the host can't see
+	if(buffer->isStaged) {
+		buffCI.usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		allocCI.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+		allocCI.flags = 0;
+	}
 	res = vmaCreateBuffer(engine->allocator, &buffCI, &allocCI, &buffer->_buffer, &buffer->_allocation, NULL);
 	ERR_CHECK(res == VK_SUCCESS, ENGINE_BUFFER_CREATION_FAILED, res);
+	VkBufferDeviceAddressInfo addressInfo = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+		.pNext = NULL,
+		.buffer = (VkBuffer)buffer->_buffer
+	};
+	buffer->deviceAddress = vkGetBufferDeviceAddress(engine->device, &addressInfo);
+	if(buffer->isStaged)
+		return registerStagedBuffer(engine, buffer);
 	EngineBufferAccessUpdate(engine, buffer, buffer->isAccessible);
 	return ENGINE_RESULT_SUCCESS;
 }
+//a staged buffer's data is always its host copy
 void EngineBufferAccessUpdate(Engine *engine, EngineBuffer *buffer, bool setAccessVal) {
+	if(buffer->isStaged)
+		return;
 	if(setAccessVal) {
 		vmaMapMemory(engine->allocator, buffer->_allocation, &buffer->data);
 		buffer->isAccessible = true;
@@ -1388,17 +4420,23 @@ void EngineBufferAccessUpdate(Engine *engine, EngineBuffer *buffer, bool setAcce
 	}
 }
 
+//the frames and async commands that may use it can be on any of the queues the buffer is shared with,
+//so it is destroyed at the start of a frame once they are all done instead of waiting for them here
 void EngineDestroyBuffer(Engine *engine, EngineBuffer buffer) {
-	vkQueueWaitIdle(engine->compute.queue);
+	if(buffer.isStaged)
+		unregisterStagedBuffer(engine, buffer);
 	if(buffer.isAccessible) {
 		vmaUnmapMemory(engine->allocator, buffer._allocation);
 	}
-	vmaDestroyBuffer(engine->allocator, buffer._buffer, buffer._allocation);
+	retireBuffer(engine, buffer._buffer, buffer._allocation);
 }
 
 void EngineDestroy(Engine *engine) {
+	//the compiler builds whatever is still queued first, the modules have to outlive that
+	stopPipelineCompiler(engine);
 	vkDeviceWaitIdle(engine->device);
-	EngineDestroyHeapArray(&engine->writeQueue);
+	EngineDestroyRingQueue(&engine->writeQueue);
+	EngineDestroyArena(&engine->frameArena);
 
 	if(engine->shaderModulesCount > 0) {
 		vkDestroyPipelineLayout(engine->device, engine->pipelineLayout, NULL);
@@ -1406,9 +4444,26 @@ void EngineDestroy(Engine *engine) {
 
 	for(int i = 0; i < engine->shaderModulesCount; i++) {
 		vkDestroyShaderModule(engine->device, engine->shaderModules[i], NULL);
-		vkDestroyPipeline(engine->device, engine->pipelines[i], NULL);
 	}
+	if(engine->shaderModulesCount > 0)
+		destroyPipelineSet(engine, &engine->shaderPipelines);
+	if(engine->wavefrontLoaded)
+		destroyPipelineSet(engine, &engine->wavefrontPipelines);
+	//finished jobs go the way they would at the next frame
+	collectShaderVariants(engine);
+	for(size_t i = 0; i < engine->shaderVariantCount; i++) {
+		if(engine->shaderVariants[i].pipeline != VK_NULL_HANDLE)
+			vkDestroyPipeline(engine->device, engine->shaderVariants[i].pipeline, NULL);
+	}
+	free(engine->shaderVariants);
+	free(engine->tunePath);
 	free(engine->shaderModules);
+	if(engine->pipelineCache != VK_NULL_HANDLE) {
+		if(EngineSavePipelineCache(engine).EngineCode != ENGINE_SUCCESS)
+			debug_msg("couldn't write the pipeline cache to %s\n", engine->pipelineCachePath);
+		vkDestroyPipelineCache(engine->device, engine->pipelineCache, NULL);
+	}
+	free(engine->pipelineCachePath);
 	// if(engine->textureImage.imageView != NULL) {
 	// 	vkDestroyImageView(engine->device, engine->textureImage.imageView, NULL);
 	// 	vmaDestroyImage(engine->allocator, engine->textureImage.image, engine->textureImage.allocation);
@@ -1416,37 +4471,121 @@ void EngineDestroy(Engine *engine) {
 	// if(engine->sphereBuffer._buffer != NULL)
 	// 	vmaDestroyBuffer(engine->allocator, engine->sphereBuffer._buffer, engine->sphereBuffer._allocation);
 
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		EngineDestroyBuffer(engine, engine->frameStateBuffers[i]);
+	}
+	EngineDestroyBuffer(engine, engine->uploadRing);
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		if(engine->stagingBuffers[i]._buffer)
+			vmaDestroyBuffer(engine->allocator, (VkBuffer)engine->stagingBuffers[i]._buffer, (VmaAllocation)engine->stagingBuffers[i]._allocation);
+	}
+	//the buffers belong to whoever created them
+	for(size_t i = 0; i < engine->stagedBufferCount; i++) {
+		free(engine->stagedBuffers[i].shadow);
+	}
+	free(engine->stagedBuffers);
+	//the device is idle, everything still waiting to be destroyed can go
+	for(size_t i = 0; i < engine->retiredObjectCount; i++) {
+		destroyRetiredObject(engine, engine->retiredObjects[i]);
+	}
+	free(engine->retiredObjects);
 	vmaDestroyAllocator(engine->allocator);
-	for(size_t i = 0; i < FRAME_OVERLAP; i++) {
+	for(size_t i = 0; i < engine->frameCount; i++) {
 		vkDestroySemaphore(engine->device, engine->swapchainSemaphores[i], NULL);
-		vkDestroySemaphore(engine->device, engine->frameReadySemaphores[i], NULL);
 		vkDestroySemaphore(engine->device, engine->bufferCopySemaphores[i], NULL);
-		vkDestroySemaphore(engine->device, engine->tmpSemaphores[i], NULL);
-		vkDestroyFence(engine->device, engine->frameFence[i], NULL);
+		vkDestroySemaphore(engine->device, engine->frameTimelines[i], NULL);
+		if(engine->timestampPools[i] != VK_NULL_HANDLE)
+			vkDestroyQueryPool(engine->device, engine->timestampPools[i], NULL);
+		if(engine->statisticsPools[i] != VK_NULL_HANDLE)
+			vkDestroyQueryPool(engine->device, engine->statisticsPools[i], NULL);
 	}
+	vkDestroySemaphore(engine->device, engine->asyncTimeline, NULL);
 	vkDestroyDescriptorPool(engine->device, engine->descriptorPool, NULL);
 	vkDestroyDescriptorSetLayout(engine->device, engine->descriptorSetLayout, NULL);
+	destroyBindlessSet(engine);
 
 	DestroyQueue(engine, &engine->graphics);
 	DestroyQueue(engine, &engine->compute);
 	DestroyQueue(engine, &engine->presentation);
+	DestroyQueue(engine, &engine->transfer);
+	DestroyQueue(engine, &engine->asyncCompute);
 
 	vkDestroyDevice(engine->device, NULL);
-	vkDestroySurfaceKHR(engine->instance, engine->surface, NULL);
+	if(!engine->headless) {
+		vkDestroySurfaceKHR(engine->instance, engine->surface, NULL);
+	}
 	vkDestroyInstance(engine->instance, NULL);
 	free(engine);
 }
 
+//every frame gets its own copy of the tree, see uploadSphereBvh
+EngineResult createSphereBvh(Engine *engine) {
+	size_t sphereCapacity = engine->limits.maxSphereCount > 0 ? engine->limits.maxSphereCount : 1;
+	EngineResult eRes = EngineBvhCreate(&engine->bvh, sphereCapacity);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	engine->sphereDirty = calloc(sphereCapacity, sizeof(bool));
+	engine->dirtySpheres = malloc(sizeof(uint32_t) * sphereCapacity);
+	engine->bvhChangedNodes = malloc(sizeof(uint32_t) * ENGINE_BVH_MAX_NODES(sphereCapacity));
+	ERR_CHECK(engine->sphereDirty != NULL && engine->dirtySpheres != NULL && engine->bvhChangedNodes != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+	engine->dirtySphereCount = 0;
+	engine->bvhDirty = true;
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		size_t frame = (engine->cur_frame + i) % engine->frameCount;
+		engine->bvhFullUpload[frame] = true;
+		engine->bvhNodePending[frame] = calloc(ENGINE_BVH_MAX_NODES(sphereCapacity), sizeof(bool));
+		engine->bvhPendingNodes[frame] = malloc(sizeof(uint32_t) * ENGINE_BVH_MAX_NODES(sphereCapacity));
+		ERR_CHECK(engine->bvhNodePending[frame] != NULL && engine->bvhPendingNodes[frame] != NULL, ENGINE_OUT_OF_MEMORY, VK_SUCCESS);
+		engine->bvhPendingCount[frame] = 0;
+		engine->bvhNodeBuffers[frame] = (EngineBuffer) {
+			.isAccessible = true,
+			.length = ENGINE_BVH_MAX_NODES(sphereCapacity),
+			.elementByteSize = sizeof(EngineBvhNode),
+			.count = 0
+		};
+		engine->bvhIndexBuffers[frame] = (EngineBuffer) {
+			.isAccessible = true,
+			.length = sphereCapacity,
+			.elementByteSize = sizeof(uint32_t),
+			.count = 0
+		};
+		eRes = EngineCreateBuffer(engine, &engine->bvhNodeBuffers[frame], ENGINE_BUFFER_STORAGE);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+		eRes = EngineCreateBuffer(engine, &engine->bvhIndexBuffers[frame], ENGINE_BUFFER_STORAGE);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+		eRes = attachData(engine, (EngineAttachDataInfo) {
+			.applyCount = 1,
+			.binding = BINDING_BVH_NODE_BUFFER,
+			.content = {.buffer = engine->bvhNodeBuffers[frame]},
+			.type = ENGINE_BUFFER_STORAGE,
+			.startingIndex = 0,
+			.endIndex = 0,
+		}, frame);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+		eRes = attachData(engine, (EngineAttachDataInfo) {
+			.applyCount = 1,
+			.binding = BINDING_BVH_INDEX_BUFFER,
+			.content = {.buffer = engine->bvhIndexBuffers[frame]},
+			.type = ENGINE_BUFFER_STORAGE,
+			.startingIndex = 0,
+			.endIndex = 0,
+		}, frame);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	}
+	return ENGINE_RESULT_SUCCESS;
+}
+
 EngineResult EngineCreateSphere(Engine *engine, EngineSphere **sphereArr, size_t *count, size_t *indexOut) {
 	if(engine->sphereBuffer.data == NULL) {
 		debug_msg("creating sphere buffer\n");
 		engine->sphereBuffer = (EngineBuffer) {
-			.isAccessible = true,
+			.isAccessible = !engine->stagedScene,
+			.isStaged = engine->stagedScene,
 			.length = engine->limits.maxSphereCount,
 			.elementByteSize = sizeof(EngineSphere),
 			.count = 0
 		};
 		EngineCreateBuffer(engine, &engine->sphereBuffer, ENGINE_BUFFER_STORAGE);
+		setSceneAddress(engine, &engine->sceneAddresses.spheres, engine->sphereBuffer);
 
 		EngineAttachDataInfo attachInfo = {
 			.applyCount = ENGINE_ATTACH_DATA_ALL_FRAMES,
@@ -1457,7 +4596,10 @@ EngineResult EngineCreateSphere(Engine *engine, EngineSphere **sphereArr, size_t
 			.startingIndex = 0,
 			.endIndex = 0,
 		};
-		EngineAttachData(engine, attachInfo);
+		EngineResult eRes = EngineAttachData(engine, attachInfo);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+		eRes = createSphereBvh(engine);
+		ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
 	}
 	debug_msg("sphere buffer created\n");
 	size_t index = engine->sphereBuffer.count;
@@ -1484,16 +4626,59 @@ EngineResult EngineCreateSphere(Engine *engine, EngineSphere **sphereArr, size_t
 		engine->sphereBuffer.count += 1;
 	debug_msg("Sphere created\n\t===\n\tcount: %zu\n\tindex: %zu\n\t===\n", engine->sphereBuffer.count, *indexOut);
 	*count = engine->sphereBuffer.count;
+	//filled in by the caller before the next frame, which adds it to the tree
+	EngineMarkSphereDirty(engine, index);
 	return ENGINE_RESULT_SUCCESS;
 }
 
+//the shader skips spheres without flags, so the tree can keep them until the slot is reused
 void EngineDestroySphere(Engine *engine, EngineSphere *sphere) {
 	sphere->flags = 0;
+	EngineBufferMarkDirty(engine, engine->sphereBuffer, (size_t)(sphere - (EngineSphere*)engine->sphereBuffer.data) * sizeof(EngineSphere), sizeof(EngineSphere));
 	sphere = NULL;
+	engine->accumulationReset = true;
+}
+
+void EngineMarkSphereDirty(Engine *engine, size_t index) {
+	engine->accumulationReset = true;
+	EngineBufferMarkDirty(engine, engine->sphereBuffer, index * sizeof(EngineSphere), sizeof(EngineSphere));
+	if(engine->bvh.nodes == NULL || index >= engine->limits.maxSphereCount || engine->sphereDirty[index])
+		return;
+	engine->sphereDirty[index] = true;
+	engine->dirtySpheres[engine->dirtySphereCount++] = (uint32_t)index;
 }
 
 void EngineDestroySphereBuffer(Engine *engine) {
 	EngineDestroyBuffer(engine, engine->sphereBuffer);
+	if(engine->bvh.nodes == NULL)
+		return;
+	for(size_t i = 0; i < engine->frameCount; i++) {
+		EngineDestroyBuffer(engine, engine->bvhNodeBuffers[i]);
+		EngineDestroyBuffer(engine, engine->bvhIndexBuffers[i]);
+		free(engine->bvhNodePending[i]);
+		free(engine->bvhPendingNodes[i]);
+	}
+	free(engine->sphereDirty);
+	free(engine->dirtySpheres);
+	free(engine->bvhChangedNodes);
+	EngineBvhDestroy(&engine->bvh);
+}
+
+EngineResult EngineBuildSphereBVH(Engine *engine) {
+	if(engine->bvh.nodes == NULL)
+		return ENGINE_RESULT_SUCCESS;
+	EngineTraceZone zone = EngineTraceBegin("EngineBuildSphereBVH");
+	EngineResult eRes = EngineBvhBuild((EngineBvhBuildCI){.threadCount = 0}, engine->sphereBuffer.data, engine->sphereBuffer.count, &engine->bvh);
+	EngineTraceEnd(zone);
+	ERR_CHECK(eRes.EngineCode == ENGINE_SUCCESS, eRes.EngineCode, eRes.VulkanCode);
+	debug_msg("Sphere BVH built: %u nodes over %u spheres\n", engine->bvh.nodeCount, engine->bvh.indexCount);
+	engine->bvhDirty = false;
+	engine->bvhBuildCost = EngineBvhCost(&engine->bvh);
+	engine->accumulationReset = true;
+	for(size_t frame = 0; frame < engine->frameCount; frame++) {
+		engine->bvhFullUpload[frame] = true;
+	}
+	return ENGINE_RESULT_SUCCESS;
 }
 
 
@@ -1666,9 +4851,11 @@ void EngineLoadMaterials(Engine *engine, EngineMaterial *material, size_t materi
 	engine->materialBuffer = (EngineBuffer){
 		.length = materialCount,
 		.elementByteSize = sizeof(EngineMaterial),
-		.isAccessible = false
+		.isAccessible = false,
+		.isStaged = engine->stagedScene
 	};
 	EngineCreateBuffer(engine, &engine->materialBuffer, ENGINE_BUFFER_UNIFORM);
+	setSceneAddress(engine, &engine->sceneAddresses.materials, engine->materialBuffer);
 	debug_msg("materialBuffer address: %llu\n", engine->materialBuffer._buffer);
 
 	debug_msg("Material buffer created\n");
@@ -1693,14 +4880,26 @@ void EngineWriteMaterials(Engine *engine, EngineMaterial *material, size_t *indi
 		for(size_t i = 0; i < indexCount; i++) {
 			materialMem[i] = material[i];
 		}
+		EngineBufferMarkDirty(engine, engine->materialBuffer, 0, sizeof(EngineMaterial) * indexCount);
 	} else {
 		for(size_t i = 0; i < indexCount; i++) {
 			materialMem[indices[i]] = material[i];
+			EngineBufferMarkDirty(engine, engine->materialBuffer, sizeof(EngineMaterial) * indices[i], sizeof(EngineMaterial));
 		}
 	}
+	//recordings that picked a variant without refraction have to pick again
+	bool refractive = false;
+	for(size_t i = 0; i < engine->materialBuffer.length; i++) {
+		refractive |= materialMem[i].refraction != 0;
+	}
+	if(refractive != engine->sceneRefractive) {
+		engine->sceneRefractive = refractive;
+		invalidateFrameCommands(engine);
+	}
 
 	debug_msg("data copied\n");
 	EngineBufferAccessUpdate(engine, &engine->materialBuffer, false);
+	engine->accumulationReset = true;
 }
 void EngineUnloadMaterials(Engine *engine) {
 	EngineDestroyBuffer(engine, engine->materialBuffer);
@@ -1737,6 +4936,7 @@ void EngineWriteSunlight(Engine *engine, EngineSunlight sunlight) {
 	EngineSunlight *mem = engine->sunlightBuffer.data;
 	*mem = sunlight;
 	EngineBufferAccessUpdate(engine, &engine->sunlightBuffer, false);
+	engine->accumulationReset = true;
 }
 void EngineUnloadSunlight(Engine *engine) {
 	EngineDestroyBuffer(engine, engine->sunlightBuffer);
@@ -1754,6 +4954,7 @@ void EngineCreateCamera(Engine *engine, EngineCamera **camera) {
 		.isAccessible = true
 	};
 	EngineCreateBuffer(engine, &engine->cameraBuffer, ENGINE_BUFFER_STORAGE);
+	setSceneAddress(engine, &engine->sceneAddresses.camera, engine->cameraBuffer);
 	EngineAttachDataInfo attachInfo = {
 		.binding = BINDING_CAMERA_BUFFER,
 		.content = {.buffer = engine->cameraBuffer},
@@ -1768,4 +4969,44 @@ void EngineCreateCamera(Engine *engine, EngineCamera **camera) {
 }
 void EngineDestroyCamera(Engine *engine) {
 	EngineDestroyBuffer(engine, engine->cameraBuffer);
-}
\ No newline at end of file
+}
+
+void EngineSetAccumulation(Engine *engine, bool enabled) {
+	if(engine->accumulationEnabled != enabled)
+		engine->accumulationReset = true;
+	engine->accumulationEnabled = enabled;
+}
+void EngineResetAccumulation(Engine *engine) {
+	engine->accumulationReset = true;
+}
+uint32_t EngineGetAccumulatedSamples(Engine *engine) {
+	return engine->accumulatedSamples;
+}
+void EngineSetTemporalReprojection(Engine *engine, bool enabled, float newSampleWeight) {
+	engine->temporalEnabled = enabled;
+	engine->temporalWeight = newSampleWeight;
+}
+
+EngineResult EngineRenderCpu(Engine *engine, EngineCpuTracer *tracer, EngineCpuFrameInfo frame) {
+	EngineCpuScene scene = {
+		.spheres = engine->sphereBuffer.data,
+		.sphereCount = engine->sphereBuffer.data ? engine->sphereBuffer.count : 0,
+		.materialCount = engine->materialBuffer.length,
+		.screenToViewport = EngineCpuScreenTransform(frame.width, frame.height),
+	};
+	if(engine->cameraBuffer.data != NULL) {
+		scene.camera = *(EngineCamera*)engine->cameraBuffer.data;
+	}
+	if(engine->materialBuffer._allocation) {
+		EngineBufferAccessUpdate(engine, &engine->materialBuffer, true);
+		scene.materials = engine->materialBuffer.data;
+	}
+	if(engine->sunlightBuffer._allocation) {
+		EngineBufferAccessUpdate(engine, &engine->sunlightBuffer, true);
+		scene.sunlight = *(EngineSunlight*)engine->sunlightBuffer.data;
+	}
+	EngineResult result = EngineCpuRender(tracer, &scene, frame);
+	EngineBufferAccessUpdate(engine, &engine->materialBuffer, false);
+	EngineBufferAccessUpdate(engine, &engine->sunlightBuffer, false);
+	return result;
+}
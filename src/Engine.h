@@ -4,11 +4,16 @@
 #include <stdbool.h>
 #include <cglm/cglm.h>
 
+#define ENGINE_MAX_FRAMES_IN_FLIGHT 4
+
 typedef struct {
     uint32_t appVersion;
     char *appName, *displayName;
     uint32_t extensionsCount;
     char **extensions;
+    uint32_t framesInFlight; //1 to ENGINE_MAX_FRAMES_IN_FLIGHT, 0 picks 2
+    bool stagedScene; //spheres and materials are created with isStaged
+    const char *pipelineCachePath; //NULL keeps the pipeline cache in memory only; each device gets its own file next to it, see EngineSavePipelineCache
 } EngineCI;
 
 
@@ -55,9 +60,14 @@ typedef struct {
         ENGINE_CANNOT_PREPARE_FOR_SUBMISSION,
         ENGINE_CANNOT_SUBMIT_TO_GPU,
         ENGINE_CANNOT_DISPLAY,
+        ENGINE_UNSUPPORTED_BY_DEVICE,
         
         ENGINE_DATASET_DECLARATION_FAILED,
         ENGINE_SHADER_CREATION_FAILED,
+
+        ENGINE_THREAD_CREATION_FAILED,
+        ENGINE_FILE_WRITE_FAILED,
+        ENGINE_INVALID_ARGUMENT,
     } EngineCode;
     size_t VulkanCode;
 } EngineResult;
@@ -81,6 +91,8 @@ typedef struct {
     size_t elementByteSize;
     bool isAccessible;
     void *data;
+    uint64_t deviceAddress; //set by EngineCreateBuffer, what shaders read it through with buffer_reference
+    bool isStaged; //device local, data is a host copy that only reaches the GPU through EngineBufferMarkDirty
 } EngineBuffer;
 
 typedef union {
@@ -89,7 +101,6 @@ typedef union {
 } EngineDataContent;
 
 
-typedef uintptr_t EngineSemaphore;
 typedef uintptr_t EngineCommand;
 typedef enum {
     ENGINE_COMMAND_REUSABLE,
@@ -104,28 +115,166 @@ typedef struct {
     size_t maxSphereCount;
     size_t maxLightSourceCount;
     size_t maxTriangleCount;
+    size_t uploadBytesPerFrame; //upload ring space of every frame besides the camera and spheres, 0 picks 64 KiB
 } EngineObjectLimits;
 
 
+
+typedef struct {
+    const void *pixels; //RGBA8 sRGB, tightly packed rows of width*4 bytes
+    uint32_t width, height;
+    uint64_t frameIndex;
+} EngineFrameData;
+//pixels are only valid until the callback returns
+typedef void (*EngineFrameCallback)(EngineFrameData frame, void *userData);
+
 EngineResult EngineInit(Engine **engine, EngineCI engineCI, uintptr_t *vkInstance);
+//ENGINE_INVALID_ARGUMENT for a null surface, headless engines are set up with EngineFinishSetupHeadless
 EngineResult EngineFinishSetup(Engine *engine, uintptr_t surface, EngineObjectLimits limits);
+//runs without a window; no present-capable queue or swapchain is needed then
+EngineResult EngineFinishSetupHeadless(Engine *engine, EngineObjectLimits limits);
 void EngineDestroy(Engine *engine);
 
 EngineResult EngineSwapchainCreate(Engine *engine, uint32_t frameBufferWidth, uint32_t frameBufferHeight);
 EngineResult EngineSwapchainCreate(Engine *engine, uint32_t frameBufferWidth, uint32_t frameBufferHeight);
 void EngineSwapchainDestroy(Engine *engine);
 
-EngineResult EngineDrawStart(Engine *engine, EngineColor background, EngineSemaphore *signalSemaphore);
-EngineResult EngineDrawEnd(Engine *engine, EngineSemaphore *waitSemaphore);
+//headless counterpart of EngineSwapchainCreate/EngineSwapchainDestroy
+EngineResult EngineHeadlessCreate(Engine *engine, uint32_t width, uint32_t height);
+void EngineHeadlessDestroy(Engine *engine);
+//called from EngineDrawStart once the GPU is done with a frame, or from EngineHeadlessFlush
+void EngineSetFrameCallback(Engine *engine, EngineFrameCallback callback, void *userData);
+//waits for every frame still in flight and hands them to the frame callback in order
+EngineResult EngineHeadlessFlush(Engine *engine);
 
+typedef struct {
+    bool available; //false until a frame with queries has finished
+    uint64_t frameIndex;
+    //GPU milliseconds, -1 when the driver couldn't measure them
+    double clearMs, dispatchMs, blitMs;
+    double frameMs; //from the start of the clear to the end of the blit, gaps between submissions included
+    uint32_t dispatchCount; //EngineRunShader calls of the frame, only the first 8 are timed
+    bool invocationsAvailable; //needs the pipelineStatisticsQuery feature
+    uint64_t computeInvocations;
+} EngineFrameTimings;
+//timings of the newest frame the GPU has finished; the queries are only read once the frame has been waited on, so they never stall
+EngineFrameTimings EngineGetFrameTimings(Engine *engine);
+
+/*
+ * Every submission of a frame (the clear, each EngineSubmitCommand, the blit) waits for the one before it on the frame's timeline
+ * semaphore, so no semaphores have to be passed around; EngineDrawStart waits until the frame that used the same slot is done.
+ * Frames overlap unless they share something (accumulation, temporal history, the wavefront buffer, staged uploads),
+ * then each one also waits for every other frame in flight.
+ */
+EngineResult EngineDrawStart(Engine *engine, EngineColor background);
+EngineResult EngineDrawEnd(Engine *engine);
+
+typedef struct {
+    EngineColor background;
+    bool clear; //false keeps what the render image held, for shaders that write every pixel themselves
+} EngineFrameInfo;
+//true when the graphics queue family also does compute, which EngineFrameBegin needs
+bool EngineSingleSubmitSupported(Engine *engine);
+/*
+ * Alternative to EngineDrawStart, EngineSubmitCommand and EngineDrawEnd that puts the clear, the dispatches and the blit
+ * into one command buffer with a single submission and no waits between them.
+ * Record the dispatches into cmd with EngineRunShader, without EngineCommandRecordingStart/End, then call EngineFrameEnd.
+ */
+EngineResult EngineFrameBegin(Engine *engine, EngineFrameInfo info, EngineCommand *cmd);
+EngineResult EngineFrameEnd(Engine *engine);
+
+/*
+ * Pipelines are built on a thread of their own, so loading shaders, a new workgroup size or a material or sunlight count
+ * that changes their specialisation never waits for the driver. The frames keep dispatching the pipelines from before
+ * until the new ones are all there and get swapped in at the start of a frame. Dispatches before the very first build
+ * is done are skipped, the frame only gets its background.
+ */
 EngineResult EngineLoadShaders(Engine *engine, EngineShaderInfo *shaders, size_t shaderCount);
+//blocks until every requested pipeline is built and swapped in; call it between frames
+EngineResult EngineWaitForPipelines(Engine *engine);
+bool EnginePipelinesPending(Engine *engine);
 EngineResult EngineCreateCommand(Engine *engine, EngineCommand *cmd);
 EngineResult EngineCommandRecordingStart(Engine *engine, EngineCommand cmd, EngineCommandRecordingType type);
 EngineResult EngineCommandRecordingEnd(Engine *engine, EngineCommand cmd);
-EngineResult EngineSubmitCommand(Engine *engine, EngineCommand cmd, EngineSemaphore *waitSemaphore, EngineSemaphore *signalSemaphore);
+EngineResult EngineSubmitCommand(Engine *engine, EngineCommand cmd);
+//frees a command from EngineCreateCommand or EngineCreateAsyncCommand; not for the ones from EngineFrameCommand
 void EngineDestroyCommand(Engine *engine, EngineCommand cmd);
 
+/*
+ * Async compute: commands on a compute-only queue family when the device has one, so e.g. post-processing of a finished
+ * frame can overlap with the next frame's raytrace dispatch. A submission waits for everything submitted to the frames before it,
+ * but the frames don't wait for it, so the app has to keep them from overwriting what it still reads (EngineWaitForAsyncCommand).
+ * Buffers are shared with the async family, the engine's images are not.
+ */
+#define ENGINE_MAX_ASYNC_COMMANDS 16
+//false when async commands run on the compute queue itself
+bool EngineAsyncComputeSupported(Engine *engine);
+//recorded with EngineCommandRecordingStart/End like any other; its dispatches don't show up in EngineGetFrameTimings
+EngineResult EngineCreateAsyncCommand(Engine *engine, EngineCommand *cmd);
+EngineResult EngineSubmitAsyncCommand(Engine *engine, EngineCommand cmd, uint64_t *doneValue);
+bool EngineAsyncCommandFinished(Engine *engine, uint64_t doneValue);
+EngineResult EngineWaitForAsyncCommand(Engine *engine, uint64_t doneValue);
+/*
+ * The current frame's compute command, owned by the engine, to be taken after EngineDrawStart.
+ * Record it (with the same type) only when needsRecording comes back true: ONE_TIME always asks for a new recording,
+ * REUSABLE keeps the last one until the render images are resized, the shaders are reloaded or the frame's descriptor set changes.
+ */
+EngineResult EngineFrameCommand(Engine *engine, EngineCommandRecordingType type, EngineCommand *cmd, bool *needsRecording);
+
+/*
+ * Workgroup size: the local size along x and y every shader is built with, at first the largest square the device allows.
+ * EngineAutotuneWorkgroupSize takes the size stored for this device in the file at path, or else has the next frames
+ * take turns dispatching with 8x8, 16x8, 8x16, 16x16, 32x8, 32x16 and 32x32 (those the device allows, 8 frames each),
+ * then keeps the lowest median dispatch time and stores it in the file. Needs timestamp queries, otherwise nothing changes.
+ * The size can change from one frame to the next while tuning, so dispatches are sized with EngineDispatchGrid every frame.
+ */
+EngineResult EngineAutotuneWorkgroupSize(Engine *engine, const char *path);
+bool EngineWorkgroupTuning(Engine *engine);
+//the size the current frame's dispatches run with
+void EngineGetWorkgroupSize(Engine *engine, uint32_t *sizeX, uint32_t *sizeY);
+//enough groups of that size to cover width x height pixels
+EngineShaderRunInfo EngineDispatchGrid(Engine *engine, uint32_t width, uint32_t height);
+
+/*
+ * Pipeline cache: every pipeline is built through one VkPipelineCache, filled in EngineFinishSetup from a file named after
+ * EngineCI.pipelineCachePath with the vendor, device, driver version and pipelineCacheUUID appended, so every device
+ * and driver keeps a cache of its own.
+ * EngineDestroy writes it back; EngineSavePipelineCache does so right away, e.g. once the variants a job needs are built.
+ */
+EngineResult EngineSavePipelineCache(Engine *engine);
+
 void EngineRunShader(Engine *engine, EngineCommand cmd, size_t index, EngineShaderRunInfo runInfo);
+//largest parameter block a dispatch can push, it follows EngineSceneAddresses in the push constants
+#define ENGINE_SHADER_PARAMS_MAX_SIZE 64
+//like EngineRunShader, but also records params into cmd for this dispatch; a reusable recording keeps them until it is recorded again
+void EngineRunShaderWithParams(Engine *engine, EngineCommand cmd, size_t index, EngineShaderRunInfo runInfo, const void *params, uint32_t paramsSize);
+//the parameters raytrace.comp reads
+typedef struct {
+    uint32_t initialSeed; //bits of a float, like the CPU tracer's
+    uint32_t maxRays;
+} EngineRaytraceParams;
+/*
+ * Specialised variants: EngineRunRaytrace dispatches the shader at index (raytrace.comp) through a pipeline built for exactly
+ * params.maxRays bounces (at most 20), left without the refraction code while no material refracts and without the shadow rays
+ * while they are turned off. A variant is requested the first time a dispatch needs it and kept; until it is built the
+ * dispatch falls back to the shader's own pipeline, which handles any maxRays and scene, and switches over a frame later.
+ */
+void EngineRunRaytrace(Engine *engine, EngineCommand cmd, size_t index, EngineShaderRunInfo runInfo, EngineRaytraceParams params);
+//off lights every hit as if nothing stood between it and the sun, for EngineRunRaytrace only; on by default
+void EngineSetShadowRays(Engine *engine, bool enabled);
+
+/*
+ * Wavefront: raytrace.comp split into generate, extend, shade and shadow kernels that run one bounce at a time and pass
+ * the paths still alive on through queues in the secondary rays buffer (binding 7), so a dispatch never carries
+ * the registers of a whole path or the threads of paths that already ended. Pays off when maxRays is high.
+ * The buffer takes 144 bytes per pixel while the wavefront is loaded.
+ */
+//builds the kernels from the shader at index, which has to be raytrace.comp; until they are built it renders with that shader alone
+EngineResult EngineLoadWavefront(Engine *engine, size_t index);
+bool EngineWavefrontLoaded(Engine *engine);
+//the same image as EngineRunShaderWithParams with raytrace.comp over the whole render image,
+//recorded as (2 + 5 * maxRays) dispatches that are timed as one
+void EngineRunWavefront(Engine *engine, EngineCommand cmd, EngineRaytraceParams params);
 
 //for now they're gone; they will make a comeback in the far future
 // extern inline void EngineGenerateDataTypeInfo(EngineDataTypeInfo *dataTypeInfo);
@@ -144,14 +293,65 @@ typedef struct {
     size_t applyCount;
 } EngineAttachDataInfo;
 #define ENGINE_ATTACH_DATA_ALL_FRAMES 0
-void EngineAttachData(Engine *engine, EngineAttachDataInfo info);
+//writes wait in a fixed size queue until their frame comes up; ENGINE_OUT_OF_MEMORY once it is full
+#define ENGINE_MAX_QUEUED_ATTACHMENTS 256
+EngineResult EngineAttachData(Engine *engine, EngineAttachDataInfo info);
+
+/*
+ * Bindless resources: descriptor set 1 holds an array of storage buffers (binding 0) and one of sampled textures (binding 1)
+ * that every frame shares and the shader indexes directly, e.g. with EngineMaterial.textureIndex.
+ * Adding a resource writes just its slot and is visible to every dispatch recorded afterwards, without touching the frames' sets.
+ * A slot the GPU may still read can't be rewritten, so swapping a resource means adding the new one and removing the old index;
+ * removed slots are handed out again once every frame recorded before the removal is finished.
+ */
+#define ENGINE_BINDLESS_BUFFER_CAPACITY 4096
+#define ENGINE_BINDLESS_TEXTURE_CAPACITY 4096
+//ENGINE_OUT_OF_MEMORY once every slot is taken
+EngineResult EngineBindlessAddBuffer(Engine *engine, EngineBuffer buffer, uint32_t *index);
+//sampled with linear filtering, repeating horizontally; the image has to be in image.layout whenever a frame reads it
+EngineResult EngineBindlessAddTexture(Engine *engine, EngineImage image, uint32_t *index);
+//ENGINE_INVALID_ARGUMENT for an index that was never handed out, ENGINE_OUT_OF_MEMORY when an index is removed twice
+EngineResult EngineBindlessRemoveBuffer(Engine *engine, uint32_t index);
+EngineResult EngineBindlessRemoveTexture(Engine *engine, uint32_t index);
+
+/*
+ * raytrace.comp reads the scene through buffer device addresses in a push constant block instead of descriptors.
+ * The engine fills in the spheres, materials and camera it creates, and takes transformations from
+ * EngineAttachData on binding 2. Setting other addresses switches scenes for every following EngineRunShader
+ * without touching any descriptor; the buffers have to stay alive until the frames that used them are finished.
+ */
+typedef struct {
+    uint64_t spheres, materials, transformations, camera;
+} EngineSceneAddresses;
+EngineSceneAddresses EngineGetSceneAddresses(Engine *engine);
+//from then on the dispatches read exactly these buffers, the camera, spheres and transformations aren't copied into the upload ring
+void EngineSetSceneAddresses(Engine *engine, EngineSceneAddresses addresses);
+
+/*
+ * Upload ring: one persistently mapped buffer split into a region per frame in flight, handed out linearly and reset once
+ * the GPU is done with that frame, so data written for one frame never aliases what another frame is still reading.
+ * At the frame's first submission the engine copies the camera, spheres and transformations the app wrote into its region
+ * and the frame's dispatches read those copies, so the app can keep writing them while earlier frames are in flight.
+ */
+//memory for the frame being recorded; write it before the frame's first submission, it is reused when the frame comes around again.
+//alignment has to be a power of two (0 means none), ENGINE_INVALID_ARGUMENT otherwise; ENGINE_OUT_OF_MEMORY once the frame's region is used up
+EngineResult EngineUploadAlloc(Engine *engine, size_t byteSize, size_t alignment, void **data, uint64_t *deviceAddress);
 
-EngineResult EngineCreateSemaphore(Engine *engine, EngineSemaphore *semaphore);
-void EngineDestroySemaphore(Engine *engine, EngineSemaphore semaphore);
 uint32_t EngineGetFrame(Engine *engine);
+//increases by one every frame; the frame being recorded has the current one
+uint64_t EngineGetFrameIndex(Engine *engine);
+//whether the GPU is done with an earlier frame and every one before it, without blocking
+bool EngineFrameFinished(Engine *engine, uint64_t frameIndex);
+//blocks until the GPU is done with an earlier frame and every one before it, e.g. before reusing memory it read
+EngineResult EngineWaitForFrame(Engine *engine, uint64_t frameIndex);
 
 EngineResult EngineCreateBuffer(Engine *engine, EngineBuffer *engineBuffer, EngineDataType type);
 void EngineBufferAccessUpdate(Engine *engine, EngineBuffer *buffer, bool setAccessVal);
+//bytes of a staged buffer's host copy that changed; they are copied over before the next frame's first submission reads it.
+//does nothing for other buffers
+void EngineBufferMarkDirty(Engine *engine, EngineBuffer buffer, size_t byteOffset, size_t byteSize);
+//doesn't wait for the GPU: the buffer is freed at the start of a later frame, once the frame being recorded,
+//the ones before it and the async commands submitted so far are done
 void EngineDestroyBuffer(Engine *engine, EngineBuffer buffer);
 
 EngineResult EngineCreateImage(Engine *engine, EngineImage *engineImage);
@@ -189,6 +389,11 @@ typedef struct {
 EngineResult EngineCreateSphere(Engine *engine, EngineSphere **sphereArr, size_t *count, size_t *ID);
 void EngineDestroySphere(Engine *engine, EngineSphere *sphereInstance);
 void EngineDestroySphereBuffer(Engine *engine);
+//call after moving, resizing or activating a sphere through its pointer; EngineDrawStart then refits the BVH the shader
+//traces spheres through around it, or rebuilds it when the sphere is not in it yet or refitting has made it too slow
+void EngineMarkSphereDirty(Engine *engine, size_t index);
+//rebuilds that BVH from the whole sphere buffer right away
+EngineResult EngineBuildSphereBVH(Engine *engine);
 
 void EngineLoadMaterials(Engine *engine, EngineMaterial *material, size_t materialCount);
 //if indices == NULL, then it starts from 0 and goes to count-1
@@ -211,4 +416,16 @@ typedef struct {
 } EngineCamera;
 
 void EngineCreateCamera(Engine *engine, EngineCamera **camera);
-void EngineDestroyCamera(Engine *engine);
\ No newline at end of file
+void EngineDestroyCamera(Engine *engine);
+
+//averages every frame into a float image instead of showing just that frame's sample, so a still view converges.
+//Starts over by itself when the camera changes, spheres are marked dirty, created or destroyed, or materials or sunlight are written;
+//anything else the shader reads (like your own buffers) needs EngineResetAccumulation
+void EngineSetAccumulation(Engine *engine, bool enabled);
+void EngineResetAccumulation(Engine *engine);
+//samples in the image once the last submitted frame is done, 0 while accumulation is off
+uint32_t EngineGetAccumulatedSamples(Engine *engine);
+//while the camera moves, blends each pixel's sample with the colour the previous frame showed at the same point in the scene,
+//unless the distance or normal found there don't match; newSampleWeight is the new sample's share, 0.1-0.3 works well.
+//Until the camera stops, accumulation uses this instead
+void EngineSetTemporalReprojection(Engine *engine, bool enabled, float newSampleWeight);
\ No newline at end of file
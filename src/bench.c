@@ -0,0 +1,730 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <Engine.h>
+#include <CpuTracer.h>
+#include <trace.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Renders a fixed set of scenes headlessly along a fixed camera path and prints the frame times as JSON.
+ * Runs on any Vulkan 1.3 device including software drivers, or with --backend cpu on the CPU tracer.
+ */
+
+#define MAX_SCENE_SPHERES 32768
+#define MAX_SCENE_MATERIALS 8
+#define BENCH_SCENE_COUNT 9
+#define ARR_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
+
+typedef struct {
+	char name[64];
+	EngineSphere spheres[MAX_SCENE_SPHERES];
+	size_t sphereCount;
+	EngineMaterial materials[MAX_SCENE_MATERIALS];
+	size_t materialCount;
+	EngineSunlight sunlight;
+	uint32_t maxRays;
+	bool gpuOnly; //far too slow for the CPU tracer, which tests every sphere
+	uint32_t movingSpheres; //moved every frame, spread evenly over the scene
+} BenchScene;
+
+typedef struct {
+	uint32_t width, height;
+	uint32_t warmupFrames, measuredFrames;
+	bool cpu;
+	uint32_t threads;
+	const char *sceneFilter;
+	const char *shaderPath;
+	const char *outputPath;
+	const char *tracePath;
+	float temporalWeight; //0 leaves temporal reprojection off
+	bool splitSubmit; //clear, dispatch and blit as three submissions instead of EngineFrameBegin/EngineFrameEnd
+	uint32_t framesInFlight; //0 leaves it to the engine
+	bool stagedScene; //spheres and materials in device local memory
+	bool wavefront; //EngineRunWavefront instead of the single raytrace dispatch
+	bool variants; //EngineRunRaytrace instead of the shader's own pipeline
+	const char *workgroupPath; //EngineAutotuneWorkgroupSize file, NULL keeps the default size
+	const char *pipelineCachePath; //EngineCI.pipelineCachePath
+} BenchOptions;
+
+typedef struct {
+	double min, median, p99;
+} BenchStats;
+
+typedef struct {
+	double *frameMs; //wall clock time of every measured frame
+	//GPU timings of the measured frames the engine reported
+	double *gpuFrameMs, *gpuDispatchMs;
+	size_t gpuCount;
+	bool invocationsAvailable;
+	uint64_t computeInvocations;
+	int64_t lastTimedFrame;
+	double startupMs; //GPU only: from EngineInit until the first frame was submitted, negative when not measured
+} BenchSamples;
+
+static double nowMs() {
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (double)counter.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+#endif
+}
+
+static int compareDoubles(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+//nearest-rank percentiles
+static BenchStats computeStats(double *samples, size_t count) {
+	qsort(samples, count, sizeof(double), compareDoubles);
+	size_t medianRank = (size_t)ceil(0.5 * count);
+	size_t p99Rank = (size_t)ceil(0.99 * count);
+	return (BenchStats){
+		.min = samples[0],
+		.median = samples[medianRank > 0 ? medianRank - 1 : 0],
+		.p99 = samples[p99Rank > 0 ? p99Rank - 1 : 0],
+	};
+}
+
+//the camera path only depends on the frame number, so every run sees the same frames
+static EngineCamera cameraAt(uint32_t frame) {
+	float angle = 0.01f * frame;
+	return (EngineCamera){
+		.origin = {0.25f * sinf(angle), 0, 0.25f * (1 - cosf(angle))},
+		.direction = {sinf(0.5f * angle), 0, cosf(0.5f * angle)},
+	};
+}
+
+//what the shader reads as initialSeed, written as a float like main.c does
+static float seedAt(uint32_t frame) {
+	return (float)(frame + 1) * 1000;
+}
+
+static EngineSphere makeSphere(float x, float y, float z, float radius, uint32_t materialID) {
+	return (EngineSphere){
+		.materialID = materialID,
+		.radius = radius,
+		.transformation = {
+			.translation = {x, y, z},
+			.rotation = {0,0,0},
+			.scale = {0,0,0}
+		},
+		.flags = ENGINE_ISACTIVE_FLAG | ENGINE_EXISTS_FLAG
+	};
+}
+
+static void setDefaultMaterials(BenchScene *scene) {
+	EngineMaterial materials[] = {
+		{.color = {1,0,0,0}, .metallic = 0, .roughness = 1, .refraction = 0},
+		{.color = {0,1,0,0}, .metallic = 0, .roughness = 0, .refraction = 1.57},
+		{.color = {1,1,1,0}, .metallic = 0, .roughness = 0, .refraction = 1},
+		{.color = {0,0,1,0}, .metallic = 1, .roughness = 0, .refraction = 0},
+		{.color = {1,1,0,2}, .metallic = 0, .roughness = 1, .refraction = 0},
+	};
+	memcpy(scene->materials, materials, sizeof(materials));
+	scene->materialCount = ARR_SIZE(materials);
+	scene->sunlight = (EngineSunlight){
+		.color = {1,1,1,1},
+		.lightData = {-1,-1,0,0.7},
+	};
+}
+
+//the scene main.c shows
+static void buildFewSpheres(BenchScene *scene, uint32_t maxRays) {
+	setDefaultMaterials(scene);
+	EngineSphere spheres[] = {
+		makeSphere(-1, -0.5, 3, 0.5, 0),
+		makeSphere(0, -0.4, 2.5, 0.5, 1),
+		makeSphere(0, -0.4, 2.5, 0.3, 2),
+		makeSphere(2, -0.4, 2.5, 0.5, 1),
+		makeSphere(2, 0.25, 5, 0.75, 3),
+		makeSphere(2, 0.25, 5, 0.25, 0),
+		makeSphere(0, 0, -20, 20, 4),
+	};
+	memcpy(scene->spheres, spheres, sizeof(spheres));
+	scene->sphereCount = ARR_SIZE(spheres);
+	scene->maxRays = maxRays;
+	if(maxRays == 6) {
+		snprintf(scene->name, sizeof(scene->name), "few_spheres");
+	} else {
+		snprintf(scene->name, sizeof(scene->name), "few_spheres_rays_%u", maxRays);
+	}
+}
+
+//10x10x10 grid in front of the camera, cycling through all materials
+static void buildThousandSpheres(BenchScene *scene) {
+	setDefaultMaterials(scene);
+	scene->sphereCount = 0;
+	for(uint32_t z = 0; z < 10; z++) {
+		for(uint32_t y = 0; y < 10; y++) {
+			for(uint32_t x = 0; x < 10; x++) {
+				scene->spheres[scene->sphereCount] = makeSphere(
+					-2.25f + 0.5f * x, -0.75f + 0.25f * y, 3 + 0.5f * z, 0.12f,
+					(x + y + z) % 4
+				);
+				scene->sphereCount++;
+			}
+		}
+	}
+	scene->maxRays = 6;
+	snprintf(scene->name, sizeof(scene->name), "1k_spheres");
+}
+
+//rows of glass spheres with smaller glass spheres inside, so most paths keep refracting until maxRays
+static void buildHeavyRefraction(BenchScene *scene) {
+	setDefaultMaterials(scene);
+	scene->materials[5] = (EngineMaterial){.color = {1,1,1,0}, .metallic = 0, .roughness = 0, .refraction = 1.5};
+	scene->materials[6] = (EngineMaterial){.color = {0.8,0.9,1,0}, .metallic = 0, .roughness = 0, .refraction = 1.33};
+	scene->materialCount = 7;
+	scene->sphereCount = 0;
+	for(uint32_t z = 0; z < 4; z++) {
+		for(uint32_t x = 0; x < 6; x++) {
+			float px = -1.5f + 0.6f * x + 0.3f * (z % 2);
+			float pz = 2 + 0.7f * z;
+			scene->spheres[scene->sphereCount++] = makeSphere(px, -0.5f, pz, 0.28f, 5);
+			scene->spheres[scene->sphereCount++] = makeSphere(px, -0.5f, pz, 0.15f, 6);
+		}
+	}
+	scene->spheres[scene->sphereCount++] = makeSphere(0, 0, -20, 20, 4);
+	scene->maxRays = 20;
+	snprintf(scene->name, sizeof(scene->name), "heavy_refraction");
+}
+
+//32x32x32 grid of small spheres filling the view, only fast enough with the BVH
+static void buildManySpheres(BenchScene *scene, uint32_t movingSpheres) {
+	setDefaultMaterials(scene);
+	scene->sphereCount = 0;
+	for(uint32_t z = 0; z < 32; z++) {
+		for(uint32_t y = 0; y < 32; y++) {
+			for(uint32_t x = 0; x < 32; x++) {
+				scene->spheres[scene->sphereCount] = makeSphere(
+					-4 + 0.25f * x, -0.9f + 0.1f * y, 2 + 0.25f * z, 0.04f,
+					(x + y + z) % 4
+				);
+				scene->sphereCount++;
+			}
+		}
+	}
+	scene->maxRays = 6;
+	scene->gpuOnly = true;
+	scene->movingSpheres = movingSpheres;
+	if(movingSpheres > 0) {
+		snprintf(scene->name, sizeof(scene->name), "32k_spheres_moving_%u", movingSpheres);
+	} else {
+		snprintf(scene->name, sizeof(scene->name), "32k_spheres");
+	}
+}
+
+static size_t buildScenes(BenchScene *scenes) {
+	size_t count = 0;
+	for(size_t i = 0; i < BENCH_SCENE_COUNT; i++) {
+		scenes[i].gpuOnly = false;
+		scenes[i].movingSpheres = 0;
+	}
+	buildFewSpheres(&scenes[count++], 6);
+	buildThousandSpheres(&scenes[count++]);
+	buildManySpheres(&scenes[count++], 0);
+	buildManySpheres(&scenes[count++], 256);
+	buildHeavyRefraction(&scenes[count++]);
+	const uint32_t rayCounts[] = {8, 12, 16, 20};
+	for(size_t i = 0; i < ARR_SIZE(rayCounts); i++) {
+		buildFewSpheres(&scenes[count++], rayCounts[i]);
+	}
+	return count;
+}
+
+static char *readFile(const char *path, size_t *size) {
+	FILE *file = fopen(path, "rb");
+	if(file == NULL) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char *data = malloc(*size);
+	if(data != NULL && fread(data, 1, *size, file) != *size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	return data;
+}
+
+#define BENCH_CHECK(call) \
+	do { \
+		EngineResult checkRes = (call); \
+		if(checkRes.EngineCode != ENGINE_SUCCESS) { \
+			fprintf(stderr, "%s failed: engine code %d, vulkan code %zu\n", #call, checkRes.EngineCode, checkRes.VulkanCode); \
+			return false; \
+		} \
+	} while(0)
+
+//picks up the timings of the newest finished frame if it is a measured one that hasn't been seen yet
+static void recordGpuTimings(Engine *engine, const BenchOptions *options, BenchSamples *samples) {
+	EngineFrameTimings timings = EngineGetFrameTimings(engine);
+	if(!timings.available || timings.frameIndex < options->warmupFrames || (int64_t)timings.frameIndex <= samples->lastTimedFrame) {
+		return;
+	}
+	samples->lastTimedFrame = timings.frameIndex;
+	if(timings.frameMs >= 0 && timings.dispatchMs >= 0) {
+		samples->gpuFrameMs[samples->gpuCount] = timings.frameMs;
+		samples->gpuDispatchMs[samples->gpuCount] = timings.dispatchMs;
+		samples->gpuCount++;
+	}
+	if(timings.invocationsAvailable) {
+		samples->invocationsAvailable = true;
+		samples->computeInvocations = timings.computeInvocations;
+	}
+}
+
+static void runRaytrace(Engine *engine, const BenchOptions *options, EngineCommand cmd, EngineRaytraceParams params) {
+	//the workgroup size changes every frame while it is tuned
+	EngineShaderRunInfo runInfo = EngineDispatchGrid(engine, options->width, options->height);
+	if(options->wavefront) {
+		EngineRunWavefront(engine, cmd, params);
+	} else if(options->variants) {
+		EngineRunRaytrace(engine, cmd, 0, runInfo, params);
+	} else {
+		EngineRunShaderWithParams(engine, cmd, 0, runInfo, &params, sizeof(params));
+	}
+}
+
+static bool runGpuScene(const BenchScene *scene, const BenchOptions *options, EngineShaderInfo shaderInfo, BenchSamples *samples) {
+	Engine *engine = NULL;
+	uintptr_t vkInstance = 0;
+	double startupStart = nowMs();
+	EngineCI engineCI = {
+		.appName = "vulkanrun_bench",
+		.displayName = "vulkanrun_bench",
+		.appVersion = 1,
+		.extensionsCount = 0,
+		.extensions = NULL,
+		.framesInFlight = options->framesInFlight,
+		.stagedScene = options->stagedScene,
+		.pipelineCachePath = options->pipelineCachePath,
+	};
+	BENCH_CHECK(EngineInit(&engine, engineCI, &vkInstance));
+	const EngineObjectLimits limits = {
+		.maxSphereCount = scene->sphereCount,
+		.maxLightSourceCount = 1,
+	};
+	BENCH_CHECK(EngineFinishSetupHeadless(engine, limits));
+	BENCH_CHECK(EngineHeadlessCreate(engine, options->width, options->height));
+
+	EngineBuffer VSMatrices = {
+		.elementByteSize = sizeof(EngineTransformation),
+		.length = 2,
+		.isAccessible = true
+	};
+	BENCH_CHECK(EngineCreateBuffer(engine, &VSMatrices, ENGINE_BUFFER_STORAGE));
+	EngineTransformation matrices[2] = {{
+		.translation = {(float)options->width/2, (float)options->height/2, 0},
+		.scale = {(float)options->height/2, -(float)options->height/2, 1},
+		.rotation = {0,0,0}
+	}, EngineCpuScreenTransform(options->width, options->height)};
+	memcpy(VSMatrices.data, matrices, sizeof(matrices));
+	BENCH_CHECK(EngineAttachData(engine, (EngineAttachDataInfo){
+		.applyCount = ENGINE_ATTACH_DATA_ALL_FRAMES,
+		.binding = 2,
+		.content = {.buffer = VSMatrices},
+		.type = ENGINE_BUFFER_STORAGE
+	}));
+
+	EngineLoadMaterials(engine, (EngineMaterial*)scene->materials, scene->materialCount);
+	EngineSphere **sphereArr = calloc(scene->sphereCount, sizeof(EngineSphere*));
+	size_t sphereCount = 0, ID = 0;
+	for(size_t i = 0; i < scene->sphereCount; i++) {
+		BENCH_CHECK(EngineCreateSphere(engine, sphereArr, &sphereCount, &ID));
+		*sphereArr[ID] = scene->spheres[i];
+	}
+	EngineLoadSunlight(engine, scene->sunlight);
+
+	EngineCamera *camHandle = NULL;
+	EngineCreateCamera(engine, &camHandle);
+	if(options->temporalWeight > 0) {
+		EngineSetTemporalReprojection(engine, true, options->temporalWeight);
+	}
+	BENCH_CHECK(EngineLoadShaders(engine, &shaderInfo, 1));
+	if(options->wavefront) {
+		BENCH_CHECK(EngineLoadWavefront(engine, 0));
+	}
+	if(options->workgroupPath != NULL) {
+		BENCH_CHECK(EngineAutotuneWorkgroupSize(engine, options->workgroupPath));
+	}
+	BENCH_CHECK(EngineWaitForPipelines(engine));
+
+	EngineColor background = {0.1, 0.5, 0.9, 1};
+	bool singleSubmit = !options->splitSubmit && EngineSingleSubmitSupported(engine);
+	if(!options->splitSubmit && !singleSubmit) {
+		fprintf(stderr, "%s: the device can't do a frame in one submission, measuring three\n", scene->name);
+	}
+	uint32_t totalFrames = options->warmupFrames + options->measuredFrames;
+	for(uint32_t i = 0; i < totalFrames; i++) {
+		if(i == options->warmupFrames && EngineWorkgroupTuning(engine)) {
+			fprintf(stderr, "%s: still tuning the workgroup size after the warmup, raise --warmup\n", scene->name);
+		}
+		//the variants the warmup asked for, and the pipelines of a tuned size
+		if(i == options->warmupFrames) {
+			BENCH_CHECK(EngineWaitForPipelines(engine));
+		}
+		double start = nowMs();
+		for(uint32_t j = 0; j < scene->movingSpheres; j++) {
+			size_t index = j * (scene->sphereCount / scene->movingSpheres);
+			sphereArr[index]->transformation.translation[1] = scene->spheres[index].transformation.translation[1] + 0.1f * sinf(0.2f * i + j);
+			EngineMarkSphereDirty(engine, index);
+		}
+		EngineCommand cmd = 0;
+		if(singleSubmit) {
+			EngineFrameInfo frameInfo = {
+				.background = {background[0], background[1], background[2], background[3]},
+				.clear = true
+			};
+			BENCH_CHECK(EngineFrameBegin(engine, frameInfo, &cmd));
+		} else {
+			BENCH_CHECK(EngineDrawStart(engine, background));
+		}
+		recordGpuTimings(engine, options, samples);
+		*camHandle = cameraAt(i);
+		float seed = seedAt(i);
+		EngineRaytraceParams params = {.maxRays = scene->maxRays};
+		memcpy(&params.initialSeed, &seed, sizeof(uint32_t));
+
+		if(singleSubmit) {
+			runRaytrace(engine, options, cmd, params);
+			BENCH_CHECK(EngineFrameEnd(engine));
+			if(i == 0) {
+				samples->startupMs = nowMs() - startupStart;
+			}
+			if(i >= options->warmupFrames) {
+				samples->frameMs[i - options->warmupFrames] = nowMs() - start;
+			}
+			continue;
+		}
+		//the seed changes every frame, so the dispatch is recorded every frame
+		bool needsRecording = false;
+		BENCH_CHECK(EngineFrameCommand(engine, ENGINE_COMMAND_ONE_TIME, &cmd, &needsRecording));
+		BENCH_CHECK(EngineCommandRecordingStart(engine, cmd, ENGINE_COMMAND_ONE_TIME));
+		runRaytrace(engine, options, cmd, params);
+		BENCH_CHECK(EngineCommandRecordingEnd(engine, cmd));
+		BENCH_CHECK(EngineSubmitCommand(engine, cmd));
+		BENCH_CHECK(EngineDrawEnd(engine));
+		if(i == 0) {
+			samples->startupMs = nowMs() - startupStart;
+		}
+		if(i >= options->warmupFrames) {
+			samples->frameMs[i - options->warmupFrames] = nowMs() - start;
+		}
+	}
+	BENCH_CHECK(EngineHeadlessFlush(engine));
+	recordGpuTimings(engine, options, samples);
+
+	free(sphereArr);
+	EngineDestroyCamera(engine);
+	EngineDestroySphereBuffer(engine);
+	EngineUnloadMaterials(engine);
+	EngineUnloadSunlight(engine);
+	EngineDestroyBuffer(engine, VSMatrices);
+	EngineHeadlessDestroy(engine);
+	EngineDestroy(engine);
+	return true;
+}
+
+static bool runCpuScene(const BenchScene *scene, const BenchOptions *options, EngineCpuTracer *tracer, BenchSamples *samples) {
+	float *pixels = malloc(sizeof(float) * 4 * options->width * options->height);
+	if(pixels == NULL) {
+		fprintf(stderr, "could not allocate the image\n");
+		return false;
+	}
+	EngineCpuScene cpuScene = {
+		.spheres = scene->spheres,
+		.sphereCount = scene->sphereCount,
+		.materials = scene->materials,
+		.materialCount = scene->materialCount,
+		.sunlight = scene->sunlight,
+		.screenToViewport = EngineCpuScreenTransform(options->width, options->height),
+	};
+	uint32_t totalFrames = options->warmupFrames + options->measuredFrames;
+	for(uint32_t i = 0; i < totalFrames; i++) {
+		double start = nowMs();
+		float seed = seedAt(i);
+		EngineCpuFrameInfo frame = {
+			.width = options->width,
+			.height = options->height,
+			.maxRays = scene->maxRays,
+			.background = {0.1, 0.5, 0.9, 1},
+			.pixels = pixels,
+		};
+		memcpy(&frame.initialSeed, &seed, sizeof(uint32_t));
+		cpuScene.camera = cameraAt(i);
+		EngineResult result = EngineCpuRender(tracer, &cpuScene, frame);
+		if(result.EngineCode != ENGINE_SUCCESS) {
+			fprintf(stderr, "EngineCpuRender failed: engine code %d\n", result.EngineCode);
+			free(pixels);
+			return false;
+		}
+		if(i >= options->warmupFrames) {
+			samples->frameMs[i - options->warmupFrames] = nowMs() - start;
+		}
+	}
+	free(pixels);
+	return true;
+}
+
+static void printUsage(const char *program) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --width <px> --height <px>   render size (640x480)\n"
+		"  --warmup <n>                 frames rendered before measuring (10)\n"
+		"  --frames <n>                 measured frames (100)\n"
+		"  --backend <gpu|cpu>          renderer to measure (gpu)\n"
+		"  --threads <n>                CPU tracer threads, 0 for all hardware threads (0)\n"
+		"  --scene <name>               only run this scene\n"
+		"  --shader <path>              compiled raytrace shader\n"
+		"  --output <path>              write the JSON here instead of stdout\n"
+		"  --trace <path>               write a Chrome trace of the CPU and GPU timelines here\n"
+		"  --temporal <weight>          GPU only: reproject the previous frame and give the new sample this weight (off)\n"
+		"  --submit <single|split>      GPU only: one submission per frame, or separate clear, dispatch and blit (single)\n"
+		"  --frames-in-flight <n>       GPU only: frames the CPU may run ahead of the GPU, 1 to 4 (2)\n"
+		"  --scene-memory <host|device> GPU only: where the spheres and materials live, device copies them over when they change (host)\n"
+		"  --kernel <mega|wavefront>    GPU only: one dispatch per frame, or a generate/extend/shade/shadow dispatch per bounce (mega)\n"
+		"  --variants <on|off>          GPU only: dispatch a pipeline specialised for the scene's maxRays and materials (on)\n"
+		"  --autotune <path>            GPU only: workgroup size stored for the device in this file, tuned during warmup if it isn't there\n"
+		"  --pipeline-cache <path>      GPU only: keep the compiled pipelines in a file per device named after this path (no file)\n",
+		program);
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions *options) {
+	for(int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if(i + 1 >= argc) {
+			return false;
+		}
+		const char *value = argv[++i];
+		if(strcmp(arg, "--width") == 0) {
+			options->width = strtoul(value, NULL, 10);
+		} else if(strcmp(arg, "--height") == 0) {
+			options->height = strtoul(value, NULL, 10);
+		} else if(strcmp(arg, "--warmup") == 0) {
+			options->warmupFrames = strtoul(value, NULL, 10);
+		} else if(strcmp(arg, "--frames") == 0) {
+			options->measuredFrames = strtoul(value, NULL, 10);
+		} else if(strcmp(arg, "--backend") == 0) {
+			if(strcmp(value, "cpu") != 0 && strcmp(value, "gpu") != 0) {
+				return false;
+			}
+			options->cpu = strcmp(value, "cpu") == 0;
+		} else if(strcmp(arg, "--threads") == 0) {
+			options->threads = strtoul(value, NULL, 10);
+		} else if(strcmp(arg, "--scene") == 0) {
+			options->sceneFilter = value;
+		} else if(strcmp(arg, "--shader") == 0) {
+			options->shaderPath = value;
+		} else if(strcmp(arg, "--output") == 0) {
+			options->outputPath = value;
+		} else if(strcmp(arg, "--trace") == 0) {
+			options->tracePath = value;
+		} else if(strcmp(arg, "--temporal") == 0) {
+			options->temporalWeight = strtof(value, NULL);
+		} else if(strcmp(arg, "--submit") == 0) {
+			if(strcmp(value, "single") != 0 && strcmp(value, "split") != 0) {
+				return false;
+			}
+			options->splitSubmit = strcmp(value, "split") == 0;
+		} else if(strcmp(arg, "--frames-in-flight") == 0) {
+			options->framesInFlight = strtoul(value, NULL, 10);
+			if(options->framesInFlight < 1 || options->framesInFlight > ENGINE_MAX_FRAMES_IN_FLIGHT) {
+				return false;
+			}
+		} else if(strcmp(arg, "--scene-memory") == 0) {
+			if(strcmp(value, "host") != 0 && strcmp(value, "device") != 0) {
+				return false;
+			}
+			options->stagedScene = strcmp(value, "device") == 0;
+		} else if(strcmp(arg, "--kernel") == 0) {
+			if(strcmp(value, "mega") != 0 && strcmp(value, "wavefront") != 0) {
+				return false;
+			}
+			options->wavefront = strcmp(value, "wavefront") == 0;
+		} else if(strcmp(arg, "--autotune") == 0) {
+			options->workgroupPath = value;
+		} else if(strcmp(arg, "--pipeline-cache") == 0) {
+			options->pipelineCachePath = value;
+		} else if(strcmp(arg, "--variants") == 0) {
+			if(strcmp(value, "on") != 0 && strcmp(value, "off") != 0) {
+				return false;
+			}
+			options->variants = strcmp(value, "on") == 0;
+		} else {
+			return false;
+		}
+	}
+	return options->width > 0 && options->height > 0 && options->measuredFrames > 0;
+}
+
+int main(int argc, char **argv) {
+	BenchOptions options = {
+		.width = 640,
+		.height = 480,
+		.warmupFrames = 10,
+		.measuredFrames = 100,
+		.cpu = false,
+		.threads = 0,
+		.sceneFilter = NULL,
+		.shaderPath = RAYTRACE_SPV_PATH,
+		.outputPath = NULL,
+		.tracePath = NULL,
+		.temporalWeight = 0,
+		.splitSubmit = false,
+		.framesInFlight = 2,
+		.stagedScene = false,
+		.wavefront = false,
+		.variants = true,
+		.workgroupPath = NULL,
+		.pipelineCachePath = NULL,
+	};
+	if(!parseOptions(argc, argv, &options)) {
+		printUsage(argv[0]);
+		return 2;
+	}
+	EngineTraceEnable(options.tracePath != NULL);
+	EngineTraceSetThreadName("main");
+
+	BenchScene *scenes = malloc(sizeof(BenchScene) * BENCH_SCENE_COUNT);
+	BenchSamples samples = {
+		.frameMs = malloc(sizeof(double) * options.measuredFrames),
+		.gpuFrameMs = malloc(sizeof(double) * options.measuredFrames),
+		.gpuDispatchMs = malloc(sizeof(double) * options.measuredFrames),
+	};
+	if(scenes == NULL || samples.frameMs == NULL || samples.gpuFrameMs == NULL || samples.gpuDispatchMs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	size_t sceneCount = buildScenes(scenes);
+
+	EngineShaderInfo shaderInfo = {0};
+	EngineCpuTracer *tracer = NULL;
+	if(options.cpu) {
+		EngineResult result = EngineCpuTracerCreate(&tracer, (EngineCpuTracerCI){.threadCount = options.threads});
+		if(result.EngineCode != ENGINE_SUCCESS) {
+			fprintf(stderr, "could not create the CPU tracer: engine code %d\n", result.EngineCode);
+			return 1;
+		}
+	} else {
+		shaderInfo.code = readFile(options.shaderPath, &shaderInfo.byteSize);
+		if(shaderInfo.code == NULL) {
+			fprintf(stderr, "could not read %s\n", options.shaderPath);
+			return 1;
+		}
+	}
+
+	FILE *output = stdout;
+	if(options.outputPath != NULL) {
+		output = fopen(options.outputPath, "w");
+		if(output == NULL) {
+			fprintf(stderr, "could not open %s\n", options.outputPath);
+			return 1;
+		}
+	}
+
+	int exitCode = 0;
+	bool firstScene = true;
+	fprintf(output, "{\n");
+	fprintf(output, "  \"backend\": \"%s\",\n", options.cpu ? "cpu" : "gpu");
+	fprintf(output, "  \"width\": %u,\n  \"height\": %u,\n", options.width, options.height);
+	fprintf(output, "  \"temporal_weight\": %g,\n", options.temporalWeight);
+	fprintf(output, "  \"submit\": \"%s\",\n", options.splitSubmit ? "split" : "single");
+	fprintf(output, "  \"frames_in_flight\": %u,\n", options.framesInFlight);
+	fprintf(output, "  \"scene_memory\": \"%s\",\n", options.stagedScene ? "device" : "host");
+	fprintf(output, "  \"kernel\": \"%s\",\n", options.wavefront ? "wavefront" : "mega");
+	fprintf(output, "  \"variants\": %s,\n", options.variants ? "true" : "false");
+	fprintf(output, "  \"pipeline_cache\": %s,\n", options.pipelineCachePath != NULL ? "true" : "false");
+	fprintf(output, "  \"warmup_frames\": %u,\n  \"measured_frames\": %u,\n", options.warmupFrames, options.measuredFrames);
+	if(options.cpu) {
+		fprintf(output, "  \"cpu_packet_width\": %u,\n", EngineCpuPacketWidth());
+	}
+	fprintf(output, "  \"scenes\": [");
+	for(size_t i = 0; i < sceneCount; i++) {
+		const BenchScene *scene = &scenes[i];
+		if(options.sceneFilter != NULL && strcmp(options.sceneFilter, scene->name) != 0) {
+			continue;
+		}
+		if(options.cpu && scene->gpuOnly) {
+			fprintf(stderr, "skipping %s on the CPU\n", scene->name);
+			continue;
+		}
+		fprintf(stderr, "running %s\n", scene->name);
+		samples.gpuCount = 0;
+		samples.invocationsAvailable = false;
+		samples.lastTimedFrame = -1;
+		samples.startupMs = -1;
+		bool success = options.cpu
+			? runCpuScene(scene, &options, tracer, &samples)
+			: runGpuScene(scene, &options, shaderInfo, &samples);
+		if(!success) {
+			fprintf(stderr, "%s failed\n", scene->name);
+			exitCode = 1;
+			continue;
+		}
+		BenchStats stats = computeStats(samples.frameMs, options.measuredFrames);
+		fprintf(output, "%s\n    {\n", firstScene ? "" : ",");
+		fprintf(output, "      \"name\": \"%s\",\n", scene->name);
+		fprintf(output, "      \"spheres\": %zu,\n", scene->sphereCount);
+		fprintf(output, "      \"max_rays\": %u,\n", scene->maxRays);
+		if(samples.startupMs >= 0) {
+			fprintf(output, "      \"startup_ms\": %.4f,\n", samples.startupMs);
+		} else {
+			fprintf(output, "      \"startup_ms\": null,\n");
+		}
+		fprintf(output, "      \"frame_ms\": {\"min\": %.4f, \"median\": %.4f, \"p99\": %.4f},\n", stats.min, stats.median, stats.p99);
+		if(samples.gpuCount > 0) {
+			BenchStats gpuStats = computeStats(samples.gpuFrameMs, samples.gpuCount);
+			BenchStats dispatchStats = computeStats(samples.gpuDispatchMs, samples.gpuCount);
+			fprintf(output, "      \"gpu_ms\": {\"min\": %.4f, \"median\": %.4f, \"p99\": %.4f, \"samples\": %zu},\n", gpuStats.min, gpuStats.median, gpuStats.p99, samples.gpuCount);
+			fprintf(output, "      \"dispatch_ms\": {\"min\": %.4f, \"median\": %.4f, \"p99\": %.4f},\n", dispatchStats.min, dispatchStats.median, dispatchStats.p99);
+		} else {
+			fprintf(output, "      \"gpu_ms\": null,\n");
+			fprintf(output, "      \"dispatch_ms\": null,\n");
+		}
+		if(samples.invocationsAvailable) {
+			fprintf(output, "      \"compute_invocations\": %llu\n", (unsigned long long)samples.computeInvocations);
+		} else {
+			fprintf(output, "      \"compute_invocations\": null\n");
+		}
+		fprintf(output, "    }");
+		firstScene = false;
+	}
+	fprintf(output, "\n  ]\n}\n");
+
+	if(output != stdout) {
+		fclose(output);
+	}
+	if(options.tracePath != NULL && !EngineTraceDump(options.tracePath)) {
+		fprintf(stderr, "could not write %s\n", options.tracePath);
+		exitCode = 1;
+	}
+	if(tracer != NULL) {
+		EngineCpuTracerDestroy(tracer);
+	}
+	free(shaderInfo.code);
+	free(samples.frameMs);
+	free(samples.gpuFrameMs);
+	free(samples.gpuDispatchMs);
+	free(scenes);
+	return exitCode;
+}
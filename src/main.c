@@ -1,4 +1,5 @@
 #include <Engine.h>
+#include <trace.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
@@ -106,6 +107,10 @@ void window_size_callback(GLFWwindow *window, int width, int height) {
 #define ARR_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
 
 int main() {
+	//VULKANRUN_TRACE=<path> records a Chrome trace of every frame and writes it there on exit
+	const char *tracePath = getenv("VULKANRUN_TRACE");
+	EngineTraceEnable(tracePath != NULL);
+	EngineTraceSetThreadName("main");
 	glfwInit();
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
@@ -115,12 +120,16 @@ int main() {
 		.appName = "mammamia",
 		.displayName = DISPLAY_NAME,
 		.appVersion = MAKE_VERSION(0,0,1),
+		.pipelineCachePath = "vulkanrun_pipelines.bin",
 	};	
 	engineCreateInfo.extensions = glfwGetRequiredInstanceExtensions(&engineCreateInfo.extensionsCount);
 	
 	uintptr_t surface = 0, vkInstance = 0;
 	EngineInit(&engine_instance, engineCreateInfo, &vkInstance);
-	glfwCreateWindowSurface(vkInstance, window, NULL, &surface);
+	if(glfwCreateWindowSurface(vkInstance, window, NULL, &surface) != VK_SUCCESS) {
+		printf("couldn't create the window surface\n");
+		exit(-1);
+	}
 
 	const EngineObjectLimits limits = {
 		.maxSphereCount = MAX_SPHERE_COUNT,
@@ -133,12 +142,6 @@ int main() {
 	glfwSetWindowSizeCallback(window, window_size_callback);
 	EngineSwapchainCreate(engine_instance, bufferSize.width, bufferSize.height);
 
-	EngineSemaphore drawWaitSemaphore[2] = {0};
-	EngineSemaphore commandDoneSemaphore[2] = {0};
-	for(int i = 0; i < 2; i++) {
-		EngineCreateSemaphore(engine_instance, &commandDoneSemaphore[i]);
-	}
-
 	EngineCreateBuffer(engine_instance, &VSMatrices, ENGINE_BUFFER_STORAGE);
 	sendValues();
 
@@ -283,10 +286,7 @@ int main() {
 			.lightData = {-1,-1,0,0.7},
 	};
 	EngineLoadSunlight(engine_instance, sunlight);
-	char shaderPath[] = "/src/shaders/raytrace.spv";
-	char path[sizeof(PROJECT_PATH) + sizeof(shaderPath)] = PROJECT_PATH;
-	strcat(path, shaderPath);
-	FILE *shader = fopen(path, "rb");
+	FILE *shader = fopen(RAYTRACE_SPV_PATH, "rb");
 	if(shader == NULL) {
 		printf("womp womp bad path\n");
 		exit(-1);
@@ -303,24 +303,10 @@ int main() {
 		.code = shaderCode
 	};
 
-	EngineBuffer randBuffer = {
-		.elementByteSize = sizeof(uint32_t),
-		.length = 2,
-		.isAccessible = true
-	};
-	EngineCreateBuffer(engine_instance, &randBuffer, ENGINE_BUFFER_UNIFORM);
-	EngineAttachDataInfo attachInfo = {
-		.applyCount = ENGINE_ATTACH_DATA_ALL_FRAMES,
-		.binding = 5,
-		.content = {.buffer = randBuffer},
-		.startingIndex = 0,
-		.endIndex = 0,
-		.nextFrame = false,
-		.type = ENGINE_BUFFER_UNIFORM
-	};
-	EngineAttachData(engine_instance, attachInfo);
 	res = EngineLoadShaders(engine_instance, &shaderInfo, 1);
 	free(shaderCode);
+	//tuned over the first frames of the first run on a device, read back on every run after it
+	EngineAutotuneWorkgroupSize(engine_instance, "vulkanrun_workgroup.txt");
 	bool beingPressed[2] = {0,0};
 	uint32_t maxRays = 6;
 
@@ -333,6 +319,8 @@ int main() {
 	};
 	EngineCamera *camHandle = NULL;
 	EngineCreateCamera(engine_instance, &camHandle);
+	EngineSetAccumulation(engine_instance, true);
+	EngineSetTemporalReprojection(engine_instance, true, 0.2f);
 
 	const float velocity = 1;
 	const float rotational_velocity = 0.01;
@@ -349,14 +337,24 @@ int main() {
 
 	bool cursorLock = true;
 	bool beingLocked = false;
+	//one submission per frame where the device allows it
+	bool singleSubmit = EngineSingleSubmitSupported(engine_instance);
 
 	while(!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
 		if(isMinimised) {
 			continue;
 		}
-		EngineColor Color = {0.1, 0.5, 0.9, 1};
-		res = EngineDrawStart(engine_instance, Color, &drawWaitSemaphore[EngineGetFrame(engine_instance)]);
+		EngineFrameInfo frameInfo = {
+			.background = {0.1, 0.5, 0.9, 1},
+			.clear = true
+		};
+		EngineCommand cmd = 0;
+		if(singleSubmit) {
+			res = EngineFrameBegin(engine_instance, frameInfo, &cmd);
+		} else {
+			res = EngineDrawStart(engine_instance, frameInfo.background);
+		}
 		float time = glfwGetTime();
 		float deltaTime = time - previousTime;
 		frames++;
@@ -381,6 +379,7 @@ int main() {
 			beingPressed[0] = true;
 			if(maxRays < 20) {
 				maxRays++;
+				EngineResetAccumulation(engine_instance);
 				printf("maxRays: %zu\n", maxRays);
 			}
 		} else if(glfwGetKey(window, GLFW_KEY_UP) == GLFW_RELEASE) {
@@ -390,6 +389,7 @@ int main() {
 			beingPressed[1] = true;
 			if(maxRays > 1) {
 				maxRays--;
+				EngineResetAccumulation(engine_instance);
 				printf("maxRays: %zu\n", maxRays);
 			}
 		} else if(glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_RELEASE) {
@@ -446,23 +446,25 @@ int main() {
 		
  
 		memcpy(camHandle, &camera, sizeof(EngineCamera));
-		((float*)randBuffer.data)[0] = time * 1000;
-		((uint32_t*)randBuffer.data)[1] = maxRays;
-
-		EngineCommand cmd = 0;
-		EngineCreateCommand(engine_instance, &cmd);
+		float seed = time * 1000;
+		EngineRaytraceParams params = {.maxRays = maxRays};
+		memcpy(&params.initialSeed, &seed, sizeof(uint32_t));
+
+		EngineShaderRunInfo runInfo = EngineDispatchGrid(engine_instance, bufferSize.width, bufferSize.height);
+		if(singleSubmit) {
+			EngineRunRaytrace(engine_instance, cmd, 0, runInfo, params);
+			EngineFrameEnd(engine_instance);
+			continue;
+		}
+		//the seed changes every frame, so the dispatch is recorded every frame
+		bool needsRecording = false;
+		EngineFrameCommand(engine_instance, ENGINE_COMMAND_ONE_TIME, &cmd, &needsRecording);
 		EngineCommandRecordingStart(engine_instance, cmd, ENGINE_COMMAND_ONE_TIME);
-		EngineShaderRunInfo runInfo = {
-			.groupSizeX = ceilf((float)bufferSize.width/32.0f),
-			.groupSizeY = ceilf((float)bufferSize.height/32.0f),
-			.groupSizeZ = 1
-		};
-		EngineRunShader(engine_instance, cmd, 0, runInfo);
+		EngineRunRaytrace(engine_instance, cmd, 0, runInfo, params);
 		EngineCommandRecordingEnd(engine_instance, cmd);
-		EngineSubmitCommand(engine_instance, cmd, &drawWaitSemaphore[EngineGetFrame(engine_instance)], &commandDoneSemaphore[EngineGetFrame(engine_instance)]);
-		EngineDrawEnd(engine_instance, &commandDoneSemaphore[EngineGetFrame(engine_instance)]);
+		EngineSubmitCommand(engine_instance, cmd);
+		EngineDrawEnd(engine_instance);
 	}
-	EngineDestroyBuffer(engine_instance, randBuffer);
 	EngineDestroyCamera(engine_instance);
 
 	EngineDestroySphereBuffer(engine_instance);
@@ -475,10 +477,9 @@ int main() {
 	printf("destroyed matrices\n");
 	EngineSwapchainDestroy(engine_instance);
 	printf("destroyed swapchain\n");
-	for(size_t i = 0; i < 2; i++)
-		EngineDestroySemaphore(engine_instance, commandDoneSemaphore[i]);
-	printf("destroyed semaphore\n");
 	EngineDestroy(engine_instance);
+	if(tracePath != NULL && !EngineTraceDump(tracePath))
+		printf("could not write the trace to %s\n", tracePath);
 	glfwDestroyWindow(window);
 	glfwTerminate();
 }
\ No newline at end of file
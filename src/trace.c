@@ -0,0 +1,204 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <trace.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define TRACE_RING_CAPACITY (1 << 16)
+#define TRACE_GPU_THREAD_ID 0
+
+typedef struct {
+	const char *name;
+	uint64_t startNs, endNs;
+} TraceEvent;
+
+/*single producer ring; head counts every event ever written, so head % capacity is the next slot*/
+typedef struct TraceRing {
+	TraceEvent events[TRACE_RING_CAPACITY];
+	_Atomic uint64_t head;
+	uint32_t threadId;
+	const char *_Atomic threadName;
+	struct TraceRing *next;
+} TraceRing;
+
+static atomic_bool traceEnabled = false;
+static _Atomic(TraceRing*) traceRings = NULL;
+static _Atomic uint32_t nextThreadId = TRACE_GPU_THREAD_ID + 1;
+static _Thread_local TraceRing *localRing = NULL;
+static TraceRing *gpuRing = NULL;
+
+void EngineTraceEnable(bool enabled) {
+	atomic_store(&traceEnabled, enabled);
+}
+bool EngineTraceEnabled(void) {
+	return atomic_load_explicit(&traceEnabled, memory_order_relaxed);
+}
+
+uint64_t EngineTraceNow(void) {
+#ifdef _WIN32
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return EngineTraceHostTicksToNs(counter.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+uint64_t EngineTraceHostTicksToNs(uint64_t ticks) {
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return (uint64_t)((double)ticks * 1000000000.0 / (double)frequency.QuadPart);
+#else
+	return ticks;
+#endif
+}
+
+//rings are never freed, so a thread that exits still shows up in the dump
+static TraceRing *registerRing(uint32_t threadId) {
+	TraceRing *ring = calloc(1, sizeof(TraceRing));
+	if(ring == NULL)
+		return NULL;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->threadName, NULL);
+	ring->threadId = threadId;
+	ring->next = atomic_load(&traceRings);
+	while(!atomic_compare_exchange_weak(&traceRings, &ring->next, ring));
+	return ring;
+}
+
+static TraceRing *getLocalRing(void) {
+	if(localRing == NULL)
+		localRing = registerRing(atomic_fetch_add(&nextThreadId, 1));
+	return localRing;
+}
+
+static void pushEvent(TraceRing *ring, const char *name, uint64_t startNs, uint64_t endNs) {
+	uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	ring->events[head % TRACE_RING_CAPACITY] = (TraceEvent){name, startNs, endNs};
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void EngineTraceSetThreadName(const char *name) {
+	TraceRing *ring = getLocalRing();
+	if(ring != NULL)
+		atomic_store(&ring->threadName, name);
+}
+
+EngineTraceZone EngineTraceBegin(const char *name) {
+	EngineTraceZone zone = {name, 0};
+	if(EngineTraceEnabled())
+		zone.startNs = EngineTraceNow();
+	return zone;
+}
+
+void EngineTraceEnd(EngineTraceZone zone) {
+	if(zone.startNs == 0)
+		return;
+	uint64_t endNs = EngineTraceNow();
+	TraceRing *ring = getLocalRing();
+	if(ring != NULL)
+		pushEvent(ring, zone.name, zone.startNs, endNs);
+}
+
+void EngineTraceGpuZone(const char *name, uint64_t startNs, uint64_t endNs) {
+	if(!EngineTraceEnabled())
+		return;
+	if(gpuRing == NULL) {
+		gpuRing = registerRing(TRACE_GPU_THREAD_ID);
+		if(gpuRing == NULL)
+			return;
+		atomic_store(&gpuRing->threadName, "GPU");
+	}
+	pushEvent(gpuRing, name, startNs, endNs);
+}
+
+static void writeJsonString(FILE *file, const char *str) {
+	fputc('"', file);
+	for(; *str; str++) {
+		if(*str == '"' || *str == '\\')
+			fputc('\\', file);
+		if((unsigned char)*str >= 0x20)
+			fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+bool EngineTraceDump(const char *path) {
+	FILE *file = fopen(path, "w");
+	if(file == NULL)
+		return false;
+	TraceEvent *snapshot = malloc(sizeof(TraceEvent) * TRACE_RING_CAPACITY);
+	if(snapshot == NULL) {
+		fclose(file);
+		return false;
+	}
+
+	//timestamps are written relative to the oldest event so they stay readable
+	uint64_t originNs = UINT64_MAX;
+	for(TraceRing *ring = atomic_load(&traceRings); ring != NULL; ring = ring->next) {
+		uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		uint64_t first = head > TRACE_RING_CAPACITY ? head - TRACE_RING_CAPACITY : 0;
+		for(uint64_t i = first; i < head; i++) {
+			uint64_t startNs = ring->events[i % TRACE_RING_CAPACITY].startNs;
+			if(startNs < originNs)
+				originNs = startNs;
+		}
+	}
+	if(originNs == UINT64_MAX)
+		originNs = 0;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool firstEvent = true;
+	for(TraceRing *ring = atomic_load(&traceRings); ring != NULL; ring = ring->next) {
+		const char *threadName = atomic_load(&ring->threadName);
+		fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", firstEvent ? "" : ",\n", ring->threadId);
+		if(threadName != NULL) {
+			writeJsonString(file, threadName);
+		} else {
+			fprintf(file, "\"thread %u\"", ring->threadId);
+		}
+		fprintf(file, "}}");
+		firstEvent = false;
+
+		uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		uint64_t first = head > TRACE_RING_CAPACITY ? head - TRACE_RING_CAPACITY : 0;
+		for(uint64_t i = first; i < head; i++) {
+			snapshot[i - first] = ring->events[i % TRACE_RING_CAPACITY];
+		}
+		//the owner keeps writing while we copy, slots it may have reused in the meantime are dropped
+		//(writing event headAfter reuses the slot of event headAfter - capacity)
+		uint64_t headAfter = atomic_load_explicit(&ring->head, memory_order_acquire);
+		uint64_t valid = first;
+		if(headAfter + 1 > TRACE_RING_CAPACITY && headAfter + 1 - TRACE_RING_CAPACITY > valid)
+			valid = headAfter + 1 - TRACE_RING_CAPACITY;
+
+		for(uint64_t i = valid; i < head; i++) {
+			TraceEvent event = snapshot[i - first];
+			if(event.endNs < event.startNs || event.startNs < originNs)
+				continue;
+			fprintf(file, ",\n{\"ph\":\"X\",\"name\":");
+			writeJsonString(file, event.name);
+			fprintf(file, ",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				ring->threadId,
+				(double)(event.startNs - originNs) / 1000.0,
+				(double)(event.endNs - event.startNs) / 1000.0
+			);
+		}
+	}
+	fprintf(file, "\n]}\n");
+	free(snapshot);
+	return fclose(file) == 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Frame timeline tracing.
+ * Every thread records its zones into its own ring buffer without locks, the newest events overwrite the oldest.
+ * EngineTraceDump writes everything that is still in the rings as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+ * Zone names are stored as pointers, so they have to be string literals or otherwise outlive the dump.
+ */
+
+typedef struct {
+    const char *name;
+    uint64_t startNs; //0 when tracing was disabled at the start of the zone
+} EngineTraceZone;
+
+void EngineTraceEnable(bool enabled);
+bool EngineTraceEnabled(void);
+//nanoseconds on the host clock every event is recorded with (CLOCK_MONOTONIC, QueryPerformanceCounter on Windows)
+uint64_t EngineTraceNow(void);
+//converts a raw reading of that clock, as returned by vkGetCalibratedTimestampsEXT, to nanoseconds
+uint64_t EngineTraceHostTicksToNs(uint64_t ticks);
+void EngineTraceSetThreadName(const char *name);
+
+EngineTraceZone EngineTraceBegin(const char *name);
+void EngineTraceEnd(EngineTraceZone zone);
+//zone on the GPU track, already moved onto the host clock; only one thread may emit them at a time
+void EngineTraceGpuZone(const char *name, uint64_t startNs, uint64_t endNs);
+
+bool EngineTraceDump(const char *path);
@@ -29,4 +29,54 @@ void EngineHeapArrayDequeue(EngineHeapArray *heapArr, void *out) {
 void EngineHeapArrayPop(EngineHeapArray *heapArr, void *out) {
     heapArr->count--;
     memcpy(out,(char*)heapArr->arr + heapArr->count*heapArr->byteSize, sizeof(heapArr->byteSize)); 
-}
\ No newline at end of file
+}
+
+bool EngineCreateRingQueue(EngineRingQueue *queue, size_t capacity, size_t byteSize) {
+    queue->arr = malloc(capacity * byteSize);
+    queue->capacity = capacity;
+    queue->byteSize = byteSize;
+    queue->head = 0;
+    queue->count = 0;
+    return queue->arr != NULL;
+}
+
+void EngineDestroyRingQueue(EngineRingQueue *queue) {
+    free(queue->arr);
+    queue->arr = NULL;
+}
+bool EngineRingQueuePush(EngineRingQueue *queue, const void *in) {
+    if(queue->count == queue->capacity)
+        return false;
+    size_t tail = (queue->head + queue->count) % queue->capacity;
+    memcpy((char*)queue->arr + tail * queue->byteSize, in, queue->byteSize);
+    queue->count++;
+    return true;
+}
+bool EngineRingQueuePop(EngineRingQueue *queue, void *out) {
+    if(queue->count == 0)
+        return false;
+    memcpy(out, (char*)queue->arr + queue->head * queue->byteSize, queue->byteSize);
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return true;
+}
+
+bool EngineCreateArena(EngineArena *arena, size_t capacity) {
+    arena->data = malloc(capacity);
+    arena->capacity = capacity;
+    arena->offset = 0;
+    return arena->data != NULL;
+}
+
+void EngineDestroyArena(EngineArena *arena) {
+    free(arena->data);
+    arena->data = NULL;
+}
+//alignment has to be a power of two
+void *EngineArenaAlloc(EngineArena *arena, size_t byteSize, size_t alignment) {
+    size_t offset = (arena->offset + alignment - 1) & ~(alignment - 1);
+    if(offset + byteSize > arena->capacity)
+        return NULL;
+    arena->offset = offset + byteSize;
+    return arena->data + offset;
+}
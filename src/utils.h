@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 inline void debug_msg(const char *format, ...) {
 #ifndef NDEBUG
@@ -28,4 +29,27 @@ void EngineDestroyHeapArray(EngineHeapArray *heapArr);
 void EngineHeapArrayEnqueue(EngineHeapArray *heapArr, void *in);
 void EngineHeapArrayDequeue(EngineHeapArray *heapArr, void *out);
 #define EngineHeapArraypush(heapArr, in) EngineHeapArrayEnqueue(heapArr, in)
-void EngineHeapArrayPop(EngineHeapArray *heapArr, void *out);
\ No newline at end of file
+void EngineHeapArrayPop(EngineHeapArray *heapArr, void *out);
+
+//fixed capacity FIFO; pushing fails once it is full instead of growing
+typedef struct {
+	size_t capacity, head, count;
+	size_t byteSize;
+	void *arr;
+} EngineRingQueue;
+
+bool EngineCreateRingQueue(EngineRingQueue *queue, size_t capacity, size_t byteSize);
+void EngineDestroyRingQueue(EngineRingQueue *queue);
+bool EngineRingQueuePush(EngineRingQueue *queue, const void *in);
+bool EngineRingQueuePop(EngineRingQueue *queue, void *out);
+
+//linear allocator for data that only lives until the next reset; allocating fails once it is full
+typedef struct {
+	size_t capacity, offset;
+	char *data;
+} EngineArena;
+
+bool EngineCreateArena(EngineArena *arena, size_t capacity);
+void EngineDestroyArena(EngineArena *arena);
+void *EngineArenaAlloc(EngineArena *arena, size_t byteSize, size_t alignment);
+#define EngineArenaReset(arena) ((arena)->offset = 0)